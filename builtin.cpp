@@ -1,4 +1,17 @@
 #include "builtin.h"
+#include "dir.h"
+#include "glob.h"
+#include "grep.h"
+#include "job.h"
+#include "output.h"
+#include "path.h"
+#include "place.h"
+#include "pool.h"
+#include "sync.h"
+#include "text.h"
+#include "utf.h"
+#include "vars.h"
+#include "walk.h"
 
 using namespace std;
 
@@ -21,8 +34,9 @@ static bool vcmp(const WCHAR * a, const WCHAR * b)
     return b[0] != L'-' ? wcscmp(a, b) < 0 : false;
 }
 
-static int do_builtin_cd(vector<WCHAR *> &args)
+static int do_builtin_cd(vector<WCHAR *> &args, builtin_io &io)
 {
+    (void)io;
     WCHAR *dest = nullptr;
 
     if (args.size() == 1) {
@@ -34,14 +48,17 @@ static int do_builtin_cd(vector<WCHAR *> &args)
     return SetCurrentDirectoryW(dest) == TRUE ? 0 : 1;
 }
 
-static int do_builtin_pwd(vector<WCHAR *> &args)
+static int do_builtin_pwd(vector<WCHAR *> &args, builtin_io &io)
 {
     (void)args;
-    WCHAR cwd[MAX_PATH];
-    DWORD ret = GetCurrentDirectoryW(_countof(cwd), cwd);
+    tstring cwd;
 
-    cwd[ret] = WNULL;
-    wprintf(L"%s\n", cwd);
+    if (!current_dir(cwd)) {
+        io.out->printf(L"pwd: (error %d)\n", GetLastError());
+        return 1;
+    }
+
+    io.out->printf(L"%s\n", cwd.c_str());
     return 0;
 }
 
@@ -56,34 +73,27 @@ static inline void get_lwt(FILETIME time, WCHAR *buf, size_t len)
         local.wHour, local.wMinute, local.wSecond);
 }
 
-static int do_builtin_ls(vector<WCHAR *> &args)
+static int do_builtin_ls(vector<WCHAR *> &args, builtin_io &io)
 {
-    HANDLE find = INVALID_HANDLE_VALUE;
-    WIN32_FIND_DATAW data;
-    WCHAR dest[MAX_PATH] = L"*";
+    const WCHAR *dir = args.size() >= 2 ? args[1] : L".";
+    dir_iter it(dir);
 
-    if (args.size() >= 2) {
-        ZeroMemory(dest, _countof(dest));
-        swprintf_s(dest, _countof(dest), L"%s\\*", args[1]);
-    }
-
-    find = FindFirstFileW(dest, &data);
-    if (find == INVALID_HANDLE_VALUE) {
-        DWORD err = GetLastError();
+    if (it.error() != ERROR_SUCCESS) {
+        DWORD err = it.error();
         if (err == ERROR_PATH_NOT_FOUND || err == ERROR_FILE_NOT_FOUND) {
-            wprintf(L"%s: No such file or directory\n", args[1]);
+            io.out->printf(L"%s: No such file or directory\n", dir);
         } else {
-            wprintf(L"internal error %d\n", err);
+            io.out->printf(L"internal error %d\n", err);
         }
         return 1;
     }
 
-    wprintf(LSFMT, L"Mode", L"Last Write Time", L"Size", L"Name");
-    wprintf(LSFMT, L"----", L"---------------", L"----", L"----");
-    do {
-        WCHAR mode[10], lwt[20], length[20];
-        ZeroMemory(lwt, _countof(mode));
-        ZeroMemory(length, _countof(mode));
+    io.out->printf(LSFMT, L"Mode", L"Last Write Time", L"Size", L"Name");
+    io.out->printf(LSFMT, L"----", L"---------------", L"----", L"----");
+    while (it.next()) {
+        const WIN32_FIND_DATAW &data = it.entry();
+        WCHAR mode[10], lwt[20], length[24];
+        ULARGE_INTEGER size;
 
         wcscpy_s(mode, _countof(mode), L"----");
         if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
@@ -95,65 +105,79 @@ static int do_builtin_ls(vector<WCHAR *> &args)
         }
 
         get_lwt(data.ftLastWriteTime, lwt, _countof(lwt));
-        swprintf_s(length, _countof(length), L"%lu", data.nFileSizeHigh * (MAXDWORD + 1) + data.nFileSizeLow);
+        size.HighPart = data.nFileSizeHigh;
+        size.LowPart = data.nFileSizeLow;
+        swprintf_s(length, _countof(length), L"%llu", size.QuadPart);
 
-        wprintf(LSFMT, mode, lwt, length, data.cFileName);
-    } while (FindNextFileW(find, &data) != 0);
+        io.out->printf(LSFMT, mode, lwt, length, data.cFileName);
+    }
 
-    if (GetLastError() != ERROR_NO_MORE_FILES) {
-        wprintf(L"internal error %d\n", GetLastError());
-        FindClose(find);
+    if (it.error() != ERROR_SUCCESS) {
+        io.out->printf(L"internal error %d\n", it.error());
         return 1;
     }
 
-    FindClose(find);
     return 0;
 }
 
-[[noreturn]] static int do_builtin_exit(vector<WCHAR *> &args)
+// exit [n]; without n the shell exits with the status of the last pipeline
+static int do_builtin_exit(vector<WCHAR *> &args, builtin_io &io)
 {
-    (void)args;
-    exit(0);
+    int status = args.size() > 1 ? _wtoi(args[1]) : last_status();
+
+    // a subshell or a served request ends, and the shell goes on
+    if (in_subshell()) {
+        set_stopped(true);
+        return status;
+    }
+
+    // exit() does not unwind, so nothing else would flush
+    io.out->flush();
+    out_flush();
+    exit(status);
 }
 
-static void recursively_remove(WCHAR *dir)
+// dir is a long path; it is extended in place while walking and restored
+static void recursively_remove(tstring &dir, out_stream &out)
 {
-    HANDLE find = INVALID_HANDLE_VALUE;
-    WIN32_FIND_DATAW data;
-    WCHAR dest[MAX_PATH];
-    size_t n = wcslen(dir);
-
-    ZeroMemory(dest, _countof(dest));
-    wcscpy_s(dest, dir);
-    wcscat_s(dest, L"\\*");
+    size_t n = dir.size();
 
-    find = FindFirstFileW(dest, &data);
-    if (find == INVALID_HANDLE_VALUE) {
-        wprintf(L"internal error %d\n", GetLastError());
-        return;
-    }
+    {
+        dir_iter it(dir.c_str());
 
-    do {
-        wcscpy_s(&dest[n + 1], MAX_PATH - n - 1, data.cFileName);
-        if (wcscmp(data.cFileName, L".") == 0 || wcscmp(data.cFileName, L"..") == 0) {
-            continue;
+        if (it.error() != ERROR_SUCCESS) {
+            out.printf(L"internal error %d\n", it.error());
+            return;
         }
-        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-            recursively_remove(dest);
-        } else {
-            DeleteFileW(dest);
+
+        dir.append(L'\\');
+        while (it.next()) {
+            if (is_dot_dir(it.name())) {
+                continue;
+            }
+            dir.append(it.name());
+            // a junction is removed itself, never the tree it points to
+            if (it.is_dir() && !it.is_reparse()) {
+                recursively_remove(dir, out);
+            } else if (it.is_dir()) {
+                RemoveDirectoryW(dir.c_str());
+            } else {
+                DeleteFileW(dir.c_str());
+            }
+            dir.resize(n + 1);
         }
-    } while (FindNextFileW(find, &data) != 0);
 
-    if (GetLastError() != ERROR_NO_MORE_FILES) { 
-        wprintf(L"internal error %d\n", GetLastError());
+        if (it.error() != ERROR_SUCCESS) {
+            out.printf(L"internal error %d\n", it.error());
+        }
     }
 
-    FindClose(find);
-    RemoveDirectoryW(dir);
+    // the listing handle has to be closed before the directory can go
+    dir.resize(n);
+    RemoveDirectoryW(dir.c_str());
 }
 
-static int do_builtin_rm(vector<WCHAR *> &args)
+static int do_builtin_rm(vector<WCHAR *> &args, builtin_io &io)
 {
     size_t n = args.size();
     bool force = false, recurs = false;
@@ -176,7 +200,7 @@ static int do_builtin_rm(vector<WCHAR *> &args)
                     recurs = true;
                     break;
                 default:
-                    wprintf(L"unknown option %c\n", *p);
+                    io.out->printf(L"unknown option %c\n", *p);
                     return 1;
                 }
                 p++;
@@ -185,29 +209,34 @@ static int do_builtin_rm(vector<WCHAR *> &args)
     }
 
     if (i == n) {
-        wprintf(L"rm: missing operands\n");
+        io.out->printf(L"rm: missing operands\n");
         return 1;
     }
 
     for (; i < n; i++) {
         WCHAR *c = args[i];
-        DWORD attr = GetFileAttributesW(c);
+        tstring path;
+        DWORD attr = INVALID_FILE_ATTRIBUTES;
+        if (long_path(c, path)) {
+            attr = GetFileAttributesW(path.c_str());
+        }
         if (attr == INVALID_FILE_ATTRIBUTES) {
             if (!force) {
-                wprintf(L"rm: cannot remove '%s' (error %d)\n", c, GetLastError());
+                io.out->printf(L"rm: cannot remove '%s' (error %d)\n", c, GetLastError());
                 return 1;
             }
+            continue;
         }
         if (attr & FILE_ATTRIBUTE_DIRECTORY) {
             if (recurs) {
-                recursively_remove(c);
+                recursively_remove(path, *io.out);
             } else {
-                wprintf(L"rm: cannot remove '%s' Is a directory\n", c);
+                io.out->printf(L"rm: cannot remove '%s' Is a directory\n", c);
                 return 1;
             }
         } else {
-            if (DeleteFileW(c) == FALSE && !force) {
-                wprintf(L"rm: cannot remove '%s' (error %d)\n", c, GetLastError());
+            if (DeleteFileW(path.c_str()) == FALSE && !force) {
+                io.out->printf(L"rm: cannot remove '%s' (error %d)\n", c, GetLastError());
                 return 1;
             }
         }
@@ -216,18 +245,259 @@ static int do_builtin_rm(vector<WCHAR *> &args)
     return 0;
 }
 
-static int do_builtin_mkdir(vector<WCHAR *> &args)
+#define MKDIR_WORKERS 8
+
+// one directory of a mkdir -p; parents always come before their children
+struct mk_node {
+    tstring path;
+    const WCHAR *arg;    // the operand this is, or null for a missing parent
+    const WCHAR *from;   // the operand it was first planned for
+    size_t up;           // how many levels above from it is
+    size_t parent;       // index of the parent node, or -1 below the root
+    volatile LONG state; // MK_*
+};
+
+enum {
+    MK_PENDING,
+    MK_DONE,
+    MK_FAILED,
+};
+
+// the directories of one depth, created by a few pool workers
+struct mk_level {
+    vector<mk_node> *nodes;
+    out_stream *out;
+    const vector<size_t> *items;
+    volatile LONG next;
+    volatile LONG pending;
+    HANDLE done;
+};
+
+/*
+ * A missing parent is shown as the operand it was planned for with the
+ * levels below it taken off, the way it was typed; when that cannot be done
+ * (a trailing . or ..), as its full path without the \\?\ prefix.
+ */
+static void mk_name(const mk_node &node, tstring &name)
+{
+    const WCHAR *p = node.from;
+    size_t root = p[0] != WNULL && p[1] == L':' ? 2 : 0;
+    size_t n = wcslen(p);
+
+    if (p[root] == L'\\' || p[root] == L'/') {
+        root++;
+    }
+
+    for (size_t up = node.up; up > 0; up--) {
+        while (n > root && (p[n - 1] == L'\\' || p[n - 1] == L'/')) {
+            n--;
+        }
+        size_t end = n;
+        while (n > root && p[n - 1] != L'\\' && p[n - 1] != L'/') {
+            n--;
+        }
+        size_t len = end - n;
+        if (len == 0 || (p[n] == L'.' && (len == 1 || (len == 2 && p[n + 1] == L'.')))) {
+            n = 0;
+            break;
+        }
+    }
+    while (n > root && (p[n - 1] == L'\\' || p[n - 1] == L'/')) {
+        n--;
+    }
+
+    name.clear();
+    if (n > 0) {
+        name.append(p, n);
+    } else if (wcsncmp(node.path.c_str(), L"\\\\?\\UNC\\", 8) == 0) {
+        name.append(L"\\\\");
+        name.append(node.path.c_str() + 8);
+    } else if (wcsncmp(node.path.c_str(), L"\\\\?\\", 4) == 0) {
+        name.append(node.path.c_str() + 4);
+    } else {
+        name.append(node.path);
+    }
+}
+
+static void make_one(vector<mk_node> &nodes, mk_node &node, out_stream &out)
+{
+    DWORD attr;
+
+    if (node.parent != (size_t)-1 && nodes[node.parent].state != MK_DONE) {
+        if (node.arg) {
+            out.printf(L"mkdir: cannot create %s (error %d)\n", node.arg, ERROR_PATH_NOT_FOUND);
+        }
+        node.state = MK_FAILED;
+        return;
+    }
+    if (CreateDirectoryW(node.path.c_str(), nullptr)) {
+        node.state = MK_DONE;
+        return;
+    }
+
+    DWORD err = GetLastError();
+    attr = GetFileAttributesW(node.path.c_str());
+    if (attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY)) {
+        node.state = MK_DONE;
+        return;
+    }
+    if (node.arg) {
+        out.printf(L"mkdir: cannot create %s (error %d)\n", node.arg, err);
+    } else {
+        tstring name;
+        mk_name(node, name);
+        out.printf(L"mkdir: cannot create %s (error %d)\n", name.c_str(), err);
+    }
+    node.state = MK_FAILED;
+}
+
+static void CALLBACK make_level(PTP_CALLBACK_INSTANCE inst, void *param)
+{
+    (void)inst;
+    mk_level *lv = (mk_level *)param;
+    size_t i;
+
+    while ((i = (size_t)InterlockedIncrement(&lv->next) - 1) < lv->items->size()) {
+        make_one(*lv->nodes, (*lv->nodes)[(*lv->items)[i]], *lv->out);
+    }
+    if (InterlockedDecrement(&lv->pending) == 0) {
+        SetEvent(lv->done);
+    }
+}
+
+// adds path and its missing ancestors; known prefixes are looked up, not checked again
+static void mk_plan(const tstring &path, const WCHAR *arg, vector<mk_node> &nodes,
+                    unordered_map<wstring, size_t> &known, vector<vector<size_t>> &levels)
+{
+    size_t root = root_length(path.c_str());
+    size_t parent = (size_t)-1;
+    size_t depth = 0;
+    size_t n = path.size();
+    size_t first = nodes.size();
+
+    while (n > root && path[(unsigned)n - 1] == L'\\') {
+        n--;
+    }
+
+    for (size_t i = root; i < n; i++) {
+        if (i + 1 < n && path[(unsigned)i + 1] != L'\\') {
+            continue;
+        }
+        wstring key(path.c_str(), i + 1);
+        auto it = known.find(key);
+        if (it == known.end()) {
+            it = known.emplace(std::move(key), nodes.size()).first;
+            nodes.push_back(mk_node{tstring(path.c_str(), i + 1), nullptr, arg, depth, parent, MK_PENDING});
+            if (levels.size() <= depth) {
+                levels.resize(depth + 1);
+            }
+            levels[depth].push_back(it->second);
+        }
+        if (i + 1 == n && !nodes[it->second].arg) {
+            nodes[it->second].arg = arg;
+        }
+        parent = it->second;
+        depth++;
+    }
+    // the new nodes hold their depth so far; make it their distance from the operand
+    for (size_t k = first; k < nodes.size(); k++) {
+        nodes[k].up = depth - 1 - nodes[k].up;
+    }
+}
+
+static int make_parents(vector<const WCHAR *> &dirs, out_stream &out)
+{
+    vector<mk_node> nodes;
+    unordered_map<wstring, size_t> known;
+    vector<vector<size_t>> levels;
+    mk_level lv;
+    int ret = 0;
+
+    for (const WCHAR *d : dirs) {
+        tstring path;
+        if (!long_path(d, path)) {
+            out.printf(L"mkdir: cannot create %s (error %d)\n", d, GetLastError());
+            ret = 1;
+            continue;
+        }
+        mk_plan(path, d, nodes, known, levels);
+    }
+
+    lv.nodes = &nodes;
+    lv.out = &out;
+    lv.done = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    for (const vector<size_t> &items : levels) {
+        size_t workers = min(items.size(), (size_t)MKDIR_WORKERS);
+
+        // siblings are created concurrently, each level only after its parents
+        lv.items = &items;
+        lv.next = 0;
+        lv.pending = 1;
+        ResetEvent(lv.done);
+        for (size_t w = 1; w < workers && lv.done; w++) {
+            InterlockedIncrement(&lv.pending);
+            if (!TrySubmitThreadpoolCallback(make_level, &lv, nullptr)) {
+                InterlockedDecrement(&lv.pending);
+                break;
+            }
+        }
+        make_level(nullptr, &lv);
+        if (lv.done) {
+            WaitForSingleObject(lv.done, INFINITE);
+        }
+    }
+    if (lv.done) {
+        CloseHandle(lv.done);
+    }
+
+    for (const mk_node &node : nodes) {
+        if (node.state != MK_DONE) {
+            ret = 1;
+            break;
+        }
+    }
+
+    return ret;
+}
+
+static int do_builtin_mkdir(vector<WCHAR *> &args, builtin_io &io)
 {
     size_t n = args.size();
+    vector<const WCHAR *> dirs;
+    bool parents = false;
 
-    if (n == 1) {
-        wprintf(L"mkdir: missing operand\n");
+    for (size_t i = 1; i < n; i++) {
+        if (args[i][0] != L'-') {
+            dirs.push_back(args[i]);
+            continue;
+        }
+        WCHAR *p = args[i] + 1;
+        while (*p != WNULL) {
+            switch (*p) {
+            case L'p':
+                parents = true;
+                break;
+            default:
+                io.out->printf(L"unknown option %c\n", *p);
+                return 1;
+            }
+            p++;
+        }
+    }
+
+    if (dirs.empty()) {
+        io.out->printf(L"mkdir: missing operand\n");
         return 1;
     }
 
-    for (size_t i = 1; i < n; i++) {
-        if (CreateDirectoryW(args[i], nullptr) == FALSE) {
-            wprintf(L"mkdir: cannot create %s (error %d)\n", args[i], GetLastError());
+    if (parents) {
+        return make_parents(dirs, *io.out);
+    }
+
+    for (const WCHAR *d : dirs) {
+        tstring path;
+        if (!long_path(d, path) || CreateDirectoryW(path.c_str(), nullptr) == FALSE) {
+            io.out->printf(L"mkdir: cannot create %s (error %d)\n", d, GetLastError());
             return 1;
         }
     }
@@ -235,39 +505,79 @@ static int do_builtin_mkdir(vector<WCHAR *> &args)
     return 0;
 }
 
-static inline int do_cat_one(WCHAR *file)
+static inline void cat_lines(u8string &o, const char *p, const char *e, int &count, bool &bol)
+{
+    char num[16];
+
+    while (p < e) {
+        if (bol) {
+            o.append(num, snprintf(num, sizeof(num), "%6d  ", ++count));
+        }
+        const char *nl = (const char *)memchr(p, '\n', e - p);
+        const char *q = nl ? nl + 1 : e;
+        o.append(p, q - p);
+        bol = nl != nullptr;
+        p = q;
+    }
+}
+
+static inline int do_cat_one(WCHAR *file, out_stream &out)
 {
-    FILE *fp;
-    int err = _wfopen_s(&fp, file, L"rtS, ccs=UNICODE");
-    WCHAR buf[512];
+    tstring path;
+    HANDLE fp = INVALID_HANDLE_VALUE;
+    vector<char> v(64 * 1024);
+    char *buf = v.data();
+    u8string o;
+    DWORD nread, keep = 0;
     int count = 0;
+    bool bol = true;
 
-    if (err) {
-        return err;
+    if (long_path(file, path)) {
+        fp = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                         FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    }
+    if (fp == INVALID_HANDLE_VALUE) {
+        return GetLastError();
     }
 
-    wprintf(L"%s\n-------\n", file);
-    while (fgetws(buf, _countof(buf), fp) != nullptr) {
-        wprintf(L"%6d  %s", ++count, buf);
+    // the file is UTF-8 already, so lines are copied as bytes; only a
+    // sequence split by the read boundary is held back for the next round
+    out.printf(L"%s\n-------\n", file);
+    while (ReadFile(fp, buf + keep, (DWORD)v.size() - keep, &nread, nullptr) != FALSE && nread > 0) {
+        size_t n = keep + nread;
+        size_t k = utf8_boundary(buf, n);
+
+        o.clear();
+        cat_lines(o, buf, buf + k, count, bol);
+        out.write(o.data(), o.size());
+
+        keep = (DWORD)(n - k);
+        memmove(buf, buf + k, keep);
     }
-    fputwc(L'\n', stdout);
+
+    o.clear();
+    cat_lines(o, buf, buf + keep, count, bol);
+    o.append('\n');
+    out.write(o.data(), o.size());
+
+    CloseHandle(fp);
     return 0;
 }
 
-static int do_builtin_cat(vector<WCHAR *> &args)
+static int do_builtin_cat(vector<WCHAR *> &args, builtin_io &io)
 {
     size_t n = args.size();
     int err;
 
     if (n == 1) {
-        wprintf(L"cat: missing operand\n");
+        io.out->printf(L"cat: missing operand\n");
         return 1;
     }
 
     for (size_t i = 1; i < n; i++) {
-        err = do_cat_one(args[i]);
+        err = do_cat_one(args[i], *io.out);
         if (err) {
-            wprintf(L"cat: file %s (error %d)\n", args[i], err);
+            io.out->printf(L"cat: file %s (error %d)\n", args[i], err);
             return 1;
         }
     }
@@ -275,19 +585,19 @@ static int do_builtin_cat(vector<WCHAR *> &args)
     return 0;
 }
 
-static int do_builtin_mv(vector<WCHAR *> &args)
+static int do_builtin_cp(vector<WCHAR *> &args, builtin_io &io)
 {
     BOOL err;
-    DWORD flag = 0;
     size_t n = args.size();
     size_t i;
     WCHAR *src = nullptr;
     WCHAR *dest = nullptr;
+    BOOL force = FALSE;
 
     for (i = 1; i < n; i++) {
         if (args[i][0] != L'-') {
             if (src && dest) {
-                wprintf(L"mv: more than one destination provided\n");
+                io.out->printf(L"cp: more than one destination provided\n");
                 return 1;
             }
             if (!src) {
@@ -301,10 +611,10 @@ static int do_builtin_mv(vector<WCHAR *> &args)
         while (*p != WNULL) {
             switch (*p) {
             case L'f':
-                flag |= MOVEFILE_REPLACE_EXISTING;
+                force = TRUE;
                 break;
             default:
-                wprintf(L"unknown option %c\n", *p);
+                io.out->printf(L"unknown option %c\n", *p);
                 return 1;
             }
             p++;
@@ -312,70 +622,562 @@ static int do_builtin_mv(vector<WCHAR *> &args)
     }
 
     if (!src || !dest) {
-        wprintf(L"mv: missing operands\n");
+        io.out->printf(L"cp: missing operands\n");
         return 1;
     }
 
-    err = MoveFileExW(src, dest, flag);
+    tstring from, to;
+    err = long_path(src, from) && long_path(dest, to) && CopyFileW(from.c_str(), to.c_str(), force);
     if (err == FALSE) {
-        wprintf(L"mv: %s -> %s failed (error %d)\n", src, dest, GetLastError());
+        io.out->printf(L"cp: %s -> %s failed (error %d)\n", src, dest, GetLastError());
         return 1;
     }
 
     return 0;
 }
 
-static int do_builtin_cp(vector<WCHAR *> &args)
+static inline ULONGLONG file_size(const WIN32_FIND_DATAW &data)
+{
+    ULARGE_INTEGER size;
+
+    size.HighPart = data.nFileSizeHigh;
+    size.LowPart = data.nFileSizeLow;
+    return size.QuadPart;
+}
+
+static inline void human_size(ULONGLONG n, WCHAR *buf, size_t len)
+{
+    static const WCHAR units[] = L"BKMGTP";
+    double v = (double)n;
+    unsigned u = 0;
+
+    while (v >= 1024 && units[u + 1] != WNULL) {
+        v /= 1024;
+        u++;
+    }
+
+    if (u == 0) {
+        swprintf_s(buf, len, L"%llu", n);
+    } else {
+        swprintf_s(buf, len, L"%.1f%c", v, units[u]);
+    }
+}
+
+// totals are updated from every walker thread without a lock
+struct du_stat {
+    volatile LONG64 bytes;
+    volatile LONG64 files;
+};
+
+static void du_visit(void *ctx, const tstring &path, const WIN32_FIND_DATAW &data)
+{
+    du_stat *st = (du_stat *)ctx;
+
+    (void)path;
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+        return;
+    }
+    InterlockedAdd64(&st->bytes, (LONG64)file_size(data));
+    InterlockedIncrement64(&st->files);
+}
+
+static int do_builtin_du(vector<WCHAR *> &args, builtin_io &io)
 {
-    BOOL err;
     size_t n = args.size();
-    size_t i;
-    WCHAR *src = nullptr;
-    WCHAR *dest = nullptr;
-    BOOL force = FALSE;
+    vector<const WCHAR *> roots;
+    bool human = false;
+    int ret = 0;
 
-    for (i = 1; i < n; i++) {
+    for (size_t i = 1; i < n; i++) {
         if (args[i][0] != L'-') {
-            if (src && dest) {
-                wprintf(L"cp: more than one destination provided\n");
+            roots.push_back(args[i]);
+            continue;
+        }
+        WCHAR *p = args[i] + 1;
+        while (*p != WNULL) {
+            switch (*p) {
+            case L'h':
+                human = true;
+                break;
+            default:
+                io.out->printf(L"unknown option %c\n", *p);
                 return 1;
             }
-            if (!src) {
-                src = args[i];
-            } else {
-                dest = args[i];
-            }
+            p++;
+        }
+    }
+
+    if (roots.empty()) {
+        roots.push_back(L".");
+    }
+
+    for (const WCHAR *root : roots) {
+        du_stat st = {0, 0};
+        WCHAR size[24];
+        int err = parallel_walk(root, du_visit, &st, *io.out);
+
+        if (err) {
+            ret = 1;
+        }
+        if (err < 0) {
+            continue;
+        }
+        if (human) {
+            human_size((ULONGLONG)st.bytes, size, _countof(size));
+        } else {
+            swprintf_s(size, _countof(size), L"%lld", (long long)st.bytes);
+        }
+        io.out->printf(L"%s\t%lld files\t%s\n", size, (long long)st.files, root);
+    }
+
+    return ret;
+}
+
+#define MOVE_UNBUFFERED (64ULL * 1024 * 1024) // larger files bypass the file cache
+#define MOVE_PROGRESS (256ULL * 1024 * 1024)  // smaller moves finish without a progress line
+#define MOVE_TICK 500                         // ms between progress updates
+
+// a move across volumes: every file is copied by its own thread pool item
+struct move_op {
+    size_t src_len;
+    const tstring *dest;
+    out_stream *out;
+    out_stream *err;
+    bool force;
+    bool show;
+    LONG64 total;
+    volatile LONG64 done;
+    volatile LONG64 next_tick;
+    volatile LONG pending;
+    volatile LONG failed;
+    HANDLE idle;
+};
+
+struct copy_job {
+    move_op *op;
+    tstring from;
+    tstring to;
+    DWORD flags;
+    LONG64 copied;
+};
+
+static void move_report(move_op *op, LONG64 done)
+{
+    WCHAR a[24], b[24], line[96];
+    int pct = 100, k;
+
+    // alternate data streams can push the count past the listed sizes
+    if (done < op->total) {
+        pct = (int)(done * 100 / op->total);
+    }
+    human_size((ULONGLONG)done, a, _countof(a));
+    human_size((ULONGLONG)op->total, b, _countof(b));
+    k = swprintf_s(line, _countof(line), L"\rmv: %s of %s (%d%%)   ", a, b, pct);
+    op->err->write(line, k);
+    op->err->flush();
+}
+
+static void move_progress(move_op *op, LONG64 delta)
+{
+    LONG64 done = InterlockedAdd64(&op->done, delta);
+    LONG64 due = op->next_tick;
+    LONG64 now = (LONG64)GetTickCount64();
+
+    // whoever moves the deadline prints; the others just add their bytes
+    if (op->show && now >= due &&
+        InterlockedCompareExchange64(&op->next_tick, now + MOVE_TICK, due) == due) {
+        move_report(op, done);
+    }
+}
+
+static DWORD CALLBACK copy_progress(LARGE_INTEGER total, LARGE_INTEGER copied, LARGE_INTEGER stream_size,
+                                    LARGE_INTEGER stream_copied, DWORD stream, DWORD reason, HANDLE src,
+                                    HANDLE dst, LPVOID data)
+{
+    copy_job *job = (copy_job *)data;
+
+    (void)total, (void)stream_size, (void)stream_copied, (void)stream, (void)reason, (void)src, (void)dst;
+    move_progress(job->op, copied.QuadPart - job->copied);
+    job->copied = copied.QuadPart;
+    return PROGRESS_CONTINUE;
+}
+
+static void move_finish(move_op *op)
+{
+    if (InterlockedDecrement(&op->pending) == 0) {
+        SetEvent(op->idle);
+    }
+}
+
+static void CALLBACK copy_one(PTP_CALLBACK_INSTANCE inst, void *param)
+{
+    (void)inst;
+    copy_job *job = (copy_job *)param;
+    move_op *op = job->op;
+    tstring from, to;
+
+    if (!long_path(job->from.c_str(), from) || !long_path(job->to.c_str(), to) ||
+        !CopyFileExW(from.c_str(), to.c_str(), copy_progress, job, nullptr, job->flags)) {
+        op->out->printf(L"mv: cannot copy %s (error %d)\n", job->from.c_str(), GetLastError());
+        InterlockedIncrement(&op->failed);
+    }
+
+    delete job;
+    move_finish(op);
+}
+
+static void move_visit(void *ctx, const tstring &path, const WIN32_FIND_DATAW &data)
+{
+    move_op *op = (move_op *)ctx;
+    tstring to(*op->dest), full;
+    DWORD flags = COPY_FILE_COPY_SYMLINK;
+
+    to.append(path.c_str() + op->src_len);
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+            op->out->printf(L"mv: cannot move directory link %s\n", path.c_str());
+            InterlockedIncrement(&op->failed);
+            return;
+        }
+        // the walker lists a directory only after this returns, so it exists before its files
+        if (!long_path(to.c_str(), full) || !CreateDirectoryW(full.c_str(), nullptr)) {
+            op->out->printf(L"mv: cannot create %s (error %d)\n", to.c_str(), GetLastError());
+            InterlockedIncrement(&op->failed);
+        }
+        return;
+    }
+
+    if (!op->force) {
+        flags |= COPY_FILE_FAIL_IF_EXISTS;
+    }
+    if (file_size(data) >= MOVE_UNBUFFERED) {
+        flags |= COPY_FILE_NO_BUFFERING;
+    }
+
+    copy_job *job = new copy_job{op, path, std::move(to), flags, 0};
+    InterlockedIncrement(&op->pending);
+    if (!TrySubmitThreadpoolCallback(copy_one, job, nullptr)) {
+        copy_one(nullptr, job);
+    }
+}
+
+// copies src to dest and deletes src once every file has arrived
+static bool move_across(const WCHAR *src, const tstring &dest, bool force, builtin_io &io)
+{
+    move_op op = {wcslen(src), &dest, io.out, io.err, force, false, 0, 0, 0, 1, 0, nullptr};
+    tstring from, to;
+    DWORD attr = INVALID_FILE_ATTRIBUTES;
+    int err;
+
+    if (long_path(src, from)) {
+        attr = GetFileAttributesW(from.c_str());
+    }
+    if (attr == INVALID_FILE_ATTRIBUTES) {
+        io.out->printf(L"mv: cannot access %s (error %d)\n", src, GetLastError());
+        return false;
+    }
+
+    // sizing the tree costs a second listing, so it is only done for a console
+    if (is_console(io.err->handle())) {
+        du_stat st = {0, 0};
+        if (parallel_walk(src, du_visit, &st, *io.out) < 0) {
+            return false;
+        }
+        op.total = st.bytes;
+        op.show = (ULONGLONG)op.total >= MOVE_PROGRESS;
+        op.next_tick = (LONG64)GetTickCount64() + MOVE_TICK;
+    }
+
+    if ((attr & FILE_ATTRIBUTE_DIRECTORY) &&
+        (!long_path(dest.c_str(), to) || !CreateDirectoryW(to.c_str(), nullptr))) {
+        io.out->printf(L"mv: cannot create %s (error %d)\n", dest.c_str(), GetLastError());
+        return false;
+    }
+
+    op.idle = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!op.idle) {
+        io.out->printf(L"mv: internal error %d\n", GetLastError());
+        return false;
+    }
+    err = parallel_walk(src, move_visit, &op, *io.out);
+    move_finish(&op);
+    WaitForSingleObject(op.idle, INFINITE);
+    CloseHandle(op.idle);
+
+    if (op.show) {
+        move_report(&op, op.done);
+        io.err->write(L"\n", 1);
+    }
+    if (err || op.failed) {
+        io.out->printf(L"mv: %s was not removed, the copy is incomplete\n", src);
+        return false;
+    }
+
+    if (attr & FILE_ATTRIBUTE_DIRECTORY) {
+        recursively_remove(from, *io.out);
+    } else if (!DeleteFileW(from.c_str())) {
+        io.out->printf(L"mv: cannot remove %s (error %d)\n", src, GetLastError());
+        return false;
+    }
+    return true;
+}
+
+static inline void trim_slashes(WCHAR *p)
+{
+    size_t k = wcslen(p);
+
+    // a drive root keeps its separator
+    while (k > 1 && (p[k - 1] == L'\\' || p[k - 1] == L'/') && p[k - 2] != L':') {
+        p[--k] = WNULL;
+    }
+}
+
+static inline const WCHAR *base_name(const WCHAR *p)
+{
+    const WCHAR *b = p;
+
+    for (; *p != WNULL; p++) {
+        if (*p == L'\\' || *p == L'/' || *p == L':') {
+            b = p + 1;
+        }
+    }
+    return b;
+}
+
+static int do_builtin_mv(vector<WCHAR *> &args, builtin_io &io)
+{
+    size_t n = args.size();
+    vector<WCHAR *> srcs;
+    DWORD flag = 0;
+    int ret = 0;
+
+    for (size_t i = 1; i < n; i++) {
+        if (args[i][0] != L'-') {
+            trim_slashes(args[i]);
+            srcs.push_back(args[i]);
             continue;
         }
         WCHAR *p = args[i] + 1;
         while (*p != WNULL) {
             switch (*p) {
             case L'f':
-                force = TRUE;
+                flag |= MOVEFILE_REPLACE_EXISTING;
                 break;
             default:
-                wprintf(L"unknown option %c\n", *p);
+                io.out->printf(L"unknown option %c\n", *p);
                 return 1;
             }
             p++;
         }
     }
 
-    if (!src || !dest) {
-        wprintf(L"cp: missing operands\n");
+    if (srcs.size() < 2) {
+        io.out->printf(L"mv: missing operands\n");
         return 1;
     }
 
-    err = CopyFileW(src, dest, force);
-    if (err == FALSE) {
-        wprintf(L"cp: %s -> %s failed (error %d)\n", src, dest, GetLastError());
+    WCHAR *dest = srcs.back();
+    tstring path;
+    DWORD attr = INVALID_FILE_ATTRIBUTES;
+
+    srcs.pop_back();
+    if (long_path(dest, path)) {
+        attr = GetFileAttributesW(path.c_str());
+    }
+    bool into = attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY);
+    if (srcs.size() > 1 && !into) {
+        io.out->printf(L"mv: target %s is not a directory\n", dest);
         return 1;
     }
 
-    return 0;
+    for (WCHAR *src : srcs) {
+        tstring to(dest), from, full;
+
+        if (into) {
+            to.append(L'\\');
+            to.append(base_name(src));
+        }
+        if (!long_path(src, from) || !long_path(to.c_str(), full)) {
+            io.out->printf(L"mv: %s -> %s failed (error %d)\n", src, to.c_str(), GetLastError());
+            ret = 1;
+            continue;
+        }
+        // a rename within one volume is instant; anything else has to be copied
+        if (MoveFileExW(from.c_str(), full.c_str(), flag)) {
+            continue;
+        }
+        if (GetLastError() != ERROR_NOT_SAME_DEVICE) {
+            io.out->printf(L"mv: %s -> %s failed (error %d)\n", src, to.c_str(), GetLastError());
+            ret = 1;
+            continue;
+        }
+        if (!move_across(src, to, flag != 0, io)) {
+            ret = 1;
+        }
+    }
+
+    return ret;
+}
+
+enum cmp_op {
+    CMP_EQ,
+    CMP_LT,
+    CMP_GT,
+};
+
+struct find_query {
+    out_stream *out;
+    const WCHAR *name;
+    WCHAR type;
+    bool has_size;
+    cmp_op size_op;
+    LONGLONG size;
+    bool has_mtime;
+    cmp_op mtime_op;
+    LONGLONG mtime;
+    LONGLONG now;
+};
+
+static inline bool cmp_match(cmp_op op, LONGLONG a, LONGLONG b)
+{
+    return op == CMP_LT ? a < b : op == CMP_GT ? a > b : a == b;
+}
+
+// [+-]N with an optional k, M or G suffix when units is set
+static bool parse_cmp(const WCHAR *s, bool units, cmp_op &op, LONGLONG &v)
+{
+    WCHAR *end;
+
+    op = *s == L'+' ? CMP_GT : *s == L'-' ? CMP_LT : CMP_EQ;
+    if (op != CMP_EQ) {
+        s++;
+    }
+    if (!iswdigit(*s)) {
+        return false;
+    }
+
+    v = (LONGLONG)wcstoull(s, &end, 10);
+    if (units) {
+        switch (*end) {
+        case L'k':
+            v <<= 10;
+            end++;
+            break;
+        case L'M':
+            v <<= 20;
+            end++;
+            break;
+        case L'G':
+            v <<= 30;
+            end++;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return *end == WNULL;
+}
+
+static void find_visit(void *ctx, const tstring &path, const WIN32_FIND_DATAW &data)
+{
+    const find_query *q = (const find_query *)ctx;
+    bool is_dir = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+
+    if (q->type && (q->type == L'd') != is_dir) {
+        return;
+    }
+    if (q->name && !wildcard_match(q->name, wcslen(q->name), data.cFileName, wcslen(data.cFileName))) {
+        return;
+    }
+    if (q->has_size && !cmp_match(q->size_op, (LONGLONG)file_size(data), q->size)) {
+        return;
+    }
+    if (q->has_mtime) {
+        ULARGE_INTEGER t;
+        t.HighPart = data.ftLastWriteTime.dwHighDateTime;
+        t.LowPart = data.ftLastWriteTime.dwLowDateTime;
+        // whole days since the last write, in 100ns FILETIME ticks
+        LONGLONG days = (q->now - (LONGLONG)t.QuadPart) / (10000000LL * 86400);
+        if (!cmp_match(q->mtime_op, days, q->mtime)) {
+            return;
+        }
+    }
+
+    q->out->printf(L"%s\n", path.c_str());
+}
+
+static int do_builtin_find(vector<WCHAR *> &args, builtin_io &io)
+{
+    size_t n = args.size();
+    size_t i;
+    vector<const WCHAR *> roots;
+    find_query q = {};
+    FILETIME now;
+    ULARGE_INTEGER t;
+    int ret = 0;
+
+    q.out = io.out;
+
+    for (i = 1; i < n && args[i][0] != L'-'; i++) {
+        roots.push_back(args[i]);
+    }
+
+    for (; i < n; i++) {
+        WCHAR *opt = args[i];
+        WCHAR *val = i + 1 < n ? args[i + 1] : nullptr;
+
+        if (!val) {
+            io.out->printf(L"find: missing argument to %s\n", opt);
+            return 1;
+        }
+        if (wcscmp(opt, L"-name") == 0) {
+            q.name = val;
+        } else if (wcscmp(opt, L"-type") == 0) {
+            if (wcscmp(val, L"f") != 0 && wcscmp(val, L"d") != 0) {
+                io.out->printf(L"find: unknown type %s\n", val);
+                return 1;
+            }
+            q.type = val[0];
+        } else if (wcscmp(opt, L"-size") == 0) {
+            q.has_size = parse_cmp(val, true, q.size_op, q.size);
+            if (!q.has_size) {
+                io.out->printf(L"find: invalid size %s\n", val);
+                return 1;
+            }
+        } else if (wcscmp(opt, L"-mtime") == 0) {
+            q.has_mtime = parse_cmp(val, false, q.mtime_op, q.mtime);
+            if (!q.has_mtime) {
+                io.out->printf(L"find: invalid age %s\n", val);
+                return 1;
+            }
+        } else {
+            io.out->printf(L"find: unknown predicate %s\n", opt);
+            return 1;
+        }
+        i++;
+    }
+
+    GetSystemTimeAsFileTime(&now);
+    t.HighPart = now.dwHighDateTime;
+    t.LowPart = now.dwLowDateTime;
+    q.now = (LONGLONG)t.QuadPart;
+
+    if (roots.empty()) {
+        roots.push_back(L".");
+    }
+
+    for (const WCHAR *root : roots) {
+        if (parallel_walk(root, find_visit, &q, *io.out) != 0) {
+            ret = 1;
+        }
+    }
+
+    return ret;
 }
 
-const static struct command g_builtin[] = {
+// laid out at compile time, so startup has nothing to build
+static constexpr struct command g_builtin[] = {
     {L"cd", do_builtin_cd},
     {L"pwd", do_builtin_pwd},
     {L"ls", do_builtin_ls},
@@ -385,6 +1187,17 @@ const static struct command g_builtin[] = {
     {L"cat", do_builtin_cat},
     {L"mv", do_builtin_mv},
     {L"cp", do_builtin_cp},
+    {L"du", do_builtin_du},
+    {L"find", do_builtin_find},
+    {L"sync", do_builtin_sync},
+    {L"grep", do_builtin_grep},
+    {L"wc", do_builtin_wc},
+    {L"head", do_builtin_head},
+    {L"tail", do_builtin_tail},
+    {L"ulimit", do_builtin_ulimit},
+    {L"place", do_builtin_place},
+    {L"set", do_builtin_set},
+    {L"pool", do_builtin_pool},
 };
 
 const struct command *is_builtin(WCHAR *cmd)
@@ -394,8 +1207,9 @@ const struct command *is_builtin(WCHAR *cmd)
 
     while (k < n && !iswspace(cmd[k])) k++;
 
+    // the whole word must match, so "ca" is not taken for cat
     for (unsigned i = 0; i < ARRAYSIZE(g_builtin); i++) {
-        if (wcsncmp(cmd, g_builtin[i].cmd, k) == 0) {
+        if (k < ARRAYSIZE(g_builtin[i].cmd) && g_builtin[i].cmd[k] == WNULL && wcsncmp(cmd, g_builtin[i].cmd, k) == 0) {
             return &g_builtin[i];
         }
     }
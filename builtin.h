@@ -3,6 +3,7 @@
 #include <vector>
 #include <algorithm>
 #include <string>
+#include <unordered_map>
 
 #include <cstdio>
 #include <cstdlib>
@@ -10,9 +11,22 @@
 
 #include <Windows.h>
 
+#include "output.h"
+
 #define WNULL L'\0'
 
-using handler_t = int (*)(std::vector<WCHAR *> &);
+/*
+ * The standard streams of one builtin run. Builtins read and write only
+ * through these, never through the process-wide standard handles, so
+ * redirections need no handle swapping and builtins can run on any thread.
+ */
+struct builtin_io {
+    HANDLE in;
+    out_stream *out;
+    out_stream *err;
+};
+
+using handler_t = int (*)(std::vector<WCHAR *> &, builtin_io &);
 
 struct command {
     WCHAR cmd[8];
@@ -1,149 +1,264 @@
 #pragma once
 
+#include <cctype>
+#include <cwctype>
+
 #include <Windows.h>
 
-class tstring
+static inline size_t str_len(const WCHAR *s)
+{
+    return wcslen(s);
+}
+
+static inline size_t str_len(const char *s)
+{
+    return strlen(s);
+}
+
+static inline bool is_blank(WCHAR c)
+{
+    return iswspace(c) != 0;
+}
+
+static inline bool is_blank(char c)
+{
+    return isspace((unsigned char)c) != 0;
+}
+
+/*
+ * Small-string-optimized string of WCHAR (tstring) or UTF-8 bytes (u8string).
+ *
+ * Strings shorter than max_nr_in_stack characters (including the terminating
+ * null) live inside the object; longer ones are moved to the heap and grow
+ * geometrically. The content is always null-terminated, so data() can be
+ * handed to Win32 APIs directly.
+ */
+template <typename T>
+class basic_tstring
 {
     static const unsigned stack_size = 56;
-#define max_nr_in_stack (stack_size / type_size)
-#define type_size sizeof(WCHAR)
+    static const unsigned type_size = sizeof(T);
+    static const unsigned max_nr_in_stack = stack_size / type_size;
 
 public:
-    tstring()
+    basic_tstring()
     {
-        _size = 0;
-        _capacity = max_nr_in_stack;
-        ZeroMemory(_dummy, stack_size);
+        init();
     }
 
-    ~tstring()
+    basic_tstring(const T *t)
     {
+        init();
+        append(t);
+    }
+
+    basic_tstring(const T *t, size_t n)
+    {
+        init();
+        append(t, n);
+    }
+
+    basic_tstring(const basic_tstring &other)
+    {
+        init();
+        append(other.data(), other._size);
+    }
+
+    basic_tstring(basic_tstring &&other) noexcept
+    {
+        steal(other);
+    }
+
+    ~basic_tstring()
+    {
+        release();
+    }
+
+    basic_tstring &operator=(const basic_tstring &other)
+    {
+        if (this != &other) {
+            _size = 0;
+            append(other.data(), other._size);
+        }
+        return *this;
+    }
+
+    basic_tstring &operator=(basic_tstring &&other) noexcept
+    {
+        if (this != &other) {
+            release();
+            steal(other);
+        }
+        return *this;
+    }
+
+    // make room for at least n characters, not counting the terminating null
+    void reserve(size_t n)
+    {
+        if (n < _capacity) {
+            return;
+        }
+
+        size_t new_cap = (size_t)_capacity * 2;
+        if (new_cap < n + 1) {
+            new_cap = n + 1;
+        }
+
+        T *new_mem = new T[new_cap];
+        memcpy(new_mem, data(), type_size * (_size + 1));
         if (!in_stack()) {
             delete[] _mem;
         }
+        _mem = new_mem;
+        _capacity = (unsigned)new_cap;
     }
 
-    void append(WCHAR c)
+    void append(T c)
     {
-        if (_size + 1 < _capacity) {
-            if (in_stack()) {
-                _content[_size] = c;
-            } else {
-                _mem[_size] = c;
-            }
-        } else {
-            unsigned new_cap = _capacity * 2;
-            WCHAR *new_mem = new WCHAR[new_cap]();
-            if (in_stack()) {
-                memmove_s(new_mem, type_size * new_cap, _content, type_size * _size);
-            } else {
-                memmove_s(new_mem, type_size * new_cap, _mem, type_size * _size);
-                delete[] _mem;
-            }
-            _mem = new_mem;
-            _capacity = new_cap;
-            _mem[_size] = c;
+        if (_size + 1 >= _capacity) {
+            reserve(_size + 1);
         }
-        _size++;
+
+        T *p = data();
+        p[_size++] = c;
+        p[_size] = T();
     }
 
-    void append(const WCHAR *t, size_t n)
+    void append(const T *t, size_t n)
     {
-        if (_size + n < _capacity) {
-            if (in_stack()) {
-                memcpy_s(&_content[_size], type_size * (_capacity - 1 - _size), t, type_size * n);
-            } else {
-                memcpy_s(&_mem[_size], type_size * (_capacity - 1 - _size), t, type_size * n);
-            }
-        } else {
-            unsigned new_cap = (_size + n) * 2;
-            WCHAR *new_mem = new WCHAR[new_cap]();
-            if (in_stack()) {
-                memmove_s(new_mem, type_size * new_cap, _content, type_size * _size);
-            } else {
-                memmove_s(new_mem, type_size * new_cap, _mem, type_size * _size);
-                delete[] _mem;
+        if (_size + n >= _capacity) {
+            // t may point into this string, whose buffer reserve() frees
+            const T *p = data();
+            bool own = t >= p && t <= p + _size;
+            size_t at = own ? t - p : 0;
+            reserve(_size + n);
+            if (own) {
+                t = data() + at;
             }
-            _mem = new_mem;
-            _capacity = new_cap;
-            memcpy_s(&_mem[_size], type_size * (_capacity - 1 - _size), t, type_size * n);
         }
-        _size += n;
+
+        T *p = data();
+        memcpy(&p[_size], t, type_size * n);
+        _size += (unsigned)n;
+        p[_size] = T();
+    }
+
+    void append(const T *t)
+    {
+        append(t, str_len(t));
+    }
+
+    void append(const basic_tstring &t)
+    {
+        append(t.data(), t._size);
     }
 
-    void append(const WCHAR *t)
+    // set the length after writing up to capacity() - 1 elements into data()
+    void resize(size_t n)
     {
-        append(t, wcslen(t));
+        reserve(n);
+        _size = (unsigned)n;
+        data()[_size] = T();
     }
 
+    // drop the content but keep the buffer for reuse
     void clear()
     {
         _size = 0;
-        if (in_stack()) {
-            ZeroMemory(_content, _countof(_content));
-        } else {
-            delete[] _mem;
-            _capacity = max_nr_in_stack;
-        }
+        data()[0] = T();
+    }
+
+    T *data()
+    {
+        return in_stack() ? _content : _mem;
     }
 
-    WCHAR *data()
+    const T *data() const
     {
         return in_stack() ? _content : _mem;
     }
 
-    WCHAR *c_str()
+    const T *c_str() const
     {
         return data();
     }
 
     void strip()
     {
-        WCHAR *c = in_stack() ? _content : _mem;
-        size_t n = _size;
-        size_t i = 0, j = n - 1;
+        T *c = data();
+        unsigned i = 0, j = _size;
 
-        while (i < n && iswspace(c[i])) i++;
-        while (j > i && iswspace(c[j])) j--;
-        _size = j - i + 1;
+        while (i < j && is_blank(c[i])) i++;
+        while (j > i && is_blank(c[j - 1])) j--;
+        _size = j - i;
 
-        memmove_s(c, _capacity * type_size, &c[i], _size * type_size);
-        c[_size] = WNULL;
+        if (i) {
+            memmove(c, &c[i], _size * type_size);
+        }
+        c[_size] = T();
     }
 
-    unsigned size()
+    unsigned size() const
     {
         return _size;
     }
 
-    unsigned capacity()
+    unsigned capacity() const
     {
         return _capacity;
     }
 
-    WCHAR operator[](unsigned i)
+    bool empty() const
     {
-        if (in_stack()) {
-            return _content[i];
-        } else {
-            return _mem[i];
-        }
+        return _size == 0;
+    }
+
+    T operator[](unsigned i) const
+    {
+        return data()[i];
     }
 
 protected:
-    bool in_stack()
+    // heap buffers are always larger than the inline one
+    bool in_stack() const
     {
-        return _capacity == max_nr_in_stack;
+        return _capacity <= max_nr_in_stack;
     }
 
 private:
+    void init()
+    {
+        _size = 0;
+        _capacity = max_nr_in_stack;
+        _content[0] = T();
+    }
+
+    void release()
+    {
+        if (!in_stack()) {
+            delete[] _mem;
+        }
+    }
+
+    void steal(basic_tstring &other)
+    {
+        _size = other._size;
+        _capacity = other._capacity;
+        if (other.in_stack()) {
+            memcpy(_content, other._content, type_size * (_size + 1));
+        } else {
+            _mem = other._mem;
+        }
+        other.init();
+    }
+
     unsigned int _size;
     unsigned int _capacity;
     union {
-        char _dummy[stack_size];
-        WCHAR _content[stack_size / type_size];
-        struct {
-            WCHAR *_mem;
-        };
+        T _content[max_nr_in_stack];
+        T *_mem;
     };
 };
+
+using tstring = basic_tstring<WCHAR>;
+using u8string = basic_tstring<char>;
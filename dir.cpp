@@ -0,0 +1,54 @@
+#include "dir.h"
+#include "path.h"
+
+dir_iter::dir_iter(const WCHAR *dir) : _find(INVALID_HANDLE_VALUE), _err(ERROR_SUCCESS), _first(true)
+{
+    tstring query;
+
+    if (!long_path(*dir ? dir : L".", query)) {
+        _err = GetLastError();
+        return;
+    }
+
+    if (query[query.size() - 1] != L'\\') {
+        query.append(L'\\');
+    }
+    query.append(L'*');
+
+    _find = FindFirstFileExW(query.c_str(), FindExInfoBasic, &_data, FindExSearchNameMatch, nullptr,
+                             FIND_FIRST_EX_LARGE_FETCH);
+    if (_find == INVALID_HANDLE_VALUE) {
+        _err = GetLastError();
+    }
+}
+
+dir_iter::~dir_iter()
+{
+    if (_find != INVALID_HANDLE_VALUE) {
+        FindClose(_find);
+    }
+}
+
+bool dir_iter::next()
+{
+    if (_find == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    if (_first) {
+        _first = false;
+        return true;
+    }
+
+    if (FindNextFileW(_find, &_data) == 0) {
+        DWORD err = GetLastError();
+        if (err != ERROR_NO_MORE_FILES) {
+            _err = err;
+        }
+        FindClose(_find);
+        _find = INVALID_HANDLE_VALUE;
+        return false;
+    }
+
+    return true;
+}
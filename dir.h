@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Windows.h>
+
+/*
+ * Directory listing shared by the builtins and globbing.
+ *
+ * FindFirstFileExW with FindExInfoBasic skips the 8.3 name lookup, and
+ * FIND_FIRST_EX_LARGE_FETCH lets the file system return entries in larger
+ * batches, which matters most on directories with many entries. The query
+ * path goes through long_path(), so deep trees can be listed as well.
+ */
+
+static inline bool is_dot_dir(const WCHAR *name)
+{
+    return name[0] == L'.' && (name[1] == L'\0' || (name[1] == L'.' && name[2] == L'\0'));
+}
+
+class dir_iter
+{
+public:
+    explicit dir_iter(const WCHAR *dir);
+    ~dir_iter();
+
+    dir_iter(const dir_iter &) = delete;
+    dir_iter &operator=(const dir_iter &) = delete;
+
+    // advances to the next entry, . and .. included; false at the end or on error
+    bool next();
+
+    // ERROR_SUCCESS unless opening or reading the directory failed
+    DWORD error() const
+    {
+        return _err;
+    }
+
+    const WIN32_FIND_DATAW &entry() const
+    {
+        return _data;
+    }
+
+    const WCHAR *name() const
+    {
+        return _data.cFileName;
+    }
+
+    bool is_dir() const
+    {
+        return (_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    }
+
+    bool is_reparse() const
+    {
+        return (_data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+    }
+
+private:
+    HANDLE _find;
+    DWORD _err;
+    bool _first;
+    WIN32_FIND_DATAW _data;
+};
@@ -0,0 +1,266 @@
+#include <algorithm>
+
+#include "dir.h"
+#include "glob.h"
+
+using namespace std;
+
+namespace {
+
+struct component {
+    const WCHAR *s;
+    size_t n;
+    bool glob;
+    bool recursive;
+};
+
+struct globber {
+    vector<component> comps;
+    vector<tstring> &out;
+    WCHAR sep;
+
+    globber(vector<tstring> &o, WCHAR separator) : out(o), sep(separator) {}
+
+    bool wants(const component &c, const WCHAR *name, size_t n)
+    {
+        // * and ? never match a leading dot
+        if (name[0] == L'.' && c.s[0] != L'.') {
+            return false;
+        }
+        return wildcard_match(c.s, c.n, name, n);
+    }
+
+    void walk(tstring &base, size_t idx);
+    void walk_recursive(tstring &base, size_t idx);
+};
+
+} // namespace
+
+static inline bool is_sep(WCHAR c)
+{
+    return c == L'\\' || c == L'/';
+}
+
+bool has_glob(const WCHAR *s, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] == L'*' || s[i] == L'?' || s[i] == L'[') {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Matches one pattern element at pat[p] against c. A '[' without a closing
+ * ']' is an ordinary character. *adv receives the element's length.
+ */
+static bool match_one(const WCHAR *pat, size_t pn, size_t p, WCHAR c, size_t *adv)
+{
+    WCHAR lc = towlower(c);
+
+    if (pat[p] == L'?') {
+        *adv = 1;
+        return true;
+    }
+
+    if (pat[p] == L'[') {
+        size_t q = p + 1;
+        bool negate = false;
+        bool found = false;
+
+        if (q < pn && (pat[q] == L'!' || pat[q] == L'^')) {
+            negate = true;
+            q++;
+        }
+        size_t first = q;
+        while (q < pn && (pat[q] != L']' || q == first)) {
+            WCHAR lo = towlower(pat[q]);
+            WCHAR hi = lo;
+            if (q + 2 < pn && pat[q + 1] == L'-' && pat[q + 2] != L']') {
+                hi = towlower(pat[q + 2]);
+                q += 2;
+            }
+            if (lc >= lo && lc <= hi) {
+                found = true;
+            }
+            q++;
+        }
+        if (q < pn) {
+            *adv = q + 1 - p;
+            return found != negate;
+        }
+    }
+
+    *adv = 1;
+    return towlower(pat[p]) == lc;
+}
+
+/*
+ * Greedy matching that only ever remembers the most recent '*': on a
+ * mismatch the star absorbs one more character and matching resumes after
+ * it. No recursion, and O(pn * sn) in the worst case.
+ */
+bool wildcard_match(const WCHAR *pat, size_t pn, const WCHAR *s, size_t sn)
+{
+    const size_t none = (size_t)-1;
+    size_t p = 0, i = 0;
+    size_t star_p = none, star_i = 0;
+    size_t adv;
+
+    while (i < sn) {
+        if (p < pn && pat[p] == L'*') {
+            star_p = ++p;
+            star_i = i;
+            continue;
+        }
+        if (p < pn && match_one(pat, pn, p, s[i], &adv)) {
+            p += adv;
+            i++;
+            continue;
+        }
+        if (star_p == none) {
+            return false;
+        }
+        p = star_p;
+        i = ++star_i;
+    }
+
+    while (p < pn && pat[p] == L'*') p++;
+    return p == pn;
+}
+
+void globber::walk(tstring &base, size_t idx)
+{
+    size_t keep = base.size();
+
+    // literal components need no directory listing
+    while (idx < comps.size() && !comps[idx].glob) {
+        base.append(comps[idx].s, comps[idx].n);
+        if (++idx < comps.size()) {
+            base.append(sep);
+        }
+    }
+
+    if (idx == comps.size()) {
+        if (GetFileAttributesW(base.c_str()) != INVALID_FILE_ATTRIBUTES) {
+            out.push_back(base);
+        }
+        base.resize(keep);
+        return;
+    }
+
+    if (comps[idx].recursive) {
+        walk_recursive(base, idx + 1);
+        base.resize(keep);
+        return;
+    }
+
+    const component &c = comps[idx];
+    bool last = idx + 1 == comps.size();
+    size_t dir_len = base.size();
+    dir_iter it(base.c_str());
+
+    while (it.next()) {
+        size_t n = wcslen(it.name());
+        if (is_dot_dir(it.name()) || !wants(c, it.name(), n)) {
+            continue;
+        }
+        base.append(it.name(), n);
+        if (last) {
+            out.push_back(base);
+        } else if (it.is_dir()) {
+            base.append(sep);
+            walk(base, idx + 1);
+        }
+        base.resize(dir_len);
+    }
+
+    base.resize(keep);
+}
+
+/*
+ * ** matches zero or more directories. Each directory is listed once: its
+ * entries are matched against the component after ** and, if they are
+ * directories, descended into.
+ */
+void globber::walk_recursive(tstring &base, size_t idx)
+{
+    size_t dir_len = base.size();
+    dir_iter it(base.c_str());
+
+    while (it.next()) {
+        const WCHAR *name = it.name();
+        size_t n = wcslen(name);
+        bool is_dir = it.is_dir();
+        bool hidden = name[0] == L'.';
+        if (is_dot_dir(name)) {
+            continue;
+        }
+
+        base.append(name, n);
+        if (idx == comps.size()) {
+            if (!hidden) {
+                out.push_back(base);
+            }
+        } else if (wants(comps[idx], name, n)) {
+            if (idx + 1 == comps.size()) {
+                out.push_back(base);
+            } else if (is_dir) {
+                base.append(sep);
+                walk(base, idx + 1);
+                base.resize(dir_len + n);
+            }
+        }
+        // junctions and symlinks are not followed, so cycles are impossible
+        if (is_dir && !hidden && !it.is_reparse()) {
+            base.append(sep);
+            walk_recursive(base, idx);
+        }
+        base.resize(dir_len);
+    }
+}
+
+bool glob_expand(const WCHAR *pattern, size_t n, vector<tstring> &out)
+{
+    size_t first = out.size();
+    size_t i = 0;
+    WCHAR sep = L'\\';
+    tstring base;
+
+    for (size_t k = 0; k < n; k++) {
+        if (is_sep(pattern[k])) {
+            sep = pattern[k];
+            break;
+        }
+    }
+
+    globber g(out, sep);
+
+    // a leading separator (or \\ of a UNC path) stays part of the base
+    while (i < n && is_sep(pattern[i])) {
+        base.append(pattern[i++]);
+    }
+
+    while (i < n) {
+        size_t j = i;
+        while (j < n && !is_sep(pattern[j])) j++;
+        component c = {&pattern[i], j - i, has_glob(&pattern[i], j - i), false};
+        c.recursive = c.n == 2 && pattern[i] == L'*' && pattern[i + 1] == L'*';
+        g.comps.push_back(c);
+        while (j < n && is_sep(pattern[j])) j++;
+        i = j;
+    }
+
+    if (g.comps.empty()) {
+        return false;
+    }
+
+    g.walk(base, 0);
+
+    sort(out.begin() + first, out.end(), [](const tstring &a, const tstring &b) {
+        return wcscmp(a.c_str(), b.c_str()) < 0;
+    });
+
+    return out.size() > first;
+}
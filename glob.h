@@ -0,0 +1,20 @@
+#pragma once
+
+#include <vector>
+
+#include <Windows.h>
+
+#include "container.h"
+
+/*
+ * Shell globbing: * ? [...] within a path component and ** across
+ * directories. Names are matched case-insensitively, as NTFS does, and a
+ * leading dot has to be matched explicitly.
+ */
+
+bool has_glob(const WCHAR *s, size_t n);
+
+bool wildcard_match(const WCHAR *pat, size_t pn, const WCHAR *s, size_t sn);
+
+// appends the sorted matches of pattern to out; false if nothing matched
+bool glob_expand(const WCHAR *pattern, size_t n, std::vector<tstring> &out);
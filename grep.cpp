@@ -0,0 +1,671 @@
+#include <emmintrin.h>
+
+#include <cstdint>
+#include <unordered_map>
+
+#include "builtin.h"
+#include "grep.h"
+#include "output.h"
+#include "path.h"
+#include "scan.h"
+#include "utf.h"
+
+using namespace std;
+
+#define GREP_FLUSH (64 * 1024)
+#define GREP_AHEAD 8 // files searched in the background ahead of the one being printed
+#define GREP_MAX_ATOMS 63
+#define GREP_MAX_STATES 4096
+
+namespace {
+
+enum repeat {
+    REP_ONE,
+    REP_OPT,
+    REP_STAR,
+};
+
+struct atom {
+    uint64_t set[4];
+    repeat rep;
+};
+
+/*
+ * The regex is a sequence of atoms, so an NFA state is just "the first i
+ * atoms have matched" and a set of them fits in one 64-bit mask. DFA states
+ * are those masks, created on first use with their 256 transitions filled
+ * in as bytes are seen. Each thread works on its own copy.
+ */
+class matcher
+{
+public:
+    bool compile(const char *pat, size_t n, bool icase, out_stream &out);
+
+    // start of the first line in [p, e) that matches; *eol gets its end
+    const char *find_line(const char *p, const char *e, const char **eol);
+
+private:
+    const char *find_literal(const char *p, const char *e) const;
+    bool verify(const char *s) const;
+    bool match_regex(const char *p, const char *e);
+    bool parse_class(const char *pat, size_t n, size_t &i, atom &a, out_stream &out);
+    uint64_t closure(uint64_t s) const;
+    int add_state(uint64_t s);
+    int step(int s, unsigned char c);
+
+    bool _literal;
+    bool _icase;
+    bool _bol;
+    bool _eol;
+    u8string _lit;
+    vector<atom> _atoms;
+    vector<uint64_t> _states;
+    vector<int> _next;
+    unordered_map<uint64_t, int> _ids;
+};
+
+struct grep_opts {
+    bool count;
+    bool list;
+    bool number;
+    bool names;
+};
+
+struct grep_job {
+    matcher m;
+    const grep_opts *opts;
+    const WCHAR *file;
+    u8string name;
+    u8string out;
+    out_stream *sink;
+    HANDLE done;
+    unsigned long long lines;
+    unsigned long long matches;
+    DWORD err;
+};
+
+} // namespace
+
+static inline void set_byte(uint64_t *set, unsigned c)
+{
+    set[c >> 6] |= 1ULL << (c & 63);
+}
+
+static inline bool has_byte(const uint64_t *set, unsigned c)
+{
+    return (set[c >> 6] >> (c & 63)) & 1;
+}
+
+static inline void add_byte(uint64_t *set, unsigned c, bool icase)
+{
+    set_byte(set, c);
+    if (icase && c < 0x80 && isalpha(c)) {
+        set_byte(set, tolower(c));
+        set_byte(set, toupper(c));
+    }
+}
+
+static inline unsigned char fold(unsigned char c)
+{
+    return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+
+bool matcher::parse_class(const char *pat, size_t n, size_t &i, atom &a, out_stream &out)
+{
+    bool negate = false;
+    size_t first;
+
+    if (i < n && pat[i] == '^') {
+        negate = true;
+        i++;
+    }
+    first = i;
+    while (i < n && (pat[i] != ']' || i == first)) {
+        unsigned lo = (unsigned char)pat[i];
+        unsigned hi = lo;
+        if (i + 2 < n && pat[i + 1] == '-' && pat[i + 2] != ']') {
+            hi = (unsigned char)pat[i + 2];
+            i += 2;
+        }
+        for (unsigned c = lo; c <= hi; c++) {
+            add_byte(a.set, c, _icase);
+        }
+        i++;
+    }
+    if (i == n) {
+        out.printf(L"grep: unmatched [\n");
+        return false;
+    }
+    i++; // ']'
+
+    if (negate) {
+        for (int k = 0; k < 4; k++) {
+            a.set[k] = ~a.set[k];
+        }
+    }
+    return true;
+}
+
+bool matcher::compile(const char *pat, size_t n, bool icase, out_stream &out)
+{
+    size_t i = 0;
+
+    _icase = icase;
+    _bol = n > 0 && pat[0] == '^';
+    _eol = n > (size_t)_bol && pat[n - 1] == '$' && (n < 2 || pat[n - 2] != '\\');
+    if (_bol) {
+        i++;
+    }
+    if (_eol) {
+        n--;
+    }
+
+    _literal = !_bol && !_eol && i < n;
+    for (size_t k = i; k < n && _literal; k++) {
+        _literal = strchr(".[*+?\\", pat[k]) == nullptr;
+    }
+    if (_literal) {
+        for (; i < n; i++) {
+            _lit.append(icase ? (char)fold(pat[i]) : pat[i]);
+        }
+        return true;
+    }
+
+    while (i < n) {
+        atom a;
+        unsigned char c = pat[i++];
+
+        ZeroMemory(a.set, sizeof(a.set));
+        a.rep = REP_ONE;
+        switch (c) {
+        case '.':
+            for (unsigned k = 0; k < 256; k++) {
+                if (k != '\n') {
+                    set_byte(a.set, k);
+                }
+            }
+            break;
+        case '[':
+            if (!parse_class(pat, n, i, a, out)) {
+                return false;
+            }
+            break;
+        case '\\':
+            if (i == n) {
+                out.printf(L"grep: trailing backslash\n");
+                return false;
+            }
+            add_byte(a.set, (unsigned char)pat[i++], icase);
+            break;
+        case '*':
+        case '+':
+        case '?':
+            out.printf(L"grep: nothing to repeat before '%c'\n", c);
+            return false;
+        default:
+            add_byte(a.set, c, icase);
+            break;
+        }
+
+        if (i < n && (pat[i] == '*' || pat[i] == '+' || pat[i] == '?')) {
+            // x+ is x followed by x*
+            if (pat[i] == '+') {
+                _atoms.push_back(a);
+            }
+            a.rep = pat[i] == '?' ? REP_OPT : REP_STAR;
+            i++;
+        }
+        _atoms.push_back(a);
+
+        if (_atoms.size() > GREP_MAX_ATOMS) {
+            out.printf(L"grep: pattern too long\n");
+            return false;
+        }
+    }
+
+    add_state(closure(1));
+    return true;
+}
+
+// optional and starred atoms may be skipped without consuming input
+uint64_t matcher::closure(uint64_t s) const
+{
+    for (size_t i = 0; i < _atoms.size(); i++) {
+        if (((s >> i) & 1) && _atoms[i].rep != REP_ONE) {
+            s |= 1ULL << (i + 1);
+        }
+    }
+    return s;
+}
+
+int matcher::add_state(uint64_t s)
+{
+    auto it = _ids.find(s);
+
+    if (it != _ids.end()) {
+        return it->second;
+    }
+
+    int id = (int)_states.size();
+    _states.push_back(s);
+    _next.resize(_next.size() + 256, -1);
+    _ids.emplace(s, id);
+    return id;
+}
+
+int matcher::step(int s, unsigned char c)
+{
+    int t = _next[(size_t)s * 256 + c];
+    uint64_t from, to = 0;
+
+    if (t >= 0) {
+        return t;
+    }
+
+    from = _states[s];
+    for (size_t i = 0; i < _atoms.size(); i++) {
+        if (((from >> i) & 1) && has_byte(_atoms[i].set, c)) {
+            to |= _atoms[i].rep == REP_STAR ? 1ULL << i : 1ULL << (i + 1);
+        }
+    }
+    // without ^ a match may start at any byte
+    if (!_bol) {
+        to |= 1;
+    }
+    to = closure(to);
+
+    // a pathological pattern starts over instead of growing without bound
+    if (_states.size() >= GREP_MAX_STATES) {
+        _states.clear();
+        _next.clear();
+        _ids.clear();
+        add_state(closure(1));
+        return add_state(to);
+    }
+
+    t = add_state(to);
+    _next[(size_t)s * 256 + c] = t;
+    return t;
+}
+
+bool matcher::match_regex(const char *p, const char *e)
+{
+    uint64_t accept = 1ULL << _atoms.size();
+    int s = 0;
+
+    if (!_eol && (_states[s] & accept)) {
+        return true;
+    }
+
+    for (; p < e; p++) {
+        s = step(s, (unsigned char)*p);
+        if (!_eol && (_states[s] & accept)) {
+            return true;
+        }
+        if (_states[s] == 0) {
+            return false;
+        }
+    }
+
+    return (_states[s] & accept) != 0;
+}
+
+bool matcher::verify(const char *s) const
+{
+    const char *lit = _lit.c_str();
+    size_t m = _lit.size();
+
+    if (!_icase) {
+        return memcmp(s, lit, m) == 0;
+    }
+    for (size_t k = 0; k < m; k++) {
+        if (fold(s[k]) != (unsigned char)lit[k]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Candidates are positions where both the first and the last byte of the
+ * literal match, which rules out most of the input 16 bytes at a time;
+ * only those are compared in full.
+ */
+const char *matcher::find_literal(const char *p, const char *e) const
+{
+    size_t m = _lit.size();
+    unsigned char first = _lit[0];
+    unsigned char last = _lit[m - 1];
+    size_t n, i = 0;
+
+    if ((size_t)(e - p) < m) {
+        return nullptr;
+    }
+    n = e - p - m + 1;
+
+    // with -i the literal is lower case and letters are or-ed with 0x20
+    const __m128i vf = _mm_set1_epi8((char)first);
+    const __m128i vl = _mm_set1_epi8((char)last);
+    const __m128i ff = _mm_set1_epi8(_icase && isalpha(first) ? 0x20 : 0);
+    const __m128i lf = _mm_set1_epi8(_icase && isalpha(last) ? 0x20 : 0);
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i *)&p[i]), ff);
+        __m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i *)&p[i + m - 1]), lf);
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, vf), _mm_cmpeq_epi8(b, vl)));
+        while (mask) {
+            size_t k = i + __builtin_ctz(mask);
+            if (verify(&p[k])) {
+                return &p[k];
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    for (; i < n; i++) {
+        if (verify(&p[i])) {
+            return &p[i];
+        }
+    }
+
+    return nullptr;
+}
+
+const char *matcher::find_line(const char *p, const char *e, const char **eol)
+{
+    if (_literal) {
+        const char *m = find_literal(p, e);
+        if (!m) {
+            return nullptr;
+        }
+        const char *bol = m;
+        while (bol > p && bol[-1] != '\n') bol--;
+        const char *nl = (const char *)memchr(m, '\n', e - m);
+        *eol = nl ? nl : e;
+        return bol;
+    }
+
+    while (p < e) {
+        const char *nl = (const char *)memchr(p, '\n', e - p);
+        const char *end = nl ? nl : e;
+        const char *le = end > p && end[-1] == '\r' ? end - 1 : end;
+        if (match_regex(p, le)) {
+            *eol = end;
+            return p;
+        }
+        p = nl ? nl + 1 : e;
+    }
+
+    return nullptr;
+}
+
+static inline void flush(grep_job &j)
+{
+    if (j.sink && !j.out.empty()) {
+        j.sink->write(j.out.data(), j.out.size());
+        j.out.clear();
+    }
+}
+
+// searches whole lines in [p, e); false once -l has seen enough
+static bool grep_chunk(grep_job &j, const char *p, const char *e)
+{
+    const grep_opts *o = j.opts;
+    const char *counted = p;
+    const char *eol;
+    char num[24];
+
+    while (p < e) {
+        const char *line = j.m.find_line(p, e, &eol);
+        if (!line) {
+            break;
+        }
+        j.matches++;
+        if (o->list) {
+            return false;
+        }
+        if (!o->count) {
+            if (o->names) {
+                j.out.append(j.name);
+                j.out.append(':');
+            }
+            if (o->number) {
+                j.lines += count_lines(counted, line);
+                counted = line;
+                j.out.append(num, snprintf(num, sizeof(num), "%llu:", j.lines + 1));
+            }
+            j.out.append(line, eol - line);
+            j.out.append('\n');
+            if (j.out.size() >= GREP_FLUSH) {
+                flush(j);
+            }
+        }
+        p = eol < e ? eol + 1 : e;
+    }
+
+    if (o->number) {
+        j.lines += count_lines(counted, e);
+    }
+    return true;
+}
+
+static void grep_stdin(grep_job &j, HANDLE in)
+{
+    vector<char> v(GREP_FLUSH);
+    size_t keep = 0;
+    DWORD nread;
+
+    while (ReadFile(in, v.data() + keep, (DWORD)(v.size() - keep), &nread, nullptr) != FALSE && nread > 0) {
+        size_t n = keep + nread;
+        size_t k = n;
+
+        while (k > 0 && v[k - 1] != '\n') k--;
+        if (k == 0) {
+            // a line longer than the buffer
+            if (n == v.size()) {
+                v.resize(v.size() * 2);
+            }
+            keep = n;
+            continue;
+        }
+        if (!grep_chunk(j, v.data(), v.data() + k)) {
+            return;
+        }
+        keep = n - k;
+        memmove(v.data(), v.data() + k, keep);
+    }
+
+    grep_chunk(j, v.data(), v.data() + keep);
+}
+
+static void grep_file(grep_job &j)
+{
+    tstring path;
+    HANDLE fp = INVALID_HANDLE_VALUE;
+    LARGE_INTEGER size;
+
+    if (long_path(j.file, path)) {
+        fp = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+                         FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    }
+    if (fp == INVALID_HANDLE_VALUE || !GetFileSizeEx(fp, &size)) {
+        j.err = GetLastError();
+        if (fp != INVALID_HANDLE_VALUE) {
+            CloseHandle(fp);
+        }
+        return;
+    }
+
+    // an empty file cannot be mapped and has nothing to match anyway
+    if (size.QuadPart > 0) {
+        HANDLE map = CreateFileMappingW(fp, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        const char *base = map ? (const char *)MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+        if (base) {
+            grep_chunk(j, base, base + size.QuadPart);
+            UnmapViewOfFile(base);
+        } else {
+            j.err = GetLastError();
+        }
+        if (map) {
+            CloseHandle(map);
+        }
+    }
+
+    CloseHandle(fp);
+}
+
+static void grep_finish(grep_job &j)
+{
+    const grep_opts *o = j.opts;
+    char num[24];
+
+    if (o->list) {
+        if (j.matches) {
+            j.out.append(j.name);
+            j.out.append('\n');
+        }
+    } else if (o->count) {
+        if (o->names) {
+            j.out.append(j.name);
+            j.out.append(':');
+        }
+        j.out.append(num, snprintf(num, sizeof(num), "%llu\n", j.matches));
+    }
+}
+
+static void CALLBACK grep_work(PTP_CALLBACK_INSTANCE inst, void *param)
+{
+    (void)inst;
+    grep_job *j = (grep_job *)param;
+
+    grep_file(*j);
+    grep_finish(*j);
+    if (j->done) {
+        SetEvent(j->done);
+    }
+}
+
+int do_builtin_grep(vector<WCHAR *> &args, builtin_io &io)
+{
+    size_t n = args.size();
+    size_t i;
+    grep_opts opts = {};
+    bool icase = false;
+    WCHAR *pattern = nullptr;
+    vector<WCHAR *> files;
+    u8string pat;
+    matcher m;
+    bool matched = false, failed = false;
+
+    for (i = 1; i < n; i++) {
+        if (args[i][0] != L'-') {
+            if (!pattern) {
+                pattern = args[i];
+            } else {
+                files.push_back(args[i]);
+            }
+            continue;
+        }
+        WCHAR *p = args[i] + 1;
+        while (*p != WNULL) {
+            switch (*p) {
+            case L'c':
+                opts.count = true;
+                break;
+            case L'i':
+                icase = true;
+                break;
+            case L'l':
+                opts.list = true;
+                break;
+            case L'n':
+                opts.number = true;
+                break;
+            default:
+                io.out->printf(L"unknown option %c\n", *p);
+                return 2;
+            }
+            p++;
+        }
+    }
+
+    if (!pattern) {
+        io.out->printf(L"grep: missing pattern\n");
+        return 2;
+    }
+
+    utf16_to_utf8(pattern, wcslen(pattern), pat);
+    if (!m.compile(pat.data(), pat.size(), icase, *io.out)) {
+        return 2;
+    }
+    opts.names = files.size() > 1;
+
+    vector<grep_job> jobs(files.empty() ? 1 : files.size());
+
+    for (i = 0; i < jobs.size(); i++) {
+        grep_job &j = jobs[i];
+        j.m = m;
+        j.opts = &opts;
+        j.file = files.empty() ? nullptr : files[i];
+        j.sink = nullptr;
+        j.done = nullptr;
+        j.lines = j.matches = 0;
+        j.err = 0;
+        if (j.file) {
+            utf16_to_utf8(j.file, wcslen(j.file), j.name);
+        } else {
+            j.name.append("(standard input)");
+        }
+    }
+
+    /*
+     * Files are printed in order. The next one to print is searched here with
+     * its output streamed, while the pool searches up to GREP_AHEAD after it
+     * into memory; those are printed as their turn comes, and only then are
+     * more started, so a long list never holds more than that in memory.
+     */
+    size_t started = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        grep_job &j = jobs[i];
+        bool here = started == i;
+        if (here) {
+            started++;
+        }
+        for (; started < jobs.size() && started <= i + GREP_AHEAD; started++) {
+            grep_job &a = jobs[started];
+            a.done = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+            // without an event or a pool slot the file is searched right here
+            if (!a.done || !TrySubmitThreadpoolCallback(grep_work, &a, nullptr)) {
+                grep_work(nullptr, &a);
+            }
+        }
+
+        if (here) {
+            j.sink = io.out;
+            if (j.file) {
+                grep_file(j);
+            } else {
+                grep_stdin(j, io.in);
+            }
+            grep_finish(j);
+            flush(j);
+        } else {
+            if (j.done) {
+                WaitForSingleObject(j.done, INFINITE);
+                CloseHandle(j.done);
+            }
+            if (!j.out.empty()) {
+                io.out->write(j.out.data(), j.out.size());
+            }
+            j.out = u8string();
+        }
+        if (j.err) {
+            io.out->printf(L"grep: %s (error %d)\n", j.file, j.err);
+            failed = true;
+        }
+        matched = matched || j.matches > 0;
+    }
+
+    return failed ? 2 : matched ? 0 : 1;
+}
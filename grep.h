@@ -0,0 +1,19 @@
+#pragma once
+
+#include <vector>
+
+#include <Windows.h>
+
+#include "builtin.h"
+
+/*
+ * grep builtin: grep [-c] [-i] [-l] [-n] pattern [file...]
+ *
+ * Files are memory-mapped and searched as UTF-8 bytes, several at a time
+ * on the thread pool; results are printed in argument order. A pattern
+ * without regex operators is searched as a literal with SSE2, everything
+ * else is compiled to a lazily built DFA. The regex subset is . [...] * + ?
+ * ^ $ and \ escapes, matched bytewise; -i folds ASCII letters only.
+ */
+
+int do_builtin_grep(std::vector<WCHAR *> &args, builtin_io &io);
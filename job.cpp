@@ -0,0 +1,223 @@
+#include "builtin.h"
+#include "job.h"
+#include "output.h"
+
+using namespace std;
+
+#define TICKS_PER_SECOND 10000000ULL
+
+static thread_local job_limits t_limits;
+
+const job_limits &get_limits()
+{
+    return t_limits;
+}
+
+void set_limits(const job_limits &l)
+{
+    t_limits = l;
+}
+
+bool open_job(HANDLE *job)
+{
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION info;
+    JOBOBJECT_BASIC_LIMIT_INFORMATION &basic = info.BasicLimitInformation;
+    const job_limits &l = t_limits;
+
+    *job = nullptr;
+    if (!l.memory && !l.cpu_time && !l.processes && !l.cpus) {
+        return true;
+    }
+
+    ZeroMemory(&info, sizeof(info));
+    if (l.memory) {
+        basic.LimitFlags |= JOB_OBJECT_LIMIT_JOB_MEMORY;
+        info.JobMemoryLimit = (SIZE_T)l.memory;
+    }
+    if (l.cpu_time) {
+        basic.LimitFlags |= JOB_OBJECT_LIMIT_JOB_TIME;
+        basic.PerJobUserTimeLimit.QuadPart = (LONGLONG)l.cpu_time;
+    }
+    if (l.processes) {
+        basic.LimitFlags |= JOB_OBJECT_LIMIT_ACTIVE_PROCESS;
+        basic.ActiveProcessLimit = l.processes;
+    }
+    if (l.cpus) {
+        basic.LimitFlags |= JOB_OBJECT_LIMIT_AFFINITY;
+        basic.Affinity = l.cpus;
+    }
+
+    HANDLE h = CreateJobObjectW(nullptr, nullptr);
+    if (!h) {
+        return false;
+    }
+    if (SetInformationJobObject(h, JobObjectExtendedLimitInformation, &info, sizeof(info)) == FALSE) {
+        DWORD err = GetLastError();
+        CloseHandle(h);
+        SetLastError(err);
+        return false;
+    }
+
+    *job = h;
+    return true;
+}
+
+// "unlimited" gives 0
+static bool parse_limit(const WCHAR *s, ULONGLONG *v)
+{
+    WCHAR *end = nullptr;
+
+    if (wcscmp(s, L"unlimited") == 0) {
+        *v = 0;
+        return true;
+    }
+    if (!iswdigit(*s)) {
+        return false;
+    }
+    *v = wcstoull(s, &end, 10);
+    return *end == WNULL;
+}
+
+// a list such as 0-3,6; "all" gives 0
+static bool parse_cpus(const WCHAR *s, ULONG_PTR *mask)
+{
+    const unsigned bits = sizeof(ULONG_PTR) * 8;
+
+    *mask = 0;
+    if (wcscmp(s, L"all") == 0) {
+        return true;
+    }
+    while (*s != WNULL) {
+        WCHAR *end;
+        unsigned long lo, hi;
+
+        if (!iswdigit(*s)) {
+            return false;
+        }
+        lo = hi = wcstoul(s, &end, 10);
+        if (*end == L'-') {
+            if (!iswdigit(end[1])) {
+                return false;
+            }
+            hi = wcstoul(end + 1, &end, 10);
+        }
+        if (lo > hi || hi >= bits) {
+            return false;
+        }
+        for (unsigned long c = lo; c <= hi; c++) {
+            *mask |= (ULONG_PTR)1 << c;
+        }
+        s = end;
+        if (*s == L',') {
+            s++;
+        } else if (*s != WNULL) {
+            return false;
+        }
+    }
+    return *mask != 0;
+}
+
+static void format_cpus(ULONG_PTR mask, tstring &out)
+{
+    const unsigned bits = sizeof(ULONG_PTR) * 8;
+    WCHAR num[24];
+
+    if (!mask) {
+        out.append(L"all");
+        return;
+    }
+    for (unsigned c = 0; c < bits; c++) {
+        if (!(mask & ((ULONG_PTR)1 << c))) {
+            continue;
+        }
+        unsigned e = c;
+        while (e + 1 < bits && (mask & ((ULONG_PTR)1 << (e + 1)))) e++;
+        if (!out.empty()) {
+            out.append(L',');
+        }
+        if (e > c) {
+            swprintf_s(num, L"%u-%u", c, e);
+        } else {
+            swprintf_s(num, L"%u", c);
+        }
+        out.append(num);
+        c = e;
+    }
+}
+
+static void print_limit(out_stream &out, const WCHAR *what, ULONGLONG v)
+{
+    if (v) {
+        out.printf(L"%-24s%llu\n", what, v);
+    } else {
+        out.printf(L"%-24sunlimited\n", what);
+    }
+}
+
+static void print_limits(out_stream &out)
+{
+    const job_limits &l = t_limits;
+    tstring cpus;
+
+    format_cpus(l.cpus, cpus);
+    print_limit(out, L"memory (KiB, -v)", l.memory / 1024);
+    print_limit(out, L"cpu time (seconds, -t)", l.cpu_time / TICKS_PER_SECOND);
+    print_limit(out, L"processes (-u)", l.processes);
+    out.printf(L"%-24s%s\n", L"cpus (-C)", cpus.c_str());
+}
+
+int do_builtin_ulimit(vector<WCHAR *> &args, builtin_io &io)
+{
+    size_t n = args.size();
+    job_limits l = t_limits;
+
+    if (n == 1 || (n == 2 && wcscmp(args[1], L"-a") == 0)) {
+        print_limits(*io.out);
+        return 0;
+    }
+
+    for (size_t i = 1; i < n; i++) {
+        const WCHAR *opt = args[i];
+        ULONGLONG v = 0;
+        bool ok;
+
+        if (opt[0] != L'-' || opt[1] == WNULL || opt[2] != WNULL || wcschr(L"vtuC", opt[1]) == nullptr) {
+            io.out->printf(L"ulimit: unknown option %s\n", opt);
+            return 1;
+        }
+        if (i + 1 == n) {
+            io.out->printf(L"ulimit: %s needs a value\n", opt);
+            return 1;
+        }
+        const WCHAR *val = args[++i];
+
+        if (opt[1] == L'C') {
+            ok = parse_cpus(val, &l.cpus);
+        } else {
+            ok = parse_limit(val, &v);
+        }
+        if (!ok) {
+            io.out->printf(L"ulimit: invalid value %s for %s\n", val, opt);
+            return 1;
+        }
+
+        switch (opt[1]) {
+        case L'v':
+            l.memory = v * 1024;
+            break;
+        case L't':
+            l.cpu_time = v * TICKS_PER_SECOND;
+            break;
+        case L'u':
+            if (v > MAXDWORD) {
+                io.out->printf(L"ulimit: invalid value %s for %s\n", val, opt);
+                return 1;
+            }
+            l.processes = (DWORD)v;
+            break;
+        }
+    }
+
+    t_limits = l;
+    return 0;
+}
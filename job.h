@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+
+#include <Windows.h>
+
+#include "builtin.h"
+
+/*
+ * Resource limits for the pipelines the shell starts, kept in Windows job
+ * objects. Every pipeline started while a limit is set gets a job of its
+ * own, and all of its processes (and their children) share that job, so the
+ * limits cover the pipeline as a whole.
+ *
+ *   ulimit [-a]                  show the limits
+ *   ulimit [-v KiB] [-t seconds] [-u count] [-C cpus]
+ *
+ * -v caps the memory committed by the job, -t the user CPU time of all its
+ * processes together, -u the number of processes alive at once, and -C
+ * restricts it to a list of processors such as 0-3,6. unlimited (or "all"
+ * for -C) lifts a limit. Limits set inside ( ... ) end with the group.
+ * Builtins run inside the shell and are not limited.
+ */
+
+struct job_limits {
+    ULONGLONG memory;   // bytes, 0 for none
+    ULONGLONG cpu_time; // in 100ns units, 0 for none
+    DWORD processes;    // 0 for none
+    ULONG_PTR cpus;     // processor mask, 0 for any
+};
+
+// per thread, like the shell's variables
+const job_limits &get_limits();
+void set_limits(const job_limits &l);
+
+// a job with the current limits in *job, or nullptr when there are none; false if it cannot be set up
+bool open_job(HANDLE *job);
+
+// processes still in the job keep its limits
+static inline void close_job(HANDLE job)
+{
+    if (job) {
+        CloseHandle(job);
+    }
+}
+
+int do_builtin_ulimit(std::vector<WCHAR *> &args, builtin_io &io);
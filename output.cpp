@@ -0,0 +1,233 @@
+#include <cstdarg>
+#include <utility>
+
+#include "output.h"
+#include "utf.h"
+
+#define OUT_BUFFER (64 * 1024)
+
+bool is_console(HANDLE h)
+{
+    DWORD mode;
+
+    return GetConsoleMode(h, &mode) != FALSE;
+}
+
+static bool write_all(HANDLE h, const char *s, size_t n)
+{
+    DWORD written;
+
+    while (n > 0) {
+        DWORD k = n > MAXDWORD ? MAXDWORD : (DWORD)n;
+        if (WriteFile(h, s, k, &written, nullptr) == FALSE) {
+            return false;
+        }
+        s += written;
+        n -= written;
+    }
+    return true;
+}
+
+static bool write_console(HANDLE h, const WCHAR *s, size_t n)
+{
+    DWORD written;
+
+    while (n > 0) {
+        DWORD k = n > 0x7FFF ? 0x7FFF : (DWORD)n;
+        if (WriteConsoleW(h, s, k, &written, nullptr) == FALSE) {
+            return false;
+        }
+        s += written;
+        n -= written;
+    }
+    return true;
+}
+
+/*
+ * Formats into line when the text fits, else into buf. Most messages fit on
+ * the stack; only longer ones are measured first. Returns the length, or a
+ * negative value on a bad format.
+ */
+static int vformat(const WCHAR *fmt, va_list ap, WCHAR *line, size_t cap, tstring &buf, const WCHAR *&text)
+{
+    va_list ap2;
+    int n;
+
+    va_copy(ap2, ap);
+    n = _vsnwprintf_s(line, cap, _TRUNCATE, fmt, ap2);
+    va_end(ap2);
+    text = line;
+    if (n >= 0) {
+        return n;
+    }
+
+    va_copy(ap2, ap);
+    n = _vscwprintf(fmt, ap2);
+    va_end(ap2);
+    if (n <= 0) {
+        return n;
+    }
+
+    buf.resize(n);
+    va_copy(ap2, ap);
+    _vsnwprintf_s(buf.data(), buf.capacity(), _TRUNCATE, fmt, ap2);
+    va_end(ap2);
+    text = buf.data();
+    return n;
+}
+
+out_stream::out_stream(HANDLE h, out_stream *tie) : _h(h), _tie(tie), _console(-1), _memory(false), _failed(false)
+{
+    InitializeSRWLock(&_lock);
+}
+
+out_stream::out_stream() : _h(nullptr), _tie(nullptr), _console(0), _memory(true), _failed(false)
+{
+    InitializeSRWLock(&_lock);
+}
+
+out_stream::~out_stream()
+{
+    flush();
+}
+
+void out_stream::prepare_locked()
+{
+    if (_console < 0) {
+        _console = is_console(_h) ? 1 : 0;
+    }
+    if (_tie) {
+        _tie->flush();
+    }
+}
+
+void out_stream::flush_locked()
+{
+    if (_memory) {
+        return;
+    }
+    // after a failed write nothing more is sent
+    if (_console > 0) {
+        _failed = _failed || !write_console(_h, _wide.data(), _wide.size());
+    } else {
+        _failed = _failed || !write_all(_h, _bytes.data(), _bytes.size());
+    }
+    _wide.clear();
+    _bytes.clear();
+}
+
+void out_stream::write(const char *s, size_t n)
+{
+    AcquireSRWLockExclusive(&_lock);
+    prepare_locked();
+    if (_console > 0) {
+        utf8_to_utf16(s, n, _wide);
+    } else if (n >= OUT_BUFFER && !_memory) {
+        flush_locked();
+        _failed = _failed || !write_all(_h, s, n);
+    } else {
+        _bytes.append(s, n);
+    }
+
+    if (_tie || _wide.size() >= OUT_BUFFER || _bytes.size() >= OUT_BUFFER) {
+        flush_locked();
+    }
+    ReleaseSRWLockExclusive(&_lock);
+}
+
+void out_stream::write(const WCHAR *s, size_t n)
+{
+    AcquireSRWLockExclusive(&_lock);
+    prepare_locked();
+    if (_console > 0) {
+        _wide.append(s, n);
+    } else {
+        utf16_to_utf8(s, n, _bytes);
+    }
+
+    if (_tie || _wide.size() >= OUT_BUFFER || _bytes.size() >= OUT_BUFFER) {
+        flush_locked();
+    }
+    ReleaseSRWLockExclusive(&_lock);
+}
+
+int out_stream::printf(const WCHAR *fmt, ...)
+{
+    va_list ap;
+    WCHAR line[512];
+    tstring buf;
+    const WCHAR *text;
+    int n;
+
+    va_start(ap, fmt);
+    n = vformat(fmt, ap, line, _countof(line), buf, text);
+    va_end(ap);
+    if (n > 0) {
+        write(text, n);
+    }
+    return n;
+}
+
+void out_stream::flush()
+{
+    AcquireSRWLockExclusive(&_lock);
+    flush_locked();
+    ReleaseSRWLockExclusive(&_lock);
+}
+
+bool out_stream::failed()
+{
+    AcquireSRWLockShared(&_lock);
+    bool failed = _failed;
+    ReleaseSRWLockShared(&_lock);
+    return failed;
+}
+
+void out_stream::take(u8string &out)
+{
+    AcquireSRWLockExclusive(&_lock);
+    out = std::move(_bytes);
+    _bytes.clear();
+    ReleaseSRWLockExclusive(&_lock);
+}
+
+static thread_local out_stream *t_bound;
+
+// the shell's own messages; builtins write to the streams they are given
+static out_stream &shell_out()
+{
+    static out_stream out(GetStdHandle(STD_OUTPUT_HANDLE));
+    return t_bound ? *t_bound : out;
+}
+
+int out_printf(const WCHAR *fmt, ...)
+{
+    va_list ap;
+    WCHAR line[512];
+    tstring buf;
+    const WCHAR *text;
+    int n;
+
+    va_start(ap, fmt);
+    n = vformat(fmt, ap, line, _countof(line), buf, text);
+    va_end(ap);
+    if (n > 0) {
+        shell_out().write(text, n);
+    }
+    return n;
+}
+
+void out_flush()
+{
+    shell_out().flush();
+}
+
+void out_bind(out_stream *s)
+{
+    t_bound = s;
+}
+
+out_stream *out_bound()
+{
+    return t_bound;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <Windows.h>
+
+#include "container.h"
+
+/*
+ * Output at the Win32 boundary. Consoles get UTF-16 through WriteConsoleW;
+ * files and pipes get UTF-8 bytes through WriteFile, so byte-oriented data
+ * (cat, pipes) passes through without being transcoded.
+ *
+ * An out_stream buffers what is written to one handle and sends it out in
+ * large pieces: when the buffer fills up, on flush() and when the stream is
+ * destroyed. Whether the handle is a console is checked once, on the first
+ * write. Writers on pool threads share a stream under its lock. A stream
+ * can be tied to another one, which is flushed before every write, so that
+ * stderr output does not overtake stdout output on the same console. A tied
+ * stream writes through, like stderr in C, so that stdout output does not
+ * overtake it either.
+ *
+ * A stream made without a handle keeps everything in memory until it is
+ * taken, for output the shell itself consumes.
+ */
+
+bool is_console(HANDLE h);
+
+class out_stream
+{
+public:
+    explicit out_stream(HANDLE h, out_stream *tie = nullptr);
+    out_stream();
+    ~out_stream();
+
+    out_stream(const out_stream &) = delete;
+    out_stream &operator=(const out_stream &) = delete;
+
+    void write(const char *s, size_t n);
+    void write(const WCHAR *s, size_t n);
+    int printf(const WCHAR *fmt, ...);
+    void flush();
+
+    // moves what an in-memory stream holds into out
+    void take(u8string &out);
+
+    // a write has failed, as it does once the reader of a pipe has gone; what follows is dropped
+    bool failed();
+
+    HANDLE handle() const
+    {
+        return _h;
+    }
+
+private:
+    void prepare_locked();
+    void flush_locked();
+
+    HANDLE _h;
+    out_stream *_tie;
+    SRWLOCK _lock;
+    int _console; // -1 until known
+    bool _memory;
+    bool _failed;
+    tstring _wide;   // for a console
+    u8string _bytes; // for files and pipes
+};
+
+// formatted output of the shell itself, to its standard output
+int out_printf(const WCHAR *fmt, ...);
+
+// writes what the shell has buffered
+void out_flush();
+
+// sends the calling thread's out_printf output to s instead, until unbound with nullptr
+void out_bind(out_stream *s);
+// where the calling thread's output is sent, nullptr for the shell's standard output
+out_stream *out_bound();
@@ -0,0 +1,675 @@
+#include "parser.h"
+#include "glob.h"
+#include "output.h"
+#include "scan.h"
+
+using namespace std;
+
+namespace {
+
+struct parser {
+    const WCHAR *c;
+    const WCHAR *end;
+    bool quiet_incomplete;
+    bool incomplete;
+    // here-document bodies follow the line that names them; once parsing
+    // gets past here_nl it continues at here_end, behind the last body
+    const WCHAR *here_nl;
+    const WCHAR *here_end;
+
+    parser(const WCHAR *line, size_t n, bool quiet)
+        : c(line), end(line + n), quiet_incomplete(quiet), incomplete(false), here_nl(nullptr),
+          here_end(nullptr) {}
+
+    // blanks within a command; newlines separate commands
+    void skip_space()
+    {
+        while (c < end && *c != L'\n' && iswspace(*c)) c++;
+    }
+
+    void skip_here_bodies()
+    {
+        if (here_nl && c > here_nl) {
+            c = here_end;
+            here_nl = nullptr;
+            here_end = nullptr;
+        }
+    }
+
+    void skip_newlines()
+    {
+        skip_here_bodies();
+        while (c < end && iswspace(*c)) {
+            c++;
+            skip_here_bodies();
+        }
+    }
+
+    bool match(const WCHAR *op)
+    {
+        const WCHAR *p = c;
+
+        while (*op) {
+            if (p == end || *p++ != *op++) {
+                return false;
+            }
+        }
+        c = p;
+        return true;
+    }
+
+    bool at_word_end(const WCHAR *p)
+    {
+        if (p == end || iswspace(*p)) {
+            return true;
+        }
+        switch (*p) {
+        case L'|':
+        case L'<':
+        case L'>':
+        case L'&':
+        case L';':
+        case L'(':
+        case L')':
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    bool at_word_end()
+    {
+        return at_word_end(c);
+    }
+
+    bool at_command_end()
+    {
+        if (c == end) {
+            return true;
+        }
+        switch (*c) {
+        case L'&':
+            // &> is a redirection, not the end of the command
+            return c + 1 == end || *(c + 1) != L'>';
+        case L'|':
+        case L';':
+        case L')':
+        case L'\n':
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // is the word at c the reserved word kw?
+    bool at_keyword(const WCHAR *kw)
+    {
+        const WCHAR *p = c;
+
+        while (*kw) {
+            if (p == end || *p++ != *kw++) {
+                return false;
+            }
+        }
+        return at_word_end(p);
+    }
+
+    bool syntax_error(const WCHAR *what)
+    {
+        if (c < end) {
+            out_printf(L"syntax error near '%c': %s\n", *c, what);
+        } else {
+            out_printf(L"syntax error at end of line: %s\n", what);
+        }
+        return false;
+    }
+
+    // the input stopped inside a construct; more lines may complete it
+    bool need_more(const WCHAR *what)
+    {
+        incomplete = true;
+        return quiet_incomplete ? false : syntax_error(what);
+    }
+
+    bool expect_keyword(const WCHAR *kw, const WCHAR *what)
+    {
+        skip_newlines();
+        if (at_keyword(kw)) {
+            c += wcslen(kw);
+            return true;
+        }
+        return c == end ? need_more(what) : syntax_error(what);
+    }
+
+    // copies the ( ... ) of a $( ... ), or a ` ... `, unchanged; the command inside is parsed when it runs
+    bool copy_substitution(tstring &w)
+    {
+        const WCHAR *p = c + 1;
+        int depth = 1;
+
+        if (*c == L'`') {
+            while (p < end && *p != L'`') {
+                p += *p == L'\\' && p + 1 < end ? 2 : 1;
+            }
+            if (p < end) {
+                depth = 0;
+                p++;
+            }
+        } else {
+            while (p < end && depth > 0) {
+                if (*p == L'\\' && p + 1 < end) {
+                    p++;
+                } else if (*p == L'(') {
+                    depth++;
+                } else if (*p == L')') {
+                    depth--;
+                }
+                p++;
+            }
+        }
+        if (depth > 0) {
+            c = end;
+            return need_more(L"missing end of command substitution");
+        }
+        w.append(c, p - c);
+        c = p;
+        return true;
+    }
+
+    bool parse_word(tstring &w, bool &has_vars)
+    {
+        skip_space();
+        while (!at_word_end()) {
+            if (*c == L'\\' && c + 1 < end) {
+                // keep \$ and \` escaped for the expansion pass
+                if (*(c + 1) == L'$' || *(c + 1) == L'`') {
+                    w.append(*c);
+                }
+                c++;
+            } else if (*c == L'`' || (*c == L'$' && c + 1 < end && *(c + 1) == L'(')) {
+                has_vars = true;
+                if (*c == L'$') {
+                    w.append(*c++);
+                }
+                if (!copy_substitution(w)) {
+                    return false;
+                }
+                continue;
+            }
+            if (*c == L'$') {
+                has_vars = true;
+            }
+            w.append(*c++);
+        }
+        return !w.empty();
+    }
+
+    bool parse_redirection(stage &st, redir_kind kind, bool append)
+    {
+        redirection r;
+
+        r.kind = kind;
+        r.append = append;
+        if (!parse_word(r.target, st.has_vars)) {
+            return syntax_error(L"missing file name");
+        }
+        st.redirs.push_back(std::move(r));
+        return true;
+    }
+
+    // the body is taken from the lines after the current one, up to the delimiter
+    bool parse_heredoc(stage &st)
+    {
+        redirection r;
+        tstring delim;
+        bool has_vars = false;
+        const WCHAR *p = here_end;
+
+        r.kind = REDIR_HEREDOC;
+        if (!parse_word(delim, has_vars)) {
+            return syntax_error(L"missing here-document delimiter");
+        }
+        size_t n = delim.size();
+        WCHAR q = delim[0];
+        if (n >= 2 && (q == L'\'' || q == L'"') && delim[(unsigned)n - 1] == q) {
+            delim = tstring(delim.c_str() + 1, n - 2);
+            r.quoted = true;
+        }
+
+        // several here-documents on one line follow each other
+        if (!p) {
+            p = c;
+            while (p < end && *p != L'\n') p++;
+            if (p == end) {
+                return need_more(L"missing here-document");
+            }
+            here_nl = p++;
+        }
+
+        while (true) {
+            if (p == end) {
+                return need_more(L"missing here-document end");
+            }
+            const WCHAR *e = p;
+            while (e < end && *e != L'\n') e++;
+            if ((size_t)(e - p) == delim.size() && wcsncmp(p, delim.c_str(), delim.size()) == 0) {
+                p = e < end ? e + 1 : e;
+                break;
+            }
+            r.target.append(p, e - p);
+            r.target.append(L'\n');
+            p = e < end ? e + 1 : e;
+        }
+        here_end = p;
+
+        if (!r.quoted && wcspbrk(r.target.c_str(), L"$`") != nullptr) {
+            st.has_vars = true;
+        }
+        st.redirs.push_back(std::move(r));
+        return true;
+    }
+
+    // parses one redirection operator at c, if there is one
+    bool try_redirection(stage &st, bool &found)
+    {
+        found = true;
+        switch (*c) {
+        case L'<':
+            if (match(L"<<<")) {
+                return parse_redirection(st, REDIR_HERESTR, false);
+            }
+            if (match(L"<<")) {
+                return parse_heredoc(st);
+            }
+            c++;
+            return parse_redirection(st, REDIR_IN, false);
+        case L'>':
+            c++;
+            return parse_redirection(st, REDIR_OUT, match(L">"));
+        case L'&':
+            if (match(L"&>")) {
+                return parse_redirection(st, REDIR_ALL, match(L">"));
+            }
+            break;
+        case L'2':
+            if (match(L"2>&1")) {
+                redirection r;
+                r.kind = REDIR_ERR_OUT;
+                st.redirs.push_back(std::move(r));
+                return true;
+            }
+            if (match(L"2>")) {
+                return parse_redirection(st, REDIR_ERR, match(L">"));
+            }
+            break;
+        default:
+            break;
+        }
+        found = false;
+        return true;
+    }
+
+    bool parse_command(stage &st)
+    {
+        size_t n;
+        bool found;
+
+        while (!at_command_end()) {
+            if (!try_redirection(st, found)) {
+                return false;
+            }
+            if (found) {
+                continue;
+            }
+
+            switch (*c) {
+            case L'\\':
+                if (c + 1 < end) {
+                    if (*(c + 1) == L'$' || *(c + 1) == L'`') {
+                        st.text.append(*c);
+                    }
+                    st.text.append(*(c + 1));
+                }
+                c += 2;
+                break;
+            case L'(':
+                // the $ of $( was copied with the text before it
+                n = st.text.size();
+                if (n > 0 && st.text[n - 1] == L'$' && (n < 2 || st.text[n - 2] != L'\\')) {
+                    if (!copy_substitution(st.text)) {
+                        return false;
+                    }
+                    break;
+                }
+                return syntax_error(L"unexpected '('");
+            case L'`':
+                if (!copy_substitution(st.text)) {
+                    return false;
+                }
+                break;
+            case L'2':
+                st.text.append(*c++);
+                break;
+            default:
+                // copy the whole run up to the next operator in one go
+                n = find_special(c, end - c);
+                st.text.append(c, n);
+                c += n;
+                break;
+            }
+        }
+
+        st.text.strip();
+        if (st.text.empty()) {
+            return c == end ? need_more(L"missing command") : syntax_error(L"missing command");
+        }
+        st.has_vars = st.has_vars || wcspbrk(st.text.c_str(), L"$`") != nullptr;
+        st.has_glob = has_glob(st.text.c_str(), st.text.size());
+        return true;
+    }
+
+    // only redirections may follow the end of a group or construct
+    bool parse_trailing_redirections(stage &st)
+    {
+        bool found;
+
+        while (true) {
+            skip_space();
+            if (at_command_end()) {
+                return true;
+            }
+            if (!try_redirection(st, found)) {
+                return false;
+            }
+            if (!found) {
+                return syntax_error(L"unexpected word");
+            }
+        }
+    }
+
+    bool parse_group(stage &st)
+    {
+        shared_ptr<command_list> group = make_shared<command_list>();
+
+        c++; // '('
+        if (!parse_list(*group, true, nullptr)) {
+            return false;
+        }
+        if (c == end) {
+            return need_more(L"missing ')'");
+        }
+        c++; // ')'
+        st.group = group;
+
+        return parse_trailing_redirections(st);
+    }
+
+    bool parse_if(stage &st)
+    {
+        static const WCHAR *const then_stop[] = {L"then", nullptr};
+        static const WCHAR *const body_stop[] = {L"elif", L"else", L"fi", nullptr};
+        static const WCHAR *const else_stop[] = {L"fi", nullptr};
+        shared_ptr<compound> ctl = make_shared<compound>();
+
+        ctl->kind = CTL_IF;
+        c += 2; // "if"
+        while (true) {
+            ctl->conds.emplace_back();
+            ctl->bodies.emplace_back();
+            if (!parse_list(ctl->conds.back(), false, then_stop) ||
+                !expect_keyword(L"then", L"missing 'then'") ||
+                !parse_list(ctl->bodies.back(), false, body_stop)) {
+                return false;
+            }
+            if (at_keyword(L"elif")) {
+                c += 4;
+                continue;
+            }
+            if (at_keyword(L"else")) {
+                c += 4;
+                ctl->bodies.emplace_back();
+                if (!parse_list(ctl->bodies.back(), false, else_stop)) {
+                    return false;
+                }
+            }
+            break;
+        }
+        if (!expect_keyword(L"fi", L"missing 'fi'")) {
+            return false;
+        }
+        st.ctl = ctl;
+
+        return parse_trailing_redirections(st);
+    }
+
+    bool parse_loop_body(compound &ctl)
+    {
+        static const WCHAR *const done_stop[] = {L"done", nullptr};
+
+        ctl.bodies.emplace_back();
+        return expect_keyword(L"do", L"missing 'do'") &&
+               parse_list(ctl.bodies.back(), false, done_stop) &&
+               expect_keyword(L"done", L"missing 'done'");
+    }
+
+    bool parse_while(stage &st)
+    {
+        static const WCHAR *const do_stop[] = {L"do", nullptr};
+        shared_ptr<compound> ctl = make_shared<compound>();
+
+        ctl->kind = CTL_WHILE;
+        c += 5; // "while"
+        ctl->conds.emplace_back();
+        if (!parse_list(ctl->conds.back(), false, do_stop) || !parse_loop_body(*ctl)) {
+            return false;
+        }
+        st.ctl = ctl;
+
+        return parse_trailing_redirections(st);
+    }
+
+    bool parse_for(stage &st)
+    {
+        shared_ptr<compound> ctl = make_shared<compound>();
+        bool has_vars = false;
+
+        ctl->kind = CTL_FOR;
+        c += 3; // "for"
+        if (!parse_word(ctl->var, has_vars) || has_vars) {
+            return c == end ? need_more(L"missing variable name") : syntax_error(L"bad variable name");
+        }
+        skip_space();
+        if (!at_keyword(L"in")) {
+            return c == end ? need_more(L"missing 'in'") : syntax_error(L"missing 'in'");
+        }
+        c += 2;
+
+        while (true) {
+            skip_space();
+            if (c == end || *c == L';' || *c == L'\n') {
+                break;
+            }
+            tstring w;
+            if (!parse_word(w, has_vars)) {
+                return syntax_error(L"unexpected character in word list");
+            }
+            ctl->words.push_back(std::move(w));
+        }
+        if (c == end) {
+            return need_more(L"missing 'do'");
+        }
+        c++; // ';' or newline
+
+        if (!parse_loop_body(*ctl)) {
+            return false;
+        }
+        st.ctl = ctl;
+
+        return parse_trailing_redirections(st);
+    }
+
+    bool parse_pipeline(pipeline &p)
+    {
+        while (true) {
+            p.stages.emplace_back();
+            stage &st = p.stages.back();
+            bool ok;
+
+            skip_space();
+            if (c < end && *c == L'(') {
+                ok = parse_group(st);
+            } else if (at_keyword(L"if")) {
+                ok = parse_if(st);
+            } else if (at_keyword(L"while")) {
+                ok = parse_while(st);
+            } else if (at_keyword(L"for")) {
+                ok = parse_for(st);
+            } else {
+                ok = parse_command(st);
+            }
+            if (!ok) {
+                return false;
+            }
+
+            if (c == end || *c != L'|' || (c + 1 < end && *(c + 1) == L'|')) {
+                return true;
+            }
+            c++; // '|'
+        }
+    }
+
+    bool at_list_end(const WCHAR *const *stops)
+    {
+        skip_newlines();
+        if (c == end || *c == L')') {
+            return true;
+        }
+        for (; stops && *stops; stops++) {
+            if (at_keyword(*stops)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool at_closer()
+    {
+        static const WCHAR *const closers[] = {L"then", L"elif", L"else", L"fi", L"do", L"done"};
+
+        for (const WCHAR *kw : closers) {
+            if (at_keyword(kw)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /*
+     * A list ends at the end of the input, at ')' when nested in a group, or
+     * at one of the reserved words in stops. The caller consumes the closer.
+     */
+    bool parse_list(command_list &l, bool nested, const WCHAR *const *stops)
+    {
+        list_op op = LIST_SEQ;
+
+        while (true) {
+            if (at_list_end(stops)) {
+                if (op != LIST_SEQ || l.items.empty()) {
+                    return c == end ? need_more(L"missing command") : syntax_error(L"missing command");
+                }
+                if (c < end && *c == L')' && !nested) {
+                    return syntax_error(L"unexpected ')'");
+                }
+                return true;
+            }
+            if (at_closer()) {
+                return syntax_error(L"unexpected reserved word");
+            }
+
+            l.items.emplace_back();
+            list_item &item = l.items.back();
+            item.op = op;
+            if (!parse_pipeline(item.p)) {
+                return false;
+            }
+
+            if (match(L"&&")) {
+                op = LIST_AND;
+            } else if (match(L"||")) {
+                op = LIST_OR;
+            } else if (match(L"&")) {
+                item.p.background = true;
+                op = LIST_SEQ;
+            } else {
+                if (!match(L";")) {
+                    match(L"\n");
+                }
+                op = LIST_SEQ;
+            }
+        }
+    }
+};
+
+} // namespace
+
+ast_ptr parse_line(const WCHAR *line, size_t n, bool *incomplete)
+{
+    shared_ptr<command_list> l = make_shared<command_list>();
+    parser ps(line, n, incomplete != nullptr);
+
+    if (incomplete) {
+        *incomplete = false;
+    }
+
+    if (!ps.parse_list(*l, false, nullptr)) {
+        if (incomplete) {
+            *incomplete = ps.incomplete;
+        }
+        return nullptr;
+    }
+
+    return l;
+}
+
+ast_ptr parse_cache::get(const WCHAR *line, bool *incomplete)
+{
+    wstring key(line);
+
+    if (incomplete) {
+        *incomplete = false;
+    }
+
+    AcquireSRWLockExclusive(&_lock);
+    auto it = _index.find(key);
+    if (it != _index.end()) {
+        _lru.splice(_lru.begin(), _lru, it->second);
+        ast_ptr p = it->second->second;
+        ReleaseSRWLockExclusive(&_lock);
+        return p;
+    }
+    ReleaseSRWLockExclusive(&_lock);
+
+    // parsed without the lock; a line another thread cached meanwhile keeps that copy
+    ast_ptr p = parse_line(key.data(), key.size(), incomplete);
+    if (!p || _capacity == 0) {
+        return p;
+    }
+
+    AcquireSRWLockExclusive(&_lock);
+    it = _index.find(key);
+    if (it != _index.end()) {
+        _lru.splice(_lru.begin(), _lru, it->second);
+        ReleaseSRWLockExclusive(&_lock);
+        return p;
+    }
+
+    if (_lru.size() == _capacity) {
+        _index.erase(_lru.back().first);
+        _lru.pop_back();
+    }
+    _lru.emplace_front(std::move(key), p);
+    _index.emplace(_lru.front().first, _lru.begin());
+    ReleaseSRWLockExclusive(&_lock);
+
+    return p;
+}
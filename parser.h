@@ -0,0 +1,127 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Windows.h>
+
+#include "container.h"
+
+/*
+ * Command line AST. Parsing has no side effects: redirection targets are only
+ * recorded here and opened by the executor, so a syntax error never leaves
+ * files or pipes behind, and a parsed line can be executed any number of times.
+ */
+
+enum redir_kind {
+    REDIR_IN,      // < file
+    REDIR_OUT,     // > file, >> file
+    REDIR_ERR,     // 2> file, 2>> file
+    REDIR_ALL,     // &> file, &>> file
+    REDIR_ERR_OUT, // 2>&1
+    REDIR_HERESTR, // <<< word
+    REDIR_HEREDOC, // << delimiter, followed by the lines up to it
+};
+
+/*
+ * target is the file name, the here-string word or the here-document body.
+ * Redirections are applied left to right, so 2>&1 sends stderr wherever
+ * stdout goes at that point.
+ */
+struct redirection {
+    redir_kind kind;
+    tstring target;
+    bool append = false;
+    bool quoted = false; // here-document with a quoted delimiter: no $ expansion
+};
+
+struct command_list;
+struct compound;
+
+/*
+ * One pipeline stage: a simple command, a ( ... ) group, or an if/while/for
+ * construct. The latter two are run by the shell itself. has_vars and
+ * has_glob are set when the text needs $ or wildcard expansion, so plain
+ * commands skip both at run time. $( ... ) and ` ... ` stay in the text as
+ * they are and count as $ expansion; they are parsed again when they run.
+ */
+struct stage {
+    tstring text;
+    std::vector<redirection> redirs;
+    std::shared_ptr<const command_list> group;
+    std::shared_ptr<const compound> ctl;
+    bool has_vars = false;
+    bool has_glob = false;
+};
+
+struct pipeline {
+    std::vector<stage> stages;
+    bool background = false;
+};
+
+// how a list item is joined to the one before it
+enum list_op {
+    LIST_SEQ,  // ; or &
+    LIST_AND,  // &&
+    LIST_OR,   // ||
+};
+
+struct list_item {
+    list_op op;
+    pipeline p;
+};
+
+struct command_list {
+    std::vector<list_item> items;
+};
+
+enum compound_kind {
+    CTL_IF,
+    CTL_WHILE,
+    CTL_FOR,
+};
+
+/*
+ * if:    bodies[i] runs when conds[i] succeeds; one extra body is the else
+ * while: bodies[0] runs while conds[0] succeeds
+ * for:   bodies[0] runs once per expanded word with var set to it
+ */
+struct compound {
+    compound_kind kind;
+    std::vector<command_list> conds;
+    std::vector<command_list> bodies;
+    tstring var;
+    std::vector<tstring> words;
+};
+
+using ast_ptr = std::shared_ptr<const command_list>;
+
+/*
+ * Returns nullptr after reporting a syntax error. When incomplete is given
+ * and the line ends inside an open construct (missing fi, done, ')' ...),
+ * nothing is reported and *incomplete is set so the caller can read more.
+ */
+ast_ptr parse_line(const WCHAR *line, size_t n, bool *incomplete = nullptr);
+
+// LRU cache of parsed lines keyed by the line text
+class parse_cache
+{
+public:
+    explicit parse_cache(size_t capacity) : _capacity(capacity)
+    {
+        InitializeSRWLock(&_lock);
+    }
+
+    ast_ptr get(const WCHAR *line, bool *incomplete = nullptr);
+
+private:
+    using entry = std::pair<std::wstring, ast_ptr>;
+
+    size_t _capacity;
+    SRWLOCK _lock; // stages running on threads of their own share the cache
+    std::list<entry> _lru;
+    std::unordered_map<std::wstring, std::list<entry>::iterator> _index;
+};
@@ -0,0 +1,78 @@
+#include "path.h"
+
+bool long_path(const WCHAR *p, tstring &out)
+{
+    DWORD n;
+
+    out.clear();
+    if (wcsncmp(p, L"\\\\?\\", 4) == 0) {
+        out.append(p);
+        return true;
+    }
+
+    n = GetFullPathNameW(p, 0, nullptr, nullptr);
+    if (n == 0) {
+        return false;
+    }
+
+    tstring full;
+    full.resize(n);
+    n = GetFullPathNameW(p, n, full.data(), nullptr);
+    if (n == 0) {
+        return false;
+    }
+    full.resize(n);
+
+    // device paths such as \\.\NUL are passed through untouched
+    if (wcsncmp(full.c_str(), L"\\\\.\\", 4) == 0) {
+        out.append(full);
+    } else if (wcsncmp(full.c_str(), L"\\\\", 2) == 0) {
+        out.append(L"\\\\?\\UNC\\");
+        out.append(full.c_str() + 2, full.size() - 2);
+    } else {
+        out.append(L"\\\\?\\");
+        out.append(full);
+    }
+
+    return true;
+}
+
+size_t root_length(const WCHAR *p)
+{
+    const WCHAR *c = p;
+    int parts = 1;
+
+    if (wcsncmp(p, L"\\\\?\\UNC\\", 8) == 0) {
+        c += 8;
+        parts = 2;
+    } else if (wcsncmp(p, L"\\\\?\\", 4) == 0 || wcsncmp(p, L"\\\\.\\", 4) == 0) {
+        c += 4;
+    }
+
+    while (parts-- > 0) {
+        while (*c != L'\0' && *c != L'\\') {
+            c++;
+        }
+        if (*c == L'\\') {
+            c++;
+        }
+    }
+
+    return c - p;
+}
+
+bool current_dir(tstring &out)
+{
+    size_t at = out.size();
+    DWORD n = GetCurrentDirectoryW(0, nullptr);
+
+    if (n == 0) {
+        return false;
+    }
+
+    out.resize(at + n);
+    n = GetCurrentDirectoryW(n, out.data() + at);
+    out.resize(at + n);
+
+    return n != 0;
+}
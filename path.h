@@ -0,0 +1,19 @@
+#pragma once
+
+#include <Windows.h>
+
+#include "container.h"
+
+/*
+ * Paths handed to file APIs go through long_path(), which makes them absolute
+ * and adds the \\?\ (or \\?\UNC\) prefix so they are not cut off at MAX_PATH.
+ * Paths shown to the user keep the form they were typed in.
+ */
+
+bool long_path(const WCHAR *p, tstring &out);
+
+// length of the drive, volume or share part of a path, with its separator
+size_t root_length(const WCHAR *p);
+
+// appends the current directory to out
+bool current_dir(tstring &out);
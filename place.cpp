@@ -0,0 +1,223 @@
+#include "builtin.h"
+#include "output.h"
+#include "place.h"
+
+using namespace std;
+
+#define AFFINITY_BITS (sizeof(KAFFINITY) * 8)
+
+static thread_local placement t_placement;
+
+const placement &get_placement()
+{
+    return t_placement;
+}
+
+void set_placement(const placement &p)
+{
+    t_placement = p;
+}
+
+static vector<GROUP_AFFINITY> read_cores()
+{
+    vector<GROUP_AFFINITY> cores;
+    DWORD len = 0;
+
+    GetLogicalProcessorInformationEx(RelationProcessorCore, nullptr, &len);
+    vector<char> buf(len);
+    if (len == 0 ||
+        !GetLogicalProcessorInformationEx(RelationProcessorCore, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buf.data(),
+                                          &len)) {
+        return cores;
+    }
+    for (DWORD off = 0; off < len;) {
+        PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX p = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)(buf.data() + off);
+        if (p->Relationship == RelationProcessorCore && p->Processor.GroupCount > 0) {
+            GROUP_AFFINITY ga;
+            ZeroMemory(&ga, sizeof(ga));
+            ga.Group = p->Processor.GroupMask[0].Group;
+            ga.Mask = p->Processor.GroupMask[0].Mask;
+            cores.push_back(ga);
+        }
+        off += p->Size;
+    }
+    return cores;
+}
+
+// the cores in topology order, each with its logical processors; read once, by the first stage placed
+static const vector<GROUP_AFFINITY> &cores()
+{
+    static const vector<GROUP_AFFINITY> c = read_cores();
+    return c;
+}
+
+// the i-th logical processor, counting core by core so that siblings are adjacent
+static bool nth_processor(size_t i, GROUP_AFFINITY *ga)
+{
+    const vector<GROUP_AFFINITY> &c = cores();
+    size_t total = 0;
+
+    for (const GROUP_AFFINITY &core : c) {
+        for (unsigned b = 0; b < AFFINITY_BITS; b++) {
+            total += (core.Mask >> b) & 1;
+        }
+    }
+    if (total == 0) {
+        return false;
+    }
+
+    i %= total;
+    for (const GROUP_AFFINITY &core : c) {
+        for (unsigned b = 0; b < AFFINITY_BITS; b++) {
+            if (((core.Mask >> b) & 1) && i-- == 0) {
+                *ga = core;
+                ga->Mask = (KAFFINITY)1 << b;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool place_stage(size_t i, size_t n, GROUP_AFFINITY *ga)
+{
+    const placement &p = t_placement;
+
+    switch (p.policy) {
+    case PLACE_PACK:
+        return nth_processor(i, ga);
+    case PLACE_SPREAD: {
+        const vector<GROUP_AFFINITY> &c = cores();
+        if (c.empty()) {
+            return false;
+        }
+        *ga = c[n > c.size() ? i % c.size() : i * c.size() / n];
+        return true;
+    }
+    case PLACE_LISTS:
+        *ga = p.lists[i % p.lists.size()];
+        return true;
+    case PLACE_OFF:
+    default:
+        return false;
+    }
+}
+
+// the number of the first processor of group g
+static DWORD group_base(WORD g)
+{
+    DWORD base = 0;
+
+    for (WORD k = 0; k < g; k++) {
+        base += GetActiveProcessorCount(k);
+    }
+    return base;
+}
+
+// a list such as 0-3,6 of processor numbers that all lie in one group
+static bool parse_list(const WCHAR *s, GROUP_AFFINITY *ga)
+{
+    WORD groups = GetActiveProcessorGroupCount();
+    bool any = false;
+
+    ZeroMemory(ga, sizeof(*ga));
+    while (*s != WNULL) {
+        WCHAR *end;
+        unsigned long lo, hi;
+
+        if (!iswdigit(*s)) {
+            return false;
+        }
+        lo = hi = wcstoul(s, &end, 10);
+        if (*end == L'-') {
+            if (!iswdigit(end[1])) {
+                return false;
+            }
+            hi = wcstoul(end + 1, &end, 10);
+        }
+        if (lo > hi) {
+            return false;
+        }
+        for (unsigned long c = lo; c <= hi; c++) {
+            WORD g = 0;
+            DWORD base = 0;
+            while (g < groups && c >= base + GetActiveProcessorCount(g)) {
+                base += GetActiveProcessorCount(g);
+                g++;
+            }
+            if (g == groups || (any && g != ga->Group)) {
+                return false;
+            }
+            ga->Group = g;
+            ga->Mask |= (KAFFINITY)1 << (c - base);
+            any = true;
+        }
+        s = end;
+        if (*s == L',') {
+            s++;
+        } else if (*s != WNULL) {
+            return false;
+        }
+    }
+    return any;
+}
+
+static void print_list(out_stream &out, const GROUP_AFFINITY &ga)
+{
+    DWORD base = group_base(ga.Group);
+    bool first = true;
+
+    for (unsigned c = 0; c < AFFINITY_BITS; c++) {
+        if (!((ga.Mask >> c) & 1)) {
+            continue;
+        }
+        unsigned e = c;
+        while (e + 1 < AFFINITY_BITS && ((ga.Mask >> (e + 1)) & 1)) e++;
+        out.printf(e > c ? L"%s%u-%u" : L"%s%u", first ? L"" : L",", base + c, base + e);
+        first = false;
+        c = e;
+    }
+}
+
+int do_builtin_place(vector<WCHAR *> &args, builtin_io &io)
+{
+    size_t n = args.size();
+    placement p;
+
+    if (n == 1) {
+        const placement &cur = t_placement;
+        if (cur.policy == PLACE_LISTS) {
+            for (size_t i = 0; i < cur.lists.size(); i++) {
+                if (i > 0) {
+                    io.out->write(L" ", 1);
+                }
+                print_list(*io.out, cur.lists[i]);
+            }
+            io.out->write(L"\n", 1);
+        } else {
+            io.out->printf(L"%s\n", cur.policy == PLACE_PACK ? L"pack" : cur.policy == PLACE_SPREAD ? L"spread" : L"off");
+        }
+        return 0;
+    }
+
+    p.policy = PLACE_LISTS;
+    if (n == 2 && wcscmp(args[1], L"off") == 0) {
+        p.policy = PLACE_OFF;
+    } else if (n == 2 && wcscmp(args[1], L"pack") == 0) {
+        p.policy = PLACE_PACK;
+    } else if (n == 2 && wcscmp(args[1], L"spread") == 0) {
+        p.policy = PLACE_SPREAD;
+    } else {
+        for (size_t i = 1; i < n; i++) {
+            GROUP_AFFINITY ga;
+            if (!parse_list(args[i], &ga)) {
+                io.out->printf(L"place: invalid processor list %s\n", args[i]);
+                return 1;
+            }
+            p.lists.push_back(ga);
+        }
+    }
+
+    t_placement = p;
+    return 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+#include <Windows.h>
+
+#include "builtin.h"
+
+/*
+ * Where the stages of a pipeline run:
+ *
+ *   place                 show the policy
+ *   place off             leave it to the scheduler (the default)
+ *   place pack            stage i on the i-th logical processor, so that
+ *                         neighbouring stages share a core and its caches
+ *   place spread          each stage on a core of its own, spaced evenly
+ *                         over all cores and so over all sockets
+ *   place LIST...         stage i on the i-th list, such as 0-1 2-3; the
+ *                         lists are reused when there are more stages
+ *
+ * Processor numbers count across processor groups; one list has to stay
+ * within one group. A placed child starts in the group of its processors,
+ * with all of its threads limited to them. ulimit -C, if set, wins.
+ * Like limits, a policy set inside ( ... ) ends with the group.
+ */
+
+enum place_policy {
+    PLACE_OFF,
+    PLACE_PACK,
+    PLACE_SPREAD,
+    PLACE_LISTS,
+};
+
+struct placement {
+    place_policy policy;
+    std::vector<GROUP_AFFINITY> lists;
+};
+
+// per thread, like the shell's variables
+const placement &get_placement();
+void set_placement(const placement &p);
+
+// the processors for stage i of a pipeline of n stages; false when stages are not placed
+bool place_stage(size_t i, size_t n, GROUP_AFFINITY *ga);
+
+int do_builtin_place(std::vector<WCHAR *> &args, builtin_io &io);
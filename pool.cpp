@@ -0,0 +1,464 @@
+#include <cstddef>
+
+#include <winternl.h>
+
+#include "builtin.h"
+#include "output.h"
+#include "path.h"
+#include "pool.h"
+
+using namespace std;
+
+// room left on a copy's command line, in characters
+#define POOL_RESERVE 8192
+#define POOL_PROGRAMS 16
+// the block holds pointers rather than offsets from its start
+#define PARAMS_NORMALIZED 0x01
+
+/*
+ * The start of RTL_USER_PROCESS_PARAMETERS, which winternl.h mostly keeps
+ * reserved. The loader reads the command line and standard handles from
+ * here when the process first runs, so a suspended one can still be changed.
+ * These fields sit at the same offsets in the public symbols of every
+ * release from Windows XP to Windows 11, checked below for x64 and x86;
+ * hand_over still checks the sizes and flags it finds before writing.
+ */
+struct process_params {
+    ULONG max_length;
+    ULONG length;
+    ULONG flags;
+    ULONG debug_flags;
+    HANDLE console;
+    ULONG console_flags;
+    HANDLE std[3];
+    UNICODE_STRING cwd;
+    HANDLE cwd_handle;
+    UNICODE_STRING dll_path;
+    UNICODE_STRING image;
+    UNICODE_STRING command_line;
+    PVOID environment;
+    ULONG x, y, cx, cy, chars_x, chars_y, fill;
+    ULONG window_flags;
+};
+
+#if defined(_WIN64)
+static_assert(offsetof(process_params, std) == 0x20, "unexpected process parameters layout");
+static_assert(offsetof(process_params, command_line) == 0x70, "unexpected process parameters layout");
+static_assert(offsetof(process_params, window_flags) == 0xa4, "unexpected process parameters layout");
+#elif defined(_WIN32)
+static_assert(offsetof(process_params, std) == 0x18, "unexpected process parameters layout");
+static_assert(offsetof(process_params, command_line) == 0x40, "unexpected process parameters layout");
+static_assert(offsetof(process_params, window_flags) == 0x68, "unexpected process parameters layout");
+#endif
+
+using query_fn = NTSTATUS(NTAPI *)(HANDLE, PROCESSINFOCLASS, PVOID, ULONG, PULONG);
+
+struct spare {
+    PROCESS_INFORMATION pi;
+    tstring cwd;
+    ULONGLONG env;
+};
+
+struct program {
+    tstring name; // the first word of the command line
+    vector<spare> spares;
+    unsigned pending; // copies being created
+    bool unusable;    // not a process the shell can change, such as a 32-bit one
+};
+
+static SRWLOCK g_lock = SRWLOCK_INIT;
+static vector<program> g_programs;
+static unsigned g_size;
+static ULONGLONG g_hits, g_misses;
+// refills queued or running, and an event set while there are none
+static unsigned g_refills;
+static HANDLE g_idle;
+
+static void end_spare(spare &s)
+{
+    TerminateProcess(s.pi.hProcess, 1);
+    CloseHandle(s.pi.hThread);
+    CloseHandle(s.pi.hProcess);
+}
+
+// the first word of cmdline, which names the program
+static tstring program_name(const WCHAR *cmdline)
+{
+    const WCHAR *e = cmdline;
+
+    if (*e == L'"') {
+        e = wcschr(e + 1, L'"');
+        e = e ? e + 1 : cmdline + wcslen(cmdline);
+    } else {
+        while (*e != WNULL && !iswspace(*e)) e++;
+    }
+    return tstring(cmdline, e - cmdline);
+}
+
+// a hash of the environment block, which a copy inherits when it is created
+static ULONGLONG env_hash()
+{
+    LPWCH env = GetEnvironmentStringsW();
+    ULONGLONG h = 14695981039346656037ULL;
+
+    if (!env) {
+        return 0;
+    }
+    for (const WCHAR *p = env; *p != WNULL; p += wcslen(p) + 1) {
+        for (const WCHAR *c = p; *c != WNULL; c++) {
+            h = (h ^ *c) * 1099511628211ULL;
+        }
+        h = (h ^ L'\n') * 1099511628211ULL;
+    }
+    FreeEnvironmentStringsW(env);
+    return h;
+}
+
+static program *find_program(const tstring &name)
+{
+    for (program &p : g_programs) {
+        if (p.name.size() == name.size() && wcscmp(p.name.c_str(), name.c_str()) == 0) {
+            return &p;
+        }
+    }
+    return nullptr;
+}
+
+static void CALLBACK refill(PTP_CALLBACK_INSTANCE inst, void *param)
+{
+    (void)inst;
+    tstring *name = (tstring *)param;
+    STARTUPINFOW si;
+    spare s;
+    tstring line(*name);
+    BOOL is_wow64 = FALSE;
+    BOOL ok;
+
+    ZeroMemory(&si, sizeof(si));
+    si.cb = sizeof(si);
+    for (int i = 0; i < POOL_RESERVE; i++) {
+        line.append(L' ');
+    }
+
+    s.env = env_hash();
+    bool have_cwd = current_dir(s.cwd);
+    ok = FALSE;
+    if (have_cwd) {
+        ok = CreateProcessW(nullptr, line.data(), nullptr, nullptr, FALSE, CREATE_SUSPENDED, nullptr, nullptr, &si,
+                            &s.pi);
+    }
+    if (ok != FALSE) {
+        IsWow64Process(s.pi.hProcess, &is_wow64);
+    }
+
+    AcquireSRWLockExclusive(&g_lock);
+    program *p = find_program(*name);
+    if (p) {
+        p->pending--;
+        p->unusable = p->unusable || (have_cwd && ok == FALSE) || is_wow64;
+    }
+    // the shell may have changed directory while the copy was created
+    tstring cwd;
+    bool keep = ok != FALSE && p && !p->unusable && p->spares.size() < g_size && current_dir(cwd) &&
+                wcscmp(cwd.c_str(), s.cwd.c_str()) == 0;
+    if (keep) {
+        p->spares.push_back(std::move(s));
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+
+    if (ok != FALSE && !keep) {
+        end_spare(s);
+    }
+    delete name;
+
+    AcquireSRWLockExclusive(&g_lock);
+    if (--g_refills == 0) {
+        SetEvent(g_idle);
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+}
+
+// called with the lock held
+static void request_copies(program &p)
+{
+    while (p.spares.size() + p.pending < g_size && !p.unusable) {
+        tstring *name = new tstring(p.name);
+        if (!TrySubmitThreadpoolCallback(refill, name, nullptr)) {
+            delete name;
+            break;
+        }
+        p.pending++;
+        if (g_refills++ == 0) {
+            ResetEvent(g_idle);
+        }
+    }
+}
+
+// writes the command line and standard handles into a suspended copy
+static bool hand_over(const spare &s, const WCHAR *cmdline, const HANDLE *handles)
+{
+    // through void (*)(void), which GCC accepts as a generic function pointer
+    static query_fn query =
+        (query_fn)(void (*)(void))GetProcAddress(GetModuleHandleW(L"ntdll.dll"), "NtQueryInformationProcess");
+    HANDLE h = s.pi.hProcess;
+    PROCESS_BASIC_INFORMATION pbi;
+    PEB peb;
+    process_params pp;
+    size_t n = wcslen(cmdline);
+
+    if (!query || query(h, ProcessBasicInformation, &pbi, sizeof(pbi), nullptr) != 0 ||
+        ReadProcessMemory(h, pbi.PebBaseAddress, &peb, sizeof(peb), nullptr) == FALSE ||
+        ReadProcessMemory(h, peb.ProcessParameters, &pp, sizeof(pp), nullptr) == FALSE) {
+        return false;
+    }
+    // a shorter block, or one not yet turned into pointers, is not what the fields above describe
+    if (pp.length < sizeof(pp) || pp.max_length < pp.length || (pp.flags & PARAMS_NORMALIZED) == 0) {
+        return false;
+    }
+    const UNICODE_STRING &line = pp.command_line;
+    if (!line.Buffer || line.Length > line.MaximumLength || (n + 1) * sizeof(WCHAR) > line.MaximumLength) {
+        return false;
+    }
+
+    if (WriteProcessMemory(h, pp.command_line.Buffer, cmdline, (n + 1) * sizeof(WCHAR), nullptr) == FALSE) {
+        return false;
+    }
+    pp.command_line.Length = (USHORT)(n * sizeof(WCHAR));
+    if (handles) {
+        for (int i = 0; i < 3; i++) {
+            // inheritable, so that the program's own children get them too
+            if (DuplicateHandle(GetCurrentProcess(), handles[i], h, &pp.std[i], 0, TRUE, DUPLICATE_SAME_ACCESS) ==
+                FALSE) {
+                return false;
+            }
+        }
+        pp.window_flags |= STARTF_USESTDHANDLES;
+    }
+    return WriteProcessMemory(h, peb.ProcessParameters, &pp, sizeof(pp), nullptr) != FALSE;
+}
+
+bool pool_take(WCHAR *cmdline, const HANDLE *handles, PROCESS_INFORMATION *pi)
+{
+    vector<spare> stale;
+    tstring name, cwd;
+    spare s;
+    bool found = false;
+
+    AcquireSRWLockShared(&g_lock);
+    bool on = g_size != 0;
+    ReleaseSRWLockShared(&g_lock);
+    if (!on) {
+        return false;
+    }
+
+    name = program_name(cmdline);
+    if (!current_dir(cwd)) {
+        return false;
+    }
+    ULONGLONG env = env_hash();
+
+    AcquireSRWLockExclusive(&g_lock);
+    program *p = find_program(name);
+    if (!p && g_programs.size() < POOL_PROGRAMS) {
+        g_programs.push_back(program{name, {}, 0, false});
+        p = &g_programs.back();
+    }
+    // copies made before a cd or an environment change would start out of date
+    while (p && !p->spares.empty() && !found) {
+        spare &last = p->spares.back();
+        found = last.env == env && wcscmp(last.cwd.c_str(), cwd.c_str()) == 0;
+        if (found) {
+            s = std::move(last);
+        } else {
+            stale.push_back(std::move(last));
+        }
+        p->spares.pop_back();
+    }
+    if (p) {
+        request_copies(*p);
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+
+    for (spare &o : stale) {
+        end_spare(o);
+    }
+    if (found && !hand_over(s, cmdline, handles)) {
+        end_spare(s);
+        found = false;
+    }
+
+    AcquireSRWLockExclusive(&g_lock);
+    if (found) {
+        g_hits++;
+    } else {
+        g_misses++;
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+
+    if (found) {
+        *pi = s.pi;
+    }
+    return found;
+}
+
+static void set_size(unsigned n)
+{
+    vector<spare> ended;
+
+    AcquireSRWLockExclusive(&g_lock);
+    g_size = n;
+    for (program &p : g_programs) {
+        while (p.spares.size() > n) {
+            ended.push_back(std::move(p.spares.back()));
+            p.spares.pop_back();
+        }
+        request_copies(p);
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+
+    for (spare &s : ended) {
+        end_spare(s);
+    }
+}
+
+// a copy still being created when the shell exits would be left suspended
+static void end_all()
+{
+    set_size(0);
+    WaitForSingleObject(g_idle, INFINITE);
+}
+
+// n launches of cmd, one after the other, with NUL as their standard handles
+static double launch_rate(const WCHAR *cmd, int n, bool pooled, HANDLE nul)
+{
+    HANDLE handles[3] = {nul, nul, nul};
+    LARGE_INTEGER freq, t0, t1;
+    STARTUPINFOW si;
+
+    ZeroMemory(&si, sizeof(si));
+    si.cb = sizeof(si);
+    si.hStdInput = nul;
+    si.hStdOutput = nul;
+    si.hStdError = nul;
+    si.dwFlags = STARTF_USESTDHANDLES;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t0);
+    for (int i = 0; i < n; i++) {
+        tstring line(cmd);
+        PROCESS_INFORMATION pi;
+
+        if (pooled && pool_take(line.data(), handles, &pi)) {
+            ResumeThread(pi.hThread);
+        } else if (CreateProcessW(nullptr, line.data(), nullptr, nullptr, TRUE, 0, nullptr, nullptr, &si, &pi) ==
+                   FALSE) {
+            return -1;
+        }
+        WaitForSingleObject(pi.hProcess, INFINITE);
+        CloseHandle(pi.hThread);
+        CloseHandle(pi.hProcess);
+    }
+    QueryPerformanceCounter(&t1);
+
+    return t1.QuadPart > t0.QuadPart ? (double)n * freq.QuadPart / (t1.QuadPart - t0.QuadPart) : 0;
+}
+
+static int bench(vector<WCHAR *> &args, builtin_io &io)
+{
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
+    int n = args.size() > 2 ? _wtoi(args[2]) : 0;
+    unsigned size;
+    ULONGLONG hits;
+    tstring cmd;
+    double cold, pooled;
+
+    if (n <= 0 || args.size() < 4) {
+        io.out->printf(L"pool: usage: pool -b N command...\n");
+        return 1;
+    }
+    for (size_t i = 3; i < args.size(); i++) {
+        if (i > 3) {
+            cmd.append(L' ');
+        }
+        cmd.append(args[i]);
+    }
+
+    HANDLE nul = CreateFileW(L"NUL", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa,
+                             OPEN_EXISTING, 0, nullptr);
+    if (nul == INVALID_HANDLE_VALUE) {
+        io.out->printf(L"pool: cannot open NUL (error %d)\n", GetLastError());
+        return 1;
+    }
+
+    AcquireSRWLockShared(&g_lock);
+    size = g_size;
+    ReleaseSRWLockShared(&g_lock);
+
+    cold = launch_rate(cmd.c_str(), n, false, nul);
+    set_size(size ? size : 1);
+    AcquireSRWLockShared(&g_lock);
+    hits = g_hits;
+    ReleaseSRWLockShared(&g_lock);
+    pooled = launch_rate(cmd.c_str(), n, true, nul);
+    AcquireSRWLockShared(&g_lock);
+    hits = g_hits - hits;
+    ReleaseSRWLockShared(&g_lock);
+    set_size(size);
+    CloseHandle(nul);
+
+    if (cold < 0 || pooled < 0) {
+        io.out->printf(L"pool: cannot start %s (error %d)\n", cmd.c_str(), GetLastError());
+        return 1;
+    }
+    io.out->printf(L"cold:   %.1f launches/s\n", cold);
+    io.out->printf(L"pooled: %.1f launches/s (%llu of %d from the pool)\n", pooled, hits, n);
+    return 0;
+}
+
+int do_builtin_pool(vector<WCHAR *> &args, builtin_io &io)
+{
+    static bool registered;
+    size_t n = args.size();
+
+    if (n == 1) {
+        AcquireSRWLockShared(&g_lock);
+        io.out->printf(L"%u per program, %llu launches from the pool, %llu started cold\n", g_size, g_hits,
+                       g_misses);
+        for (const program &p : g_programs) {
+            io.out->printf(L"  %s: %u ready%s\n", p.name.c_str(), (unsigned)p.spares.size(),
+                           p.unusable ? L" (cannot be pooled)" : L"");
+        }
+        ReleaseSRWLockShared(&g_lock);
+        return 0;
+    }
+
+    if (!registered) {
+        g_idle = CreateEventW(nullptr, TRUE, TRUE, nullptr);
+        if (!g_idle) {
+            io.out->printf(L"pool: cannot create event (error %d)\n", GetLastError());
+            return 1;
+        }
+        // suspended copies would otherwise outlive the shell
+        atexit(end_all);
+        registered = true;
+    }
+
+    if (wcscmp(args[1], L"-b") == 0) {
+        return bench(args, io);
+    }
+    if (n == 2 && wcscmp(args[1], L"off") == 0) {
+        set_size(0);
+        return 0;
+    }
+    if (n == 2 && iswdigit(args[1][0])) {
+        WCHAR *end;
+        unsigned long k = wcstoul(args[1], &end, 10);
+        if (*end == WNULL && k <= 64) {
+            set_size((unsigned)k);
+            return 0;
+        }
+    }
+
+    io.out->printf(L"pool: invalid argument %s\n", args[1]);
+    return 1;
+}
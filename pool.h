@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+
+#include <Windows.h>
+
+#include "builtin.h"
+
+/*
+ * Processes created ahead of time, for scripts that start the same small
+ * program many times over:
+ *
+ *   pool                  show the pool and how often it was used
+ *   pool N                keep N suspended copies of each program started
+ *   pool off              end the copies and stop (the default)
+ *   pool -b N command...  time N launches of command, cold and from the pool
+ *
+ * A copy is created suspended, without inheriting handles, and with a
+ * command line padded to leave room. When its program is started again from
+ * the same directory with the same environment, the shell writes the real
+ * command line and standard handles into it and lets it run, and creates
+ * the next copy on the thread pool meanwhile. Anything else, such as a
+ * placed stage or a longer command line, is started the usual way. Copies
+ * are ended when the shell exits.
+ */
+
+// a copy of cmdline's program set up to run cmdline, still suspended; handles null keeps the shell's
+bool pool_take(WCHAR *cmdline, const HANDLE *handles, PROCESS_INFORMATION *pi);
+
+int do_builtin_pool(std::vector<WCHAR *> &args, builtin_io &io);
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <Windows.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include <emmintrin.h>
+
+/*
+ * Vectorized scanners used by the command line parser and the text builtins.
+ *
+ * Command lines are UTF-16, so each lane is a 16-bit code unit: SSE2 checks
+ * 8 characters per step and AVX2 (when the build enables it) 16. File data
+ * is scanned as bytes, 16 per SSE2 step.
+ */
+
+static_assert(sizeof(WCHAR) == 2, "scanners assume UTF-16 code units");
+
+static inline bool is_special(const WCHAR *s, size_t i, size_t n)
+{
+    switch (s[i]) {
+    case L'|':
+    case L'<':
+    case L'>':
+    case L'&':
+    case L';':
+    case L'(':
+    case L')':
+    case L'\n':
+    case L'\\':
+    case L'`':
+        return true;
+    case L'2':
+        return i + 1 < n && s[i + 1] == L'>';
+    default:
+        return false;
+    }
+}
+
+/*
+ * Return the index of the first character in s[0, n) the parser has to look
+ * at (| < > & ; ( ) newline \ ` or the 2 of 2>), or n if the whole run is plain text.
+ */
+static inline size_t find_special(const WCHAR *s, size_t n)
+{
+    size_t i = 0;
+
+#ifdef __AVX2__
+    const __m256i pipe8 = _mm256_set1_epi16(L'|');
+    const __m256i lt8 = _mm256_set1_epi16(L'<');
+    const __m256i gt8 = _mm256_set1_epi16(L'>');
+    const __m256i amp8 = _mm256_set1_epi16(L'&');
+    const __m256i bs8 = _mm256_set1_epi16(L'\\');
+    const __m256i two8 = _mm256_set1_epi16(L'2');
+    const __m256i semi8 = _mm256_set1_epi16(L';');
+    const __m256i lp8 = _mm256_set1_epi16(L'(');
+    const __m256i rp8 = _mm256_set1_epi16(L')');
+    const __m256i nl8 = _mm256_set1_epi16(L'\n');
+    const __m256i bq8 = _mm256_set1_epi16(L'`');
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)&s[i]);
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi16(v, pipe8), _mm256_cmpeq_epi16(v, lt8)),
+            _mm256_or_si256(_mm256_cmpeq_epi16(v, gt8), _mm256_cmpeq_epi16(v, amp8)));
+        m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi16(v, bs8), _mm256_cmpeq_epi16(v, two8)));
+        m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi16(v, semi8),
+            _mm256_or_si256(_mm256_cmpeq_epi16(v, lp8), _mm256_cmpeq_epi16(v, rp8))));
+        m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi16(v, nl8), _mm256_cmpeq_epi16(v, bq8)));
+
+        unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+        while (mask) {
+            size_t k = i + (__builtin_ctz(mask) >> 1);
+            if (is_special(s, k, n)) {
+                return k;
+            }
+            mask &= ~(3u << ((k - i) << 1));
+        }
+    }
+#endif
+
+    const __m128i pipe = _mm_set1_epi16(L'|');
+    const __m128i lt = _mm_set1_epi16(L'<');
+    const __m128i gt = _mm_set1_epi16(L'>');
+    const __m128i amp = _mm_set1_epi16(L'&');
+    const __m128i bs = _mm_set1_epi16(L'\\');
+    const __m128i two = _mm_set1_epi16(L'2');
+    const __m128i semi = _mm_set1_epi16(L';');
+    const __m128i lp = _mm_set1_epi16(L'(');
+    const __m128i rp = _mm_set1_epi16(L')');
+    const __m128i nl = _mm_set1_epi16(L'\n');
+    const __m128i bq = _mm_set1_epi16(L'`');
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&s[i]);
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi16(v, pipe), _mm_cmpeq_epi16(v, lt)),
+            _mm_or_si128(_mm_cmpeq_epi16(v, gt), _mm_cmpeq_epi16(v, amp)));
+        m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi16(v, bs), _mm_cmpeq_epi16(v, two)));
+        m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi16(v, semi),
+            _mm_or_si128(_mm_cmpeq_epi16(v, lp), _mm_cmpeq_epi16(v, rp))));
+        m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi16(v, nl), _mm_cmpeq_epi16(v, bq)));
+
+        unsigned mask = (unsigned)_mm_movemask_epi8(m);
+        while (mask) {
+            size_t k = i + (__builtin_ctz(mask) >> 1);
+            if (is_special(s, k, n)) {
+                return k;
+            }
+            mask &= ~(3u << ((k - i) << 1));
+        }
+    }
+
+    for (; i < n; i++) {
+        if (is_special(s, i, n)) {
+            return i;
+        }
+    }
+
+    return n;
+}
+
+// number of newlines in [p, e)
+static inline size_t count_lines(const char *p, const char *e)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t n = 0;
+
+    for (; p + 16 <= e; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        n += __builtin_popcount((unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+    }
+    for (; p < e; p++) {
+        n += *p == '\n';
+    }
+
+    return n;
+}
@@ -0,0 +1,438 @@
+#include <cstdint>
+#include <cstring>
+
+#include "container.h"
+#include "output.h"
+#include "path.h"
+#include "serve.h"
+#include "vars.h"
+
+using namespace std;
+
+#define SERVE_WORKERS 8
+#define SERVE_BUFFER (64 * 1024)
+#define SERVE_MAX_FRAME (16 * 1024 * 1024) // larger requests end the connection
+#define SERVE_HEAD 5
+
+struct serve_state {
+    tstring pipe;
+    tstring home; // where every command starts unless the request names a directory
+    serve_fn run;
+    SRWLOCK exec;
+};
+
+struct serve_slot {
+    serve_state *state;
+    HANDLE pipe;
+};
+
+struct serve_conn {
+    HANDLE pipe;
+    SRWLOCK lock; // frames from the relays and the worker must not interleave
+};
+
+struct relay_job {
+    serve_conn *conn;
+    HANDLE r;
+    char kind;
+    HANDLE done;
+};
+
+struct env_saved {
+    tstring name;
+    tstring value;
+    bool had;
+};
+
+static void pipe_name(const WCHAR *name, tstring &out)
+{
+    if (wcsncmp(name, L"\\\\", 2) != 0) {
+        out.append(L"\\\\.\\pipe\\");
+    }
+    out.append(name);
+}
+
+static bool read_all(HANDLE h, void *p, DWORD n)
+{
+    char *c = (char *)p;
+    DWORD got;
+
+    while (n > 0) {
+        if (ReadFile(h, c, n, &got, nullptr) == FALSE || got == 0) {
+            return false;
+        }
+        c += got;
+        n -= got;
+    }
+    return true;
+}
+
+static bool write_all(HANDLE h, const void *p, DWORD n)
+{
+    const char *c = (const char *)p;
+    DWORD written;
+
+    while (n > 0) {
+        if (WriteFile(h, c, n, &written, nullptr) == FALSE) {
+            return false;
+        }
+        c += written;
+        n -= written;
+    }
+    return true;
+}
+
+static inline void put_head(char *head, char kind, DWORD n)
+{
+    uint32_t len = (uint32_t)n;
+
+    head[0] = kind;
+    memcpy(head + 1, &len, sizeof(len));
+}
+
+static bool recv_head(HANDLE h, char &kind, DWORD &n)
+{
+    char head[SERVE_HEAD];
+    uint32_t len;
+
+    if (!read_all(h, head, SERVE_HEAD)) {
+        return false;
+    }
+    kind = head[0];
+    memcpy(&len, head + 1, sizeof(len));
+    n = len;
+    return true;
+}
+
+// frame holds SERVE_HEAD bytes of room for the header, followed by n bytes of payload
+static bool send_frame(serve_conn &c, char *frame, char kind, DWORD n)
+{
+    bool ok;
+
+    put_head(frame, kind, n);
+    AcquireSRWLockExclusive(&c.lock);
+    ok = write_all(c.pipe, frame, SERVE_HEAD + n);
+    ReleaseSRWLockExclusive(&c.lock);
+    return ok;
+}
+
+static void CALLBACK relay(PTP_CALLBACK_INSTANCE inst, void *param)
+{
+    (void)inst;
+    relay_job *job = (relay_job *)param;
+    vector<char> buf(SERVE_HEAD + SERVE_BUFFER);
+    DWORD nread;
+
+    // a client that went away is not written to, but the pipe is still drained
+    bool live = true;
+    while (ReadFile(job->r, buf.data() + SERVE_HEAD, SERVE_BUFFER, &nread, nullptr) != FALSE && nread > 0) {
+        live = live && send_frame(*job->conn, buf.data(), job->kind, nread);
+    }
+    CloseHandle(job->r);
+    SetEvent(job->done);
+}
+
+static void apply_env(const vector<tstring> &env, vector<env_saved> &saved)
+{
+    for (const tstring &v : env) {
+        const WCHAR *eq = wcschr(v.c_str(), L'=');
+        if (!eq || eq == v.c_str()) {
+            continue;
+        }
+        env_saved s;
+        s.name = tstring(v.c_str(), eq - v.c_str());
+        DWORD n = GetEnvironmentVariableW(s.name.c_str(), nullptr, 0);
+        s.had = n > 0;
+        if (s.had) {
+            s.value.resize(n);
+            s.value.resize(GetEnvironmentVariableW(s.name.c_str(), s.value.data(), n));
+        }
+        SetEnvironmentVariableW(s.name.c_str(), eq + 1);
+        saved.push_back(s);
+    }
+}
+
+// in reverse, so a name given twice gets its original value back
+static void restore_env(vector<env_saved> &saved)
+{
+    for (size_t i = saved.size(); i-- > 0;) {
+        SetEnvironmentVariableW(saved[i].name.c_str(), saved[i].had ? saved[i].value.c_str() : nullptr);
+    }
+    saved.clear();
+}
+
+/*
+ * Runs one request. Its output pipes are created only once it holds the
+ * exec lock: they are inheritable, and a command running for another client
+ * must not start a child that keeps them open.
+ */
+static int run_request(serve_state &s, serve_conn &c, const tstring &dir, const vector<tstring> &env,
+                       const tstring &line)
+{
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
+    relay_job jobs[2];
+    HANDLE w[2] = {nullptr, nullptr};
+    HANDLE done[2];
+    HANDLE in;
+    DWORD started = 0;
+    int status = 1;
+
+    AcquireSRWLockExclusive(&s.exec);
+    in = CreateFileW(L"NUL", GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
+    for (; started < 2; started++) {
+        relay_job &j = jobs[started];
+        j.conn = &c;
+        j.kind = "OE"[started];
+        j.done = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        if (!j.done) {
+            break;
+        }
+        if (CreatePipe(&j.r, &w[started], &sa, 0) == FALSE) {
+            CloseHandle(j.done);
+            break;
+        }
+        SetHandleInformation(j.r, HANDLE_FLAG_INHERIT, 0);
+        if (!TrySubmitThreadpoolCallback(relay, &j, nullptr)) {
+            CloseHandle(j.r);
+            CloseHandle(w[started]);
+            CloseHandle(j.done);
+            w[started] = nullptr;
+            break;
+        }
+        done[started] = j.done;
+    }
+
+    if (in != INVALID_HANDLE_VALUE && started == 2) {
+        out_stream msg(w[0]);
+        var_table vars;
+        vector<env_saved> saved;
+
+        // the shell's own messages, such as syntax errors, go to the client too
+        out_bind(&msg);
+        swap_vars(vars);
+        apply_env(env, saved);
+        if (SetCurrentDirectoryW(dir.empty() ? s.home.c_str() : dir.c_str())) {
+            status = s.run(line.c_str(), in, w[0], w[1]);
+        } else {
+            out_printf(L"cd: %s (error %d)\n", dir.c_str(), GetLastError());
+        }
+        SetCurrentDirectoryW(s.home.c_str());
+        restore_env(saved);
+        swap_vars(vars);
+        out_flush();
+        out_bind(nullptr);
+    } else {
+        out_printf(L"serve: internal error %d\n", GetLastError());
+        out_flush();
+    }
+    if (in != INVALID_HANDLE_VALUE) {
+        CloseHandle(in);
+    }
+    for (DWORD i = 0; i < started; i++) {
+        CloseHandle(w[i]);
+    }
+    ReleaseSRWLockExclusive(&s.exec);
+
+    // every write end is closed once the command's processes are gone, so the relays see the end
+    if (started > 0) {
+        WaitForMultipleObjects(started, done, TRUE, INFINITE);
+    }
+    for (DWORD i = 0; i < started; i++) {
+        CloseHandle(done[i]);
+    }
+    return status;
+}
+
+static void serve_client(serve_state &s, HANDLE pipe)
+{
+    serve_conn c;
+    tstring dir, text;
+    vector<tstring> env;
+    char kind;
+    DWORD n;
+
+    c.pipe = pipe;
+    InitializeSRWLock(&c.lock);
+
+    while (recv_head(pipe, kind, n) && n <= SERVE_MAX_FRAME && n % sizeof(WCHAR) == 0) {
+        text.resize(n / sizeof(WCHAR));
+        if (!read_all(pipe, text.data(), n)) {
+            return;
+        }
+        switch (kind) {
+        case 'D':
+            dir = text;
+            break;
+        case 'V':
+            env.push_back(text);
+            break;
+        case 'C': {
+            char frame[SERVE_HEAD + sizeof(int32_t)];
+            int32_t status = run_request(s, c, dir, env, text);
+            memcpy(frame + SERVE_HEAD, &status, sizeof(status));
+            if (!send_frame(c, frame, 'X', sizeof(status))) {
+                return;
+            }
+            dir.clear();
+            env.clear();
+            break;
+        }
+        default:
+            return;
+        }
+    }
+}
+
+static DWORD WINAPI serve_worker(void *param)
+{
+    serve_slot *slot = (serve_slot *)param;
+
+    while (true) {
+        if (ConnectNamedPipe(slot->pipe, nullptr) != FALSE || GetLastError() == ERROR_PIPE_CONNECTED) {
+            serve_client(*slot->state, slot->pipe);
+        }
+        DisconnectNamedPipe(slot->pipe);
+    }
+
+    return 0;
+}
+
+int serve(const WCHAR *name, serve_fn run)
+{
+    serve_state s;
+    vector<serve_slot> slots(SERVE_WORKERS);
+
+    pipe_name(name, s.pipe);
+    if (!current_dir(s.home)) {
+        out_printf(L"serve: cannot get the current directory (error %d)\n", GetLastError());
+        return 1;
+    }
+    s.run = run;
+    InitializeSRWLock(&s.exec);
+
+    // the first instance claims the name, so a second server on it fails here
+    for (size_t i = 0; i < slots.size(); i++) {
+        DWORD open = PIPE_ACCESS_DUPLEX;
+        if (i == 0) {
+            open |= FILE_FLAG_FIRST_PIPE_INSTANCE;
+        }
+        slots[i].state = &s;
+        slots[i].pipe = CreateNamedPipeW(s.pipe.c_str(), open,
+                                         PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                                         PIPE_UNLIMITED_INSTANCES, SERVE_BUFFER, SERVE_BUFFER, 0, nullptr);
+        if (slots[i].pipe == INVALID_HANDLE_VALUE) {
+            out_printf(L"serve: cannot create %s (error %d)\n", s.pipe.c_str(), GetLastError());
+            out_flush();
+            return 1;
+        }
+    }
+
+    out_printf(L"serving on %s\n", s.pipe.c_str());
+    out_flush();
+
+    // the last worker is this thread
+    for (size_t i = 0; i + 1 < slots.size(); i++) {
+        HANDLE t = CreateThread(nullptr, 0, serve_worker, &slots[i], 0, nullptr);
+        if (!t) {
+            out_printf(L"serve: cannot start worker (error %d)\n", GetLastError());
+            out_flush();
+            CloseHandle(slots[i].pipe);
+            continue;
+        }
+        CloseHandle(t);
+    }
+    serve_worker(&slots.back());
+
+    return 0;
+}
+
+static void append_frame(vector<char> &req, char kind, const tstring &text)
+{
+    size_t at = req.size();
+    DWORD n = (DWORD)(text.size() * sizeof(WCHAR));
+
+    req.resize(at + SERVE_HEAD + n);
+    put_head(req.data() + at, kind, n);
+    memcpy(req.data() + at + SERVE_HEAD, text.c_str(), n);
+}
+
+static HANDLE connect_pipe(const tstring &pipe)
+{
+    HANDLE h;
+
+    while (true) {
+        h = CreateFileW(pipe.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+        // every instance busy: wait for a worker to finish with its client
+        if (h != INVALID_HANDLE_VALUE || GetLastError() != ERROR_PIPE_BUSY ||
+            !WaitNamedPipeW(pipe.c_str(), NMPWAIT_WAIT_FOREVER)) {
+            return h;
+        }
+    }
+}
+
+int serve_connect(const WCHAR *name, const WCHAR *line, const vector<WCHAR *> &env, int count)
+{
+    out_stream out(GetStdHandle(STD_OUTPUT_HANDLE));
+    out_stream err(GetStdHandle(STD_ERROR_HANDLE), &out);
+    tstring pipe, dir;
+    vector<char> req, buf;
+    LARGE_INTEGER freq, t0, t1;
+    int32_t status = 0;
+    DWORD n;
+    HANDLE h;
+
+    pipe_name(name, pipe);
+    h = connect_pipe(pipe);
+    if (h == INVALID_HANDLE_VALUE) {
+        err.printf(L"connect: %s (error %d)\n", pipe.c_str(), GetLastError());
+        return 1;
+    }
+
+    if (!current_dir(dir)) {
+        err.printf(L"connect: cannot get the current directory (error %d)\n", GetLastError());
+        CloseHandle(h);
+        return 1;
+    }
+    append_frame(req, 'D', dir);
+    for (WCHAR *v : env) {
+        append_frame(req, 'V', tstring(v));
+    }
+    append_frame(req, 'C', tstring(line));
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t0);
+    for (int i = 0; i < count; i++) {
+        char kind = 0;
+
+        bool sent = write_all(h, req.data(), (DWORD)req.size());
+        while (sent && recv_head(h, kind, n) && n <= SERVE_MAX_FRAME) {
+            buf.resize(n);
+            if (!read_all(h, buf.data(), n)) {
+                kind = 0;
+                break;
+            }
+            if (kind == 'O') {
+                out.write(buf.data(), n);
+            } else if (kind == 'E') {
+                err.write(buf.data(), n);
+            } else if (kind == 'X' && n == sizeof(status)) {
+                memcpy(&status, buf.data(), sizeof(status));
+                break;
+            }
+        }
+        if (kind != 'X') {
+            err.printf(L"connect: %s closed the connection\n", pipe.c_str());
+            CloseHandle(h);
+            return 1;
+        }
+    }
+    QueryPerformanceCounter(&t1);
+    CloseHandle(h);
+
+    if (count > 1) {
+        double ms = (double)(t1.QuadPart - t0.QuadPart) * 1000.0 / (double)freq.QuadPart;
+        err.printf(L"%d runs in %.3f ms, %.1f us each\n", count, ms, ms * 1000.0 / count);
+    }
+
+    return status;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+
+#include <Windows.h>
+
+/*
+ * Server mode: tiny-shell --serve name
+ *
+ * A long-lived shell that runs command lines sent over the named pipe
+ * \\.\pipe\name. Each of a fixed set of workers owns one pipe instance and
+ * serves one client at a time; a client may send any number of requests
+ * over its connection. A request carries a working directory, environment
+ * overrides and the command line; stdout and stderr are streamed back while
+ * the command runs, followed by its exit status.
+ *
+ * The working directory and the environment belong to the process, so
+ * commands run one at a time. Each starts in the request's directory with
+ * its overrides applied and no shell variables, and all of that is undone
+ * afterwards. Standard input is empty. An exit ends the request with its
+ * status, and the server goes on.
+ *
+ * Frames are a kind byte, a 32-bit little-endian length and the payload.
+ * A request is 'D' directory and 'V' NAME=value (UTF-16, both optional),
+ * ended by 'C' command line (UTF-16). Replies are 'O' and 'E' with output
+ * bytes, then 'X' with the 32-bit exit status.
+ */
+
+// runs line with the given standard handles and returns its exit status
+using serve_fn = int (*)(const WCHAR *line, HANDLE in, HANDLE out, HANDLE err);
+
+// does not return unless the pipe cannot be created
+int serve(const WCHAR *name, serve_fn run);
+
+// the loopback client: runs line on the server count times and prints what comes back;
+// with count > 1 the average round trip is reported on stderr
+int serve_connect(const WCHAR *name, const WCHAR *line, const std::vector<WCHAR *> &env, int count);
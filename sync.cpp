@@ -0,0 +1,324 @@
+#include "builtin.h"
+#include "output.h"
+#include "path.h"
+#include "sync.h"
+#include "walk.h"
+
+using namespace std;
+
+#define SYNC_BLOCK (1024 * 1024)
+#define SYNC_UNBUFFERED (64ULL * 1024 * 1024) // larger files bypass the file cache
+
+struct sync_op {
+    const WCHAR *src;
+    const WCHAR *dst;
+    size_t src_len;
+    size_t dst_len;
+    bool check;
+    out_stream *out;
+    volatile LONG64 copied;
+    volatile LONG64 bytes;
+    volatile LONG64 same;
+    volatile LONG64 deleted;
+    volatile LONG failed;
+    volatile LONG pending;
+    HANDLE idle;
+    SRWLOCK lock;
+    vector<tstring> dirs; // extra directories, removed once their contents are gone
+};
+
+struct sync_job {
+    sync_op *op;
+    tstring name; // as shown to the user
+    tstring from;
+    tstring to;
+    ULONGLONG size;
+    bool compare;
+};
+
+// root joined with the part of a walked path below the other root
+static void rebase(tstring &out, const WCHAR *root, const WCHAR *rel)
+{
+    size_t n = wcslen(root);
+
+    out.clear();
+    out.append(root, n);
+    if (*rel != WNULL && *rel != L'\\' && *rel != L'/' && n && root[n - 1] != L'\\' && root[n - 1] != L'/') {
+        out.append(L'\\');
+    }
+    out.append(rel);
+}
+
+static void sync_fail(sync_op *op, const WCHAR *what, const WCHAR *name, DWORD err)
+{
+    op->out->printf(L"sync: %s %s (error %d)\n", what, name, err);
+    InterlockedIncrement(&op->failed);
+}
+
+static bool same_content(const tstring &a, const tstring &b)
+{
+    HANDLE fa = CreateFileW(a.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    HANDLE fb = CreateFileW(b.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    vector<char> v(2 * SYNC_BLOCK);
+    DWORD na, nb;
+    bool same = fa != INVALID_HANDLE_VALUE && fb != INVALID_HANDLE_VALUE;
+
+    while (same) {
+        if (!ReadFile(fa, v.data(), SYNC_BLOCK, &na, nullptr) ||
+            !ReadFile(fb, v.data() + SYNC_BLOCK, SYNC_BLOCK, &nb, nullptr)) {
+            same = false;
+        } else if (na != nb || memcmp(v.data(), v.data() + SYNC_BLOCK, na) != 0) {
+            same = false;
+        } else if (na == 0) {
+            break;
+        }
+    }
+
+    if (fa != INVALID_HANDLE_VALUE) {
+        CloseHandle(fa);
+    }
+    if (fb != INVALID_HANDLE_VALUE) {
+        CloseHandle(fb);
+    }
+    return same;
+}
+
+static void sync_finish(sync_op *op)
+{
+    if (InterlockedDecrement(&op->pending) == 0) {
+        SetEvent(op->idle);
+    }
+}
+
+static void CALLBACK sync_copy(PTP_CALLBACK_INSTANCE inst, void *param)
+{
+    (void)inst;
+    sync_job *job = (sync_job *)param;
+    sync_op *op = job->op;
+    DWORD flags = 0;
+
+    if (job->compare && same_content(job->from, job->to)) {
+        InterlockedIncrement64(&op->same);
+    } else {
+        if (job->size >= SYNC_UNBUFFERED) {
+            flags |= COPY_FILE_NO_BUFFERING;
+        }
+        // a read-only copy would refuse to be overwritten
+        SetFileAttributesW(job->to.c_str(), FILE_ATTRIBUTE_NORMAL);
+        if (CopyFileExW(job->from.c_str(), job->to.c_str(), nullptr, nullptr, nullptr, flags)) {
+            InterlockedIncrement64(&op->copied);
+            InterlockedAdd64(&op->bytes, (LONG64)job->size);
+        } else {
+            sync_fail(op, L"cannot copy", job->name.c_str(), GetLastError());
+        }
+    }
+
+    delete job;
+    sync_finish(op);
+}
+
+static void sync_visit(void *ctx, const tstring &path, const WIN32_FIND_DATAW &data)
+{
+    sync_op *op = (sync_op *)ctx;
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    tstring to, full;
+    bool have;
+    ULARGE_INTEGER size;
+
+    rebase(to, op->dst, path.c_str() + op->src_len);
+    if (!long_path(to.c_str(), full)) {
+        sync_fail(op, L"cannot access", to.c_str(), GetLastError());
+        return;
+    }
+    have = GetFileAttributesExW(full.c_str(), GetFileExInfoStandard, &attr) != FALSE;
+
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+            op->out->printf(L"sync: skipping directory link %s\n", path.c_str());
+            return;
+        }
+        // the walker lists a directory only after this returns, so it exists before its files
+        if (!have && !CreateDirectoryW(full.c_str(), nullptr)) {
+            sync_fail(op, L"cannot create", to.c_str(), GetLastError());
+        } else if (have && !(attr.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            sync_fail(op, L"cannot replace file", to.c_str(), ERROR_ALREADY_EXISTS);
+        }
+        return;
+    }
+
+    if (have && (attr.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        sync_fail(op, L"cannot replace directory", to.c_str(), ERROR_ALREADY_EXISTS);
+        return;
+    }
+
+    size.HighPart = data.nFileSizeHigh;
+    size.LowPart = data.nFileSizeLow;
+    bool same_size = have && attr.nFileSizeHigh == data.nFileSizeHigh && attr.nFileSizeLow == data.nFileSizeLow;
+    if (same_size && !op->check && CompareFileTime(&attr.ftLastWriteTime, &data.ftLastWriteTime) == 0) {
+        InterlockedIncrement64(&op->same);
+        return;
+    }
+
+    sync_job *job = new sync_job{op, path, tstring(), std::move(full), size.QuadPart, same_size && op->check};
+    if (!long_path(path.c_str(), job->from)) {
+        sync_fail(op, L"cannot access", path.c_str(), GetLastError());
+        delete job;
+        return;
+    }
+    InterlockedIncrement(&op->pending);
+    if (!TrySubmitThreadpoolCallback(sync_copy, job, nullptr)) {
+        sync_copy(nullptr, job);
+    }
+}
+
+static void sync_prune(void *ctx, const tstring &path, const WIN32_FIND_DATAW &data)
+{
+    sync_op *op = (sync_op *)ctx;
+    tstring from, full;
+
+    rebase(from, op->src, path.c_str() + op->dst_len);
+    if (!long_path(from.c_str(), full) || GetFileAttributesW(full.c_str()) != INVALID_FILE_ATTRIBUTES) {
+        return;
+    }
+    // only what is gone from the source goes; what cannot be looked at there stays
+    DWORD err = GetLastError();
+    if (err != ERROR_FILE_NOT_FOUND && err != ERROR_PATH_NOT_FOUND) {
+        sync_fail(op, L"cannot access", from.c_str(), err);
+        return;
+    }
+    if (!long_path(path.c_str(), full)) {
+        return;
+    }
+
+    if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && !(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+        AcquireSRWLockExclusive(&op->lock);
+        op->dirs.push_back(std::move(full));
+        ReleaseSRWLockExclusive(&op->lock);
+        return;
+    }
+
+    SetFileAttributesW(full.c_str(), FILE_ATTRIBUTE_NORMAL);
+    // a directory link goes by itself; the walker does not follow it
+    BOOL ok = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? RemoveDirectoryW(full.c_str())
+                                                                : DeleteFileW(full.c_str());
+    if (ok) {
+        InterlockedIncrement64(&op->deleted);
+    } else {
+        sync_fail(op, L"cannot delete", path.c_str(), GetLastError());
+    }
+}
+
+static inline bool longer(const tstring &a, const tstring &b)
+{
+    return a.size() > b.size();
+}
+
+// whether the long path dir is root or lies below it
+static bool inside(const tstring &dir, const tstring &root)
+{
+    const WCHAR *d = dir.c_str(), *r = root.c_str();
+    size_t n = root.size();
+
+    while (n > 0 && r[n - 1] == L'\\') n--;
+    return dir.size() >= n && _wcsnicmp(d, r, n) == 0 && (d[n] == WNULL || d[n] == L'\\');
+}
+
+int do_builtin_sync(vector<WCHAR *> &args, builtin_io &io)
+{
+    size_t n = args.size();
+    vector<const WCHAR *> roots;
+    bool prune = false;
+    sync_op op;
+    tstring full;
+    DWORD attr = INVALID_FILE_ATTRIBUTES;
+    int err;
+
+    op.check = false;
+    for (size_t i = 1; i < n; i++) {
+        if (args[i][0] != L'-') {
+            roots.push_back(args[i]);
+            continue;
+        }
+        WCHAR *p = args[i] + 1;
+        while (*p != WNULL) {
+            switch (*p) {
+            case L'c':
+                op.check = true;
+                break;
+            case L'd':
+                prune = true;
+                break;
+            default:
+                io.out->printf(L"unknown option %c\n", *p);
+                return 1;
+            }
+            p++;
+        }
+    }
+
+    if (roots.size() != 2) {
+        io.out->printf(L"sync: usage: sync [-c] [-d] src dst\n");
+        return 1;
+    }
+
+    op.src = roots[0];
+    op.dst = roots[1];
+    op.src_len = wcslen(op.src);
+    op.dst_len = wcslen(op.dst);
+    op.out = io.out;
+    op.copied = op.bytes = op.same = op.deleted = 0;
+    op.failed = 0;
+    op.pending = 1;
+    InitializeSRWLock(&op.lock);
+
+    if (long_path(op.src, full)) {
+        attr = GetFileAttributesW(full.c_str());
+    }
+    if (attr == INVALID_FILE_ATTRIBUTES) {
+        io.out->printf(L"sync: cannot access %s (error %d)\n", op.src, GetLastError());
+        return 1;
+    }
+    // the walk would find the copies it makes there, and copy them again
+    tstring to;
+    if ((attr & FILE_ATTRIBUTE_DIRECTORY) && long_path(op.dst, to) && inside(to, full)) {
+        io.out->printf(L"sync: %s is inside %s\n", op.dst, op.src);
+        return 1;
+    }
+    if ((attr & FILE_ATTRIBUTE_DIRECTORY) && long_path(op.dst, full) && !CreateDirectoryW(full.c_str(), nullptr) &&
+        GetLastError() != ERROR_ALREADY_EXISTS) {
+        io.out->printf(L"sync: cannot create %s (error %d)\n", op.dst, GetLastError());
+        return 1;
+    }
+
+    op.idle = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!op.idle) {
+        io.out->printf(L"sync: internal error %d\n", GetLastError());
+        return 1;
+    }
+    err = parallel_walk(op.src, sync_visit, &op, *io.out);
+    sync_finish(&op);
+    WaitForSingleObject(op.idle, INFINITE);
+    CloseHandle(op.idle);
+
+    // nothing is deleted unless the whole source could be read
+    if (prune && (attr & FILE_ATTRIBUTE_DIRECTORY) && err == 0) {
+        if (parallel_walk(op.dst, sync_prune, &op, *io.out) != 0) {
+            err = 1;
+        }
+        sort(op.dirs.begin(), op.dirs.end(), longer);
+        for (const tstring &d : op.dirs) {
+            if (RemoveDirectoryW(d.c_str())) {
+                op.deleted++;
+            } else {
+                sync_fail(&op, L"cannot delete", d.c_str(), GetLastError());
+            }
+        }
+    }
+
+    io.out->printf(L"sync: %lld copied (%lld bytes), %lld unchanged, %lld deleted\n", (long long)op.copied,
+               (long long)op.bytes, (long long)op.same, (long long)op.deleted);
+
+    return err || op.failed ? 1 : 0;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <vector>
+
+#include <Windows.h>
+
+#include "builtin.h"
+
+/*
+ * sync builtin: sync [-c] [-d] src dst
+ *
+ * Mirrors the tree src into dst. A file is copied when dst lacks it or its
+ * size or last write time differ; with -c, files of equal size are compared
+ * byte for byte instead of by time. -d deletes whatever dst has that src
+ * does not. The source tree is walked in parallel and each copy runs as its
+ * own thread pool item.
+ */
+
+int do_builtin_sync(std::vector<WCHAR *> &args, builtin_io &io);
@@ -0,0 +1,123 @@
+#include <string>
+#include <vector>
+
+#include "dir.h"
+#include "test.h"
+
+using namespace std;
+
+static bool make_files(const wstring &dir, int n)
+{
+    bool made = CreateDirectoryW(dir.c_str(), nullptr) != FALSE;
+
+    for (int i = 0; made && i < n; i++) {
+        made = touch(dir + L"\\f" + to_wstring(i));
+    }
+    return made;
+}
+
+// every entry once, . and .. included, with directories marked
+static void test_listing(const wstring &root)
+{
+    wstring dir = root + L"\\list";
+    const int files = 1000, dirs = 10;
+    vector<int> seen(files + dirs);
+    int dots = 0, other = 0;
+    bool dir_flags = true;
+
+    CHECK(make_files(dir, files));
+    for (int i = 0; i < dirs; i++) {
+        CHECK(CreateDirectoryW((dir + L"\\d" + to_wstring(i)).c_str(), nullptr) != FALSE);
+    }
+
+    dir_iter it(dir.c_str());
+    CHECK(it.error() == ERROR_SUCCESS);
+    while (it.next()) {
+        const WCHAR *name = it.name();
+        if (is_dot_dir(name)) {
+            dots++;
+        } else if (name[0] == L'f') {
+            seen[_wtoi(name + 1)]++;
+            dir_flags = dir_flags && !it.is_dir();
+        } else if (name[0] == L'd') {
+            seen[files + _wtoi(name + 1)]++;
+            dir_flags = dir_flags && it.is_dir();
+        } else {
+            other++;
+        }
+    }
+    CHECK(it.error() == ERROR_SUCCESS);
+    CHECK(dots == 2 && other == 0 && dir_flags);
+    bool once = true;
+    for (int n : seen) {
+        once = once && n == 1;
+    }
+    CHECK(once);
+
+    out_stream out;
+    CHECK(run_builtin(out, {L"rm", L"-r", dir.c_str()}) == 0);
+
+    dir_iter missing(dir.c_str());
+    CHECK(missing.error() == ERROR_FILE_NOT_FOUND || missing.error() == ERROR_PATH_NOT_FOUND);
+    CHECK(!missing.next());
+}
+
+// entries per second through dir_iter and through the FindFirstFileW loop it replaced
+static void bench(const wstring &root)
+{
+    const int n = 1000000;
+    wstring dir = root + L"\\big";
+    size_t a = 0, b = 0;
+
+    if (!make_files(dir, n)) {
+        fprintf(stderr, "cannot create %d files (error %d)\n", n, (int)GetLastError());
+        g_failed++;
+        return;
+    }
+
+    // the second round of each runs with the directory cached
+    for (int round = 0; round < 2; round++) {
+        stopwatch t1;
+        dir_iter it(dir.c_str());
+        while (it.next()) {
+            a++;
+        }
+        double ms_iter = t1.ms();
+
+        stopwatch t2;
+        WIN32_FIND_DATAW data;
+        HANDLE h = FindFirstFileW((wstring(L"\\\\?\\") + dir + L"\\*").c_str(), &data);
+        if (h != INVALID_HANDLE_VALUE) {
+            do {
+                b++;
+            } while (FindNextFileW(h, &data) != FALSE);
+            FindClose(h);
+        }
+        double ms_find = t2.ms();
+
+        printf("%d files, round %d: dir_iter %.0f ms (%.0f entries/s), FindFirstFileW %.0f ms (%.0f entries/s)\n",
+               n, round + 1, ms_iter, (n + 2) * 1000.0 / ms_iter, ms_find, (n + 2) * 1000.0 / ms_find);
+    }
+    CHECK(a == b && a == 2 * ((size_t)n + 2));
+
+    out_stream out;
+    CHECK(run_builtin(out, {L"rm", L"-r", dir.c_str()}) == 0);
+}
+
+int wmain(int argc, WCHAR *argv[])
+{
+    wstring root;
+
+    if (!make_scratch(L"dir", root)) {
+        fprintf(stderr, "cannot create a scratch directory (error %d)\n", (int)GetLastError());
+        return 1;
+    }
+
+    test_listing(root);
+    if (bench_mode(argc, argv)) {
+        bench(root);
+    }
+
+    RemoveDirectoryW(root.c_str());
+    return test_result();
+}
@@ -0,0 +1,320 @@
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "test.h"
+#include "utf.h"
+
+using namespace std;
+
+static bool write_file(const wstring &path, const string &text)
+{
+    HANDLE h = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, 0, nullptr);
+    DWORD n;
+
+    if (h == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    BOOL ok = WriteFile(h, text.data(), (DWORD)text.size(), &n, nullptr);
+    CloseHandle(h);
+    return ok != FALSE && n == text.size();
+}
+
+// what grep printed, as bytes
+static string grep_output(std::initializer_list<const WCHAR *> words, int *status)
+{
+    out_stream out;
+    u8string text;
+
+    *status = run_builtin(out, words);
+    out.take(text);
+    return string(text.c_str(), text.size());
+}
+
+static void check_grep(std::initializer_list<const WCHAR *> words, int status, const string &expect)
+{
+    int got;
+    string text = grep_output(words, &got);
+
+    if (got != status || text != expect) {
+        fprintf(stderr, "grep");
+        for (const WCHAR *w : words) {
+            fprintf(stderr, " %ls", w);
+        }
+        fprintf(stderr, ": status %d, output\n%s", got, text.c_str());
+    }
+    CHECK(got == status);
+    CHECK(text == expect);
+}
+
+// ^ and $ see through the \r of a CRLF line, which is still printed as it was
+static void test_anchors(const wstring &root)
+{
+    wstring f = root + L"\\crlf.txt";
+
+    CHECK(write_file(f, "abc\r\nxabc\r\nabcx\r\nabc"));
+    check_grep({L"grep", L"^abc$", f.c_str()}, 0, "abc\r\nabc\n");
+    check_grep({L"grep", L"c$", f.c_str()}, 0, "abc\r\nxabc\r\nabc\n");
+    check_grep({L"grep", L"^x", f.c_str()}, 0, "xabc\r\n");
+    check_grep({L"grep", L"^b", f.c_str()}, 1, "");
+}
+
+/*
+ * Literals are found 16 bytes at a time, with a scalar tail for the last
+ * few positions; -i has to agree on case in both, at either end of the
+ * literal.
+ */
+static void test_literal_icase(const wstring &root)
+{
+    wstring f = root + L"\\case.txt";
+    string text, expect;
+
+    for (int pad = 0; pad < 40; pad++) {
+        string line = string(pad, '.') + (pad % 2 ? "NeedLE" : "needle") + string(40 - pad, '-') + "\r\n";
+        text += line;
+        expect += line;
+    }
+    // or-ing 0x20 is for letters only: @ is not `
+    text += string(30, '.') + "@EEDLE\n" + string(30, '.') + "`EEDLE\n";
+    // the last one is only seen by the scalar tail
+    text += "needle";
+    expect += "needle\n";
+    CHECK(write_file(f, text));
+
+    check_grep({L"grep", L"-i", L"NEEDLE", f.c_str()}, 0, expect);
+    check_grep({L"grep", L"-c", L"needle", f.c_str()}, 0, "21\n");
+    check_grep({L"grep", L"-c", L"NeedLE", f.c_str()}, 0, "20\n");
+    check_grep({L"grep", L"-ci", L"eedl", f.c_str()}, 0, "43\n");
+    check_grep({L"grep", L"-ci", L"`eedle", f.c_str()}, 0, "1\n");
+}
+
+/*
+ * a[ab]{12}$ needs a DFA state for every pattern of a's in the last 13
+ * bytes, 8192 in all, twice GREP_MAX_STATES; long random lines run into the
+ * limit over and over. The answer is simple: the 13th byte from the end is
+ * an a.
+ */
+static void test_state_limit(const wstring &root)
+{
+    wstring f = root + L"\\states.txt";
+    string text, expect;
+    unsigned seed = 12345;
+    int matched = 0;
+
+    for (int i = 1; i <= 3000; i++) {
+        string line;
+        seed = seed * 1103515245 + 12345;
+        size_t len = 5 + (seed >> 16) % 300;
+        for (size_t k = 0; k < len; k++) {
+            seed = seed * 1103515245 + 12345;
+            line += (seed >> 16) & 1 ? 'a' : 'b';
+        }
+        text += line + "\n";
+        if (len >= 13 && line[len - 13] == 'a') {
+            expect += to_string(i) + ":" + line + "\n";
+            matched++;
+        }
+    }
+    CHECK(matched > 1000);
+    CHECK(write_file(f, text));
+
+    check_grep({L"grep", L"-n", L"a[ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab]$", f.c_str()}, 0, expect);
+    // the same with a starred prefix, which keeps more positions alive
+    check_grep({L"grep", L"-n", L"[ab]*a[ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab]$", f.c_str()}, 0, expect);
+}
+
+// each line of lines with name: in front
+static string named(const string &name, const string &lines)
+{
+    string s;
+
+    for (size_t i = 0, nl; i < lines.size(); i = nl + 1) {
+        nl = lines.find('\n', i);
+        s += name + ":" + lines.substr(i, nl - i + 1);
+    }
+    return s;
+}
+
+static string utf8(const wstring &w)
+{
+    u8string u;
+
+    utf16_to_utf8(w.c_str(), w.size(), u);
+    return string(u.c_str(), u.size());
+}
+
+// line numbers keep counting between matches, across non-matching runs and to an unterminated last line
+static void test_numbers(const wstring &root)
+{
+    wstring f = root + L"\\numbers.txt";
+    wstring g = root + L"\\other.txt";
+    string text, hits;
+
+    for (int i = 1; i <= 100; i++) {
+        text += (i % 7 == 0 ? "hit " : "miss ") + to_string(i) + (i < 100 ? "\n" : "");
+    }
+    text += "\nhit 101";
+    CHECK(write_file(f, text));
+    CHECK(write_file(g, "hit\r\n\r\nhit\r\n"));
+
+    for (int i = 7; i <= 98; i += 7) {
+        hits += to_string(i) + ":hit " + to_string(i) + "\n";
+    }
+    hits += "101:hit 101\n";
+    const string ones = "21:hit 21\n91:hit 91\n101:hit 101\n";
+    check_grep({L"grep", L"-n", L"hit", f.c_str()}, 0, hits);
+    check_grep({L"grep", L"-n", L"^hit [0-9]*1$", f.c_str()}, 0, ones);
+
+    // several files are searched in parallel and printed in order, each numbered from 1
+    check_grep({L"grep", L"-n", L"^hit [0-9]*1$", f.c_str(), g.c_str(), f.c_str()}, 0,
+               named(utf8(f), ones) + named(utf8(f), ones));
+    check_grep({L"grep", L"-n", L"hit", g.c_str(), f.c_str()}, 0,
+               named(utf8(g), "1:hit\r\n3:hit\r\n") + named(utf8(f), hits));
+
+    // more files than are searched ahead, still one after the other
+    string many;
+    for (int i = 0; i < 20; i++) {
+        many += i % 2 ? named(utf8(g), "1:hit\r\n3:hit\r\n") : named(utf8(f), hits);
+    }
+    check_grep({L"grep", L"-n", L"hit", f.c_str(), g.c_str(), f.c_str(), g.c_str(), f.c_str(), g.c_str(), f.c_str(),
+                g.c_str(), f.c_str(), g.c_str(), f.c_str(), g.c_str(), f.c_str(), g.c_str(), f.c_str(), g.c_str(),
+                f.c_str(), g.c_str(), f.c_str(), g.c_str()},
+               0, many);
+}
+
+// runs cmd with its output in out and returns its exit code, or -1 if it could not be started
+static long run_program(wstring cmd, HANDLE out, double *ms)
+{
+    PROCESS_INFORMATION pi;
+    STARTUPINFOW si;
+    DWORD code;
+
+    ZeroMemory(&si, sizeof(si));
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    si.hStdOutput = out;
+    si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+    stopwatch t;
+    if (CreateProcessW(nullptr, &cmd[0], nullptr, nullptr, TRUE, 0, nullptr, nullptr, &si, &pi) == FALSE) {
+        return -1;
+    }
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    *ms = t.ms();
+    if (GetExitCodeProcess(pi.hProcess, &code) == FALSE) {
+        code = (DWORD)-1;
+    }
+    CloseHandle(pi.hThread);
+    CloseHandle(pi.hProcess);
+    return (long)code;
+}
+
+// grep -c pattern file through GNU grep, or -1 if it did not run
+static long long gnu_count(const WCHAR *exe, const WCHAR *flags, const WCHAR *pattern, const wstring &file,
+                           const wstring &result, double *ms)
+{
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
+    HANDLE out = CreateFileW(result.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa,
+                             CREATE_ALWAYS, 0, nullptr);
+    LARGE_INTEGER zero = {};
+    char buf[32] = {};
+    DWORD n = 0;
+
+    if (out == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+    wstring cmd = wstring(L"\"") + exe + L"\" " + flags + L" \"" + pattern + L"\" \"" + file + L"\"";
+    long code = run_program(cmd, out, ms);
+    SetFilePointerEx(out, zero, nullptr, FILE_BEGIN);
+    ReadFile(out, buf, sizeof(buf) - 1, &n, nullptr);
+    CloseHandle(out);
+    DeleteFileW(result.c_str());
+    return code == 0 || code == 1 ? strtoll(buf, nullptr, 10) : -1;
+}
+
+/*
+ * grep -c over a 256 MB log through the builtin and, where there is a
+ * grep.exe on the path, through GNU grep, for a rare literal, the same with
+ * -i and a regex. Both have to count the same lines.
+ */
+static void bench(const wstring &root)
+{
+    static const WCHAR *const cases[][2] = {
+        {L"-c", L"timeout"},
+        {L"-ci", L"TIMEOUT"},
+        {L"-c", L"^[0-9-]* [0-9:]* ERROR .*timeout$"},
+    };
+    wstring f = root + L"\\big.log";
+    string text;
+    WCHAR exe[MAX_PATH];
+    long long errors = 0;
+
+    // LF endings, so that GNU grep's $ means the same as ours
+    for (unsigned i = 0; text.size() < 256u * 1024 * 1024; i++) {
+        errors += i % 1000 == 999;
+        text += "2026-10-19 12:" + to_string(10 + i / 60 % 50) + ":" + to_string(10 + i % 50) +
+                (i % 1000 == 999 ? " ERROR request " + to_string(i) + " gave up after a timeout\n"
+                                 : " INFO request " + to_string(i) + " served in " + to_string(i % 97) +
+                                       " ms from host-" + to_string(i % 13) + "\n");
+    }
+    if (!write_file(f, text)) {
+        fprintf(stderr, "cannot write %u MB (error %d)\n", (unsigned)(text.size() >> 20), (int)GetLastError());
+        g_failed++;
+        return;
+    }
+    bool gnu = SearchPathW(nullptr, L"grep.exe", nullptr, MAX_PATH, exe, nullptr) != 0;
+    if (!gnu) {
+        printf("no grep.exe on the path, timing the builtin alone\n");
+    }
+
+    for (const auto &c : cases) {
+        // the first run warms the file cache for both
+        double ms_builtin = 0;
+        string count;
+        for (int round = 0; round < 2; round++) {
+            int status;
+            stopwatch t;
+            count = grep_output({L"grep", c[0], c[1], f.c_str()}, &status);
+            ms_builtin = t.ms();
+        }
+        long long n = strtoll(count.c_str(), nullptr, 10);
+        CHECK(n == errors);
+
+        printf("grep %ls '%ls': %lld lines, builtin %.0f ms (%.0f MB/s)", c[0], c[1], n, ms_builtin,
+               (double)text.size() / 1048576.0 * 1000.0 / ms_builtin);
+        if (gnu) {
+            double ms_gnu;
+            long long m = gnu_count(exe, c[0], c[1], f, root + L"\\count.txt", &ms_gnu);
+            CHECK(m == n);
+            printf(", GNU grep %.0f ms (%.0f MB/s)", ms_gnu, (double)text.size() / 1048576.0 * 1000.0 / ms_gnu);
+        }
+        printf("\n");
+    }
+    DeleteFileW(f.c_str());
+}
+
+int wmain(int argc, WCHAR *argv[])
+{
+    wstring root;
+
+    if (!make_scratch(L"grep", root)) {
+        fprintf(stderr, "cannot create a scratch directory (error %d)\n", (int)GetLastError());
+        return 1;
+    }
+
+    test_anchors(root);
+    test_literal_icase(root);
+    test_state_limit(root);
+    test_numbers(root);
+    if (bench_mode(argc, argv)) {
+        bench(root);
+    }
+
+    const WCHAR *files[] = {L"crlf.txt", L"case.txt", L"states.txt", L"numbers.txt", L"other.txt"};
+    for (const WCHAR *name : files) {
+        DeleteFileW((root + L"\\" + name).c_str());
+    }
+    RemoveDirectoryW(root.c_str());
+    return test_result();
+}
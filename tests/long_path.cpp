@@ -0,0 +1,166 @@
+#include <cstring>
+#include <string>
+
+#include "test.h"
+
+using namespace std;
+
+static size_t count_lines(const u8string &text)
+{
+    size_t n = 0;
+
+    for (unsigned i = 0; i < text.size(); i++) {
+        n += text[i] == '\n';
+    }
+    return n;
+}
+
+// a tree 1000 directories deep, its path over 2000 characters, through the builtins
+static void test_deep_tree(const wstring &root)
+{
+    out_stream out;
+    u8string text;
+    wstring src = root + L"\\src";
+    wstring dst = root + L"\\dst";
+    wstring deep = src;
+
+    for (int i = 0; i < 1000; i++) {
+        deep += L"\\d";
+    }
+    CHECK(deep.size() > 2000);
+
+    CHECK(run_builtin(out, {L"mkdir", L"-p", deep.c_str()}) == 0);
+    CHECK(touch(deep + L"\\leaf.txt"));
+
+    CHECK(run_builtin(out, {L"ls", deep.c_str()}) == 0);
+    out.take(text);
+    CHECK(strstr(text.c_str(), "leaf.txt") != nullptr);
+
+    CHECK(run_builtin(out, {L"cp", (deep + L"\\leaf.txt").c_str(), (deep + L"\\copy.txt").c_str()}) == 0);
+    CHECK(exists(deep + L"\\copy.txt"));
+
+    // cp copies single files; sync is the builtin that copies trees
+    CHECK(run_builtin(out, {L"sync", src.c_str(), dst.c_str()}) == 0);
+    CHECK(exists(dst + deep.substr(src.size()) + L"\\copy.txt"));
+
+    CHECK(run_builtin(out, {L"rm", L"-r", src.c_str(), dst.c_str()}) == 0);
+    CHECK(!exists(src) && !exists(dst));
+}
+
+// a destination inside the source is refused, however it is spelled; a sibling with a longer name is not
+static void test_sync_nested(const wstring &root)
+{
+    out_stream out;
+    wstring src = root + L"\\tree";
+    wstring upper = root + L"\\TREE\\";
+
+    CHECK(CreateDirectoryW(src.c_str(), nullptr) != FALSE);
+    CHECK(touch(src + L"\\a.txt"));
+
+    CHECK(run_builtin(out, {L"sync", src.c_str(), (src + L"\\copy").c_str()}) == 1);
+    CHECK(!exists(src + L"\\copy"));
+    CHECK(run_builtin(out, {L"sync", src.c_str(), (upper + L"copy\\inner").c_str()}) == 1);
+    CHECK(run_builtin(out, {L"sync", (src + L"\\").c_str(), src.c_str()}) == 1);
+
+    // -d removes what the source no longer has, and only that
+    CHECK(run_builtin(out, {L"sync", src.c_str(), (src + L"-copy").c_str()}) == 0);
+    CHECK(touch(src + L"-copy\\extra.txt"));
+    CHECK(run_builtin(out, {L"sync", L"-d", src.c_str(), (src + L"-copy").c_str()}) == 0);
+    CHECK(exists(src + L"-copy\\a.txt") && !exists(src + L"-copy\\extra.txt"));
+
+    CHECK(run_builtin(out, {L"rm", L"-r", src.c_str(), (src + L"-copy").c_str()}) == 0);
+}
+
+// a parent that cannot be made is reported as the operand was typed, without the \\?\ prefix
+static void test_mkdir_parent(const wstring &root)
+{
+    out_stream out;
+    u8string text;
+    wstring file = root + L"\\file";
+
+    CHECK(touch(file));
+    CHECK(run_builtin(out, {L"mkdir", L"-p", (root + L"/file/x/y").c_str()}) == 1);
+    out.take(text);
+    CHECK(strstr(text.c_str(), "\\\\?\\") == nullptr);
+    CHECK(strstr(text.c_str(), "/file (error") != nullptr);
+    CHECK(strstr(text.c_str(), "/file/x/y (error") != nullptr);
+    CHECK(count_lines(text) == 2);
+
+    DeleteFileW(file.c_str());
+}
+
+struct wide_times {
+    double create, ls, copy, remove;
+};
+
+// n empty files in one directory, listed, copied and removed with the builtins
+static void wide_dir(const wstring &root, int n, wide_times &t)
+{
+    out_stream out;
+    u8string text;
+    wstring src = root + L"\\wide";
+    wstring dst = root + L"\\wide-copy";
+
+    stopwatch create;
+    bool made = CreateDirectoryW(src.c_str(), nullptr) != FALSE;
+    for (int i = 0; made && i < n; i++) {
+        made = touch(src + L"\\file-" + to_wstring(i) + L".txt");
+    }
+    t.create = create.ms();
+    CHECK(made);
+
+    stopwatch ls;
+    CHECK(run_builtin(out, {L"ls", src.c_str()}) == 0);
+    out.take(text);
+    t.ls = ls.ms();
+    // every file, after the two header lines
+    CHECK(count_lines(text) >= (size_t)n + 2);
+
+    stopwatch copy;
+    CHECK(run_builtin(out, {L"sync", src.c_str(), dst.c_str()}) == 0);
+    t.copy = copy.ms();
+    CHECK(exists(dst + L"\\file-" + to_wstring(n - 1) + L".txt"));
+
+    stopwatch remove;
+    CHECK(run_builtin(out, {L"rm", L"-r", src.c_str(), dst.c_str()}) == 0);
+    t.remove = remove.ms();
+    CHECK(!exists(src) && !exists(dst));
+}
+
+// the same work on a quarter of the entries and on all of them, which should take about four times as long
+static void bench(const wstring &root)
+{
+    const int n = 1000000;
+    wide_times quarter, full;
+
+    wide_dir(root, n / 4, quarter);
+    wide_dir(root, n, full);
+
+    printf("%-8s %12s %12s %8s\n", "", "250k (ms)", "1M (ms)", "ratio");
+    printf("%-8s %12.0f %12.0f %8.2f\n", "create", quarter.create, full.create, full.create / quarter.create);
+    printf("%-8s %12.0f %12.0f %8.2f\n", "ls", quarter.ls, full.ls, full.ls / quarter.ls);
+    printf("%-8s %12.0f %12.0f %8.2f\n", "sync", quarter.copy, full.copy, full.copy / quarter.copy);
+    printf("%-8s %12.0f %12.0f %8.2f\n", "rm -r", quarter.remove, full.remove, full.remove / quarter.remove);
+}
+
+int wmain(int argc, WCHAR *argv[])
+{
+    wstring root;
+    wide_times t;
+
+    if (!make_scratch(L"long-path", root)) {
+        fprintf(stderr, "cannot create a scratch directory (error %d)\n", (int)GetLastError());
+        return 1;
+    }
+
+    test_deep_tree(root);
+    test_sync_nested(root);
+    test_mkdir_parent(root);
+    wide_dir(root, 10000, t);
+    if (bench_mode(argc, argv)) {
+        bench(root);
+    }
+
+    RemoveDirectoryW(root.c_str());
+    return test_result();
+}
@@ -0,0 +1,85 @@
+#include <string>
+
+#include "test.h"
+
+using namespace std;
+
+/*
+ * The same n assignments written two ways: one for loop, parsed once and then
+ * run from its cached tree, and n separate lines that each have to be parsed.
+ * Both end with exit $v, so the exit code shows every iteration ran.
+ */
+static string as_loop(int n)
+{
+    string s = "for x in";
+
+    for (int i = 1; i <= n; i++) {
+        s += " " + to_string(i);
+    }
+    s += "; do v=$x; done\nexit $v\n";
+    return s;
+}
+
+static string as_lines(int n)
+{
+    string s;
+
+    for (int i = 1; i <= n; i++) {
+        s += "v=" + to_string(i) + "\n";
+    }
+    s += "exit $v\n";
+    return s;
+}
+
+// loops nested around a group, so that inner bodies also run from the cache
+static string as_nested(int n)
+{
+    string s = "for x in";
+
+    for (int i = 1; i <= n / 10; i++) {
+        s += " " + to_string(i);
+    }
+    s += "; do for y in 0 1 2 3 4 5 6 7 8 9; do (v=$x$y) && v=$x$y; done; done\nexit $v\n";
+    return s;
+}
+
+static void check_runs(const WCHAR *shell, const string &script, long expect)
+{
+    long code = run_shell(shell, script.c_str(), script.size(), nullptr, nullptr);
+    CHECK(code == expect);
+}
+
+static void bench(const WCHAR *shell)
+{
+    const int n = 100000;
+    string loop = as_loop(n);
+    string lines = as_lines(n);
+    string nested = as_nested(n);
+    double t_loop, t_lines, t_nested;
+
+    run_shell(shell, loop.c_str(), loop.size(), nullptr, &t_loop);
+    run_shell(shell, lines.c_str(), lines.size(), nullptr, &t_lines);
+    run_shell(shell, nested.c_str(), nested.size(), nullptr, &t_nested);
+
+    printf("%d iterations: one for loop %.1f ms, %d separate lines %.1f ms, nested loops %.1f ms\n", n, t_loop, n,
+           t_lines, t_nested);
+}
+
+int wmain(int argc, WCHAR *argv[])
+{
+    const WCHAR *shell = shell_path(argc, argv);
+
+    if (!shell) {
+        fprintf(stderr, "usage: test-loop [--bench] path-to-tiny-shell\n");
+        return 1;
+    }
+
+    check_runs(shell, as_loop(1000), 1000);
+    check_runs(shell, as_lines(1000), 1000);
+    check_runs(shell, as_nested(1000), 1009);
+
+    if (bench_mode(argc, argv)) {
+        bench(shell);
+    }
+    return test_result();
+}
@@ -0,0 +1,167 @@
+#include <cstring>
+#include <string>
+
+#include "test.h"
+#include "utf.h"
+
+using namespace std;
+
+static string read_file(const wstring &path)
+{
+    HANDLE h = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0,
+                           nullptr);
+    string s;
+    char buf[65536];
+    DWORD n;
+
+    if (h == INVALID_HANDLE_VALUE) {
+        return s;
+    }
+    while (ReadFile(h, buf, sizeof(buf), &n, nullptr) != FALSE && n > 0) {
+        s.append(buf, n);
+    }
+    CloseHandle(h);
+    return s;
+}
+
+static HANDLE create(const wstring &path)
+{
+    return CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, 0, nullptr);
+}
+
+static string utf8(const wstring &w)
+{
+    u8string u;
+
+    utf16_to_utf8(w.c_str(), w.size(), u);
+    return string(u.c_str(), u.size());
+}
+
+/*
+ * Two streams on one file, the second tied to the first the way stderr is
+ * tied to stdout: output lands in the order it was written, converted to
+ * UTF-8, whichever stream it went through and however much of it there is.
+ */
+static void test_streams(const wstring &root)
+{
+    wstring f = root + L"\\streams.txt";
+    HANDLE h = create(f);
+    string expect;
+
+    CHECK(h != INVALID_HANDLE_VALUE);
+    CHECK(!is_console(h));
+    {
+        out_stream out(h);
+        out_stream err(h, &out);
+
+        out.write("one\n", 4);
+        err.printf(L"%s %d\n", L"two", 2);
+        out.printf(L"caf\u00e9 \u4e2d\n");
+        expect = "one\ntwo 2\ncaf\xc3\xa9 \xe4\xb8\xad\n";
+
+        // past the buffer several times over, in small pieces and in one large one
+        for (int i = 0; i < 100000; i++) {
+            out.printf(L"line %d\n", i);
+            expect += "line " + to_string(i) + "\n";
+        }
+        string big(300000, 'x');
+        out.write(big.data(), big.size());
+        expect += big;
+        err.write("last\n", 5);
+        expect += "last\n";
+    }
+    CloseHandle(h);
+    CHECK(read_file(f) == expect);
+    DeleteFileW(f.c_str());
+}
+
+// the same ls output, through the shell's buffered stream and with one WriteFile per line as before
+static void bench(const WCHAR *shell, const wstring &root)
+{
+    const int n = 200000;
+    wstring dir = root + L"\\big";
+    wstring f = root + L"\\ls.txt";
+    out_stream mem;
+    u8string listing;
+
+    bool made = CreateDirectoryW(dir.c_str(), nullptr) != FALSE;
+    for (int i = 0; made && i < n; i++) {
+        made = touch(dir + L"\\file-" + to_wstring(i) + L".txt");
+    }
+    if (!made) {
+        fprintf(stderr, "cannot create %d files (error %d)\n", n, (int)GetLastError());
+        g_failed++;
+        return;
+    }
+    // the first run brings the directory into the cache; the second costs listing and formatting alone
+    CHECK(run_builtin(mem, {L"ls", dir.c_str()}) == 0);
+    mem.take(listing);
+    stopwatch memory;
+    CHECK(run_builtin(mem, {L"ls", dir.c_str()}) == 0);
+    double t_memory = memory.ms();
+    mem.take(listing);
+
+    HANDLE h = create(f);
+    stopwatch buffered;
+    {
+        out_stream out(h);
+        CHECK(run_builtin(out, {L"ls", dir.c_str()}) == 0);
+    }
+    double t_buffered = buffered.ms();
+    CloseHandle(h);
+    CHECK(read_file(f).size() == listing.size());
+
+    h = create(f);
+    size_t lines = 0;
+    stopwatch per_line;
+    for (const char *p = listing.c_str(), *e = p + listing.size(); p < e;) {
+        const char *nl = (const char *)memchr(p, '\n', e - p);
+        DWORD k = (DWORD)((nl ? nl + 1 : e) - p), written;
+        WriteFile(h, p, k, &written, nullptr);
+        p += k;
+        lines++;
+    }
+    double t_per_line = per_line.ms();
+    CloseHandle(h);
+
+    // the whole command as typed, less what starting and stopping the shell costs
+    string script = "ls \"" + utf8(dir) + "\" > \"" + utf8(f) + "\"\nexit\n";
+    double t_shell, t_start;
+    long code = run_shell(shell, script.c_str(), script.size(), nullptr, &t_shell);
+    run_shell(shell, "exit\n", 5, nullptr, &t_start);
+    CHECK(code == 0);
+    CHECK(read_file(f).size() == listing.size());
+
+    printf("ls of %d files, %u lines, %u KB, to a file:\n", n, (unsigned)lines, (unsigned)(listing.size() >> 10));
+    printf("  builtin into memory:              %8.1f ms\n", t_memory);
+    printf("  builtin through out_stream:       %8.1f ms (%.1f ms writing)\n", t_buffered, t_buffered - t_memory);
+    printf("  the same bytes, a write per line: %8.1f ms of writing\n", t_per_line);
+    printf("  ls > file in the shell:           %8.1f ms (%.1f ms of it starting the shell)\n", t_shell, t_start);
+
+    DeleteFileW(f.c_str());
+    out_stream out;
+    CHECK(run_builtin(out, {L"rm", L"-r", dir.c_str()}) == 0);
+}
+
+int wmain(int argc, WCHAR *argv[])
+{
+    const WCHAR *shell = shell_path(argc, argv);
+    wstring root;
+
+    if (!shell) {
+        fprintf(stderr, "usage: test-output [--bench] path-to-tiny-shell\n");
+        return 1;
+    }
+    if (!make_scratch(L"output", root)) {
+        fprintf(stderr, "cannot create a scratch directory (error %d)\n", (int)GetLastError());
+        return 1;
+    }
+
+    test_streams(root);
+    if (bench_mode(argc, argv)) {
+        bench(shell, root);
+    }
+
+    RemoveDirectoryW(root.c_str());
+    return test_result();
+}
@@ -0,0 +1,182 @@
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "test.h"
+#include "utf.h"
+
+using namespace std;
+
+static bool write_file(const wstring &path, const string &text)
+{
+    HANDLE h = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, 0, nullptr);
+    DWORD n;
+
+    if (h == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    BOOL ok = WriteFile(h, text.data(), (DWORD)text.size(), &n, nullptr);
+    CloseHandle(h);
+    return ok != FALSE && n == text.size();
+}
+
+static string read_file(const wstring &path)
+{
+    HANDLE h = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0,
+                           nullptr);
+    string s;
+    char buf[4096];
+    DWORD n;
+
+    if (h == INVALID_HANDLE_VALUE) {
+        return s;
+    }
+    while (ReadFile(h, buf, sizeof(buf), &n, nullptr) != FALSE && n > 0) {
+        s.append(buf, n);
+    }
+    CloseHandle(h);
+    return s;
+}
+
+static string utf8(const wstring &w)
+{
+    u8string u;
+
+    utf16_to_utf8(w.c_str(), w.size(), u);
+    return string(u.c_str(), u.size());
+}
+
+static long run(const WCHAR *shell, const string &script)
+{
+    return run_shell(shell, script.c_str(), script.size(), nullptr, nullptr);
+}
+
+static long count_lines(const string &text)
+{
+    long n = 0;
+
+    for (char c : text) {
+        n += c == '\n';
+    }
+    return n;
+}
+
+// the count wc -l wrote to name, or -1
+static long count(const wstring &root, const WCHAR *name)
+{
+    string text = read_file(root + L"\\" + name);
+
+    return text.empty() ? -1 : strtol(text.c_str(), nullptr, 10);
+}
+
+/*
+ * Builtin, group and loop stages write far more than a pipe holds before
+ * the stage after them reads any of it; each runs alongside the rest of
+ * the pipeline, so none of these wait forever.
+ */
+static void test_large_stages(const WCHAR *shell, const wstring &root)
+{
+    string text;
+    long errors = 0;
+
+    for (int i = 0; i < 200000; i++) {
+        errors += i % 3 == 0;
+        text += (i % 3 == 0 ? "ERROR request " : "INFO request ") + to_string(i) + "\n";
+    }
+    CHECK(write_file(root + L"\\big.log", text));
+
+    string script = "cd \"" + utf8(root) + "\"\n"
+                    "grep ERROR big.log | wc -l > one.txt\n"
+                    "(grep ERROR big.log; grep ERROR big.log) | wc -l > group.txt\n"
+                    "for f in big.log big.log big.log; do grep ERROR $f; done | wc -l > loop.txt\n"
+                    "grep ERROR big.log | grep request | wc -l > chain.txt\n"
+                    "cat big.log | head -n 1 > head.txt\n";
+    CHECK(run(shell, script) == 0);
+    CHECK(count(root, L"one.txt") == errors);
+    CHECK(count(root, L"group.txt") == 2 * errors);
+    CHECK(count(root, L"loop.txt") == 3 * errors);
+    CHECK(count(root, L"chain.txt") == errors);
+    CHECK(read_file(root + L"\\head.txt") == "big.log\n");
+
+    const WCHAR *files[] = {L"big.log", L"one.txt", L"group.txt", L"loop.txt", L"chain.txt", L"head.txt"};
+    for (const WCHAR *name : files) {
+        DeleteFileW((root + L"\\" + name).c_str());
+    }
+}
+
+struct appender {
+    wstring path;
+    HANDLE stop;
+};
+
+// adds a line to the file every 50 ms until told to stop
+static DWORD WINAPI append_lines(void *param)
+{
+    appender *a = (appender *)param;
+
+    for (int i = 0; WaitForSingleObject(a->stop, 50) == WAIT_TIMEOUT; i++) {
+        HANDLE h = CreateFileW(a->path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                               OPEN_ALWAYS, 0, nullptr);
+        string line = "line " + to_string(i) + "\n";
+        DWORD n;
+        if (h != INVALID_HANDLE_VALUE) {
+            WriteFile(h, line.data(), (DWORD)line.size(), &n, nullptr);
+            CloseHandle(h);
+        }
+    }
+    return 0;
+}
+
+// tail -f ends once head has what it wants and the pipe between them is gone
+static void test_follow(const WCHAR *shell, const wstring &root)
+{
+    appender a = {root + L"\\app.log", CreateEventW(nullptr, TRUE, FALSE, nullptr)};
+
+    CHECK(write_file(a.path, "first\n"));
+    HANDLE t = CreateThread(nullptr, 0, append_lines, &a, 0, nullptr);
+    CHECK(t != nullptr);
+    if (!t) {
+        return;
+    }
+
+    string script = "cd \"" + utf8(root) + "\"\ntail -f app.log | head -n 5 > head.txt\nexit 7\n";
+    CHECK(run(shell, script) == 7);
+    CHECK(count_lines(read_file(root + L"\\head.txt")) == 5);
+
+    SetEvent(a.stop);
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+    CloseHandle(a.stop);
+    DeleteFileW(a.path.c_str());
+    DeleteFileW((root + L"\\head.txt").c_str());
+}
+
+// a stage before the last is a subshell: its exit, set -e and variables end with it
+static void test_subshell_stages(const WCHAR *shell)
+{
+    CHECK(run(shell, "exit 3 | wc -l\nexit ${PIPESTATUS[0]}\n") == 3);
+    CHECK(run(shell, "x=1 | wc -l\nexit 5$x\n") == 5);
+    CHECK(run(shell, "set -e\n(ls no-such-dir; exit 9) | wc -l\nexit 6\n") == 6);
+}
+
+int wmain(int argc, WCHAR *argv[])
+{
+    const WCHAR *shell = shell_path(argc, argv);
+    wstring root;
+
+    if (!shell) {
+        fprintf(stderr, "usage: test-pipeline path-to-tiny-shell\n");
+        return 1;
+    }
+    if (!make_scratch(L"pipeline", root)) {
+        fprintf(stderr, "cannot create a scratch directory (error %d)\n", (int)GetLastError());
+        return 1;
+    }
+
+    test_large_stages(shell, root);
+    test_subshell_stages(shell);
+    test_follow(shell, root);
+
+    RemoveDirectoryW(root.c_str());
+    return test_result();
+}
@@ -0,0 +1,215 @@
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "place.h"
+#include "test.h"
+#include "utf.h"
+
+using namespace std;
+
+#define CHUNK (64 * 1024)
+
+static unsigned bits(KAFFINITY m)
+{
+    unsigned n = 0;
+
+    for (; m; m &= m - 1) {
+        n++;
+    }
+    return n;
+}
+
+static bool same(const GROUP_AFFINITY &a, const GROUP_AFFINITY &b)
+{
+    return a.Group == b.Group && a.Mask == b.Mask;
+}
+
+static int place(std::initializer_list<const WCHAR *> words, u8string &text)
+{
+    out_stream out;
+    int status = run_builtin(out, words);
+
+    out.take(text);
+    return status;
+}
+
+// what each policy hands the stages of a 4-stage pipeline
+static void test_policies()
+{
+    DWORD cpus = 0;
+    u8string text;
+    GROUP_AFFINITY ga[5];
+
+    for (WORD g = 0; g < GetActiveProcessorGroupCount(); g++) {
+        cpus += GetActiveProcessorCount(g);
+    }
+    CHECK(cpus > 0);
+
+    CHECK(place({L"place"}, text) == 0 && strcmp(text.c_str(), "off\n") == 0);
+    CHECK(!place_stage(0, 4, &ga[0]));
+
+    // one logical processor each, taken in order, so the first two differ whenever they can
+    CHECK(place({L"place", L"pack"}, text) == 0 && get_placement().policy == PLACE_PACK);
+    bool ok = true;
+    for (size_t i = 0; i < 4; i++) {
+        ok = ok && place_stage(i, 4, &ga[i]) && bits(ga[i].Mask) == 1;
+    }
+    CHECK(ok);
+    CHECK(cpus < 2 || !same(ga[0], ga[1]));
+
+    // whole cores, all different while there are enough of them
+    CHECK(place({L"place", L"spread"}, text) == 0 && get_placement().policy == PLACE_SPREAD);
+    ok = true;
+    for (size_t i = 0; i < 4; i++) {
+        ok = ok && place_stage(i, 4, &ga[i]) && ga[i].Mask != 0;
+    }
+    CHECK(ok);
+    CHECK(cpus < 8 || (!same(ga[0], ga[1]) && !same(ga[1], ga[2]) && !same(ga[2], ga[3])));
+
+    // lists are reused past the last one, and shown as they were given
+    CHECK(place({L"place", L"0", L"0"}, text) == 0 && get_placement().policy == PLACE_LISTS);
+    CHECK(place_stage(4, 5, &ga[4]) && ga[4].Group == 0 && ga[4].Mask == 1);
+    CHECK(place({L"place"}, text) == 0 && strcmp(text.c_str(), "0 0\n") == 0);
+    if (cpus >= 2) {
+        CHECK(place({L"place", L"0-1", L"1"}, text) == 0);
+        CHECK(place_stage(0, 2, &ga[0]) && ga[0].Mask == 3);
+        CHECK(place({L"place"}, text) == 0 && strcmp(text.c_str(), "0-1 1\n") == 0);
+    }
+
+    // a bad list leaves the policy as it was
+    for (const WCHAR *bad : {L"1-0", L"x", L"0-", L"-1", L"99999"}) {
+        CHECK(place({L"place", bad}, text) == 1);
+    }
+    CHECK(get_placement().policy == PLACE_LISTS);
+
+    CHECK(place({L"place", L"off"}, text) == 0 && get_placement().policy == PLACE_OFF);
+}
+
+// the bytes --source writes, over and over
+static void pattern(char *buf)
+{
+    for (unsigned i = 0; i < CHUNK; i++) {
+        buf[i] = (char)(i * 7 + i / 251);
+    }
+}
+
+static bool write_out(HANDLE h, const char *s, DWORD n)
+{
+    DWORD k;
+
+    while (n > 0) {
+        if (WriteFile(h, s, n, &k, nullptr) == FALSE) {
+            return false;
+        }
+        s += k;
+        n -= k;
+    }
+    return true;
+}
+
+/*
+ * The stages of the benchmark pipeline, run as this program: --source MB
+ * writes MB megabytes, --pump copies its input to its output, and
+ * --sink MB checks it got exactly what the source wrote.
+ */
+static int stage(const WCHAR *mode, const WCHAR *arg)
+{
+    HANDLE in = GetStdHandle(STD_INPUT_HANDLE);
+    HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
+    static char buf[CHUNK], expect[CHUNK];
+    unsigned long long total = arg ? _wtoi(arg) * 16ULL * CHUNK : 0, got = 0;
+    DWORD n;
+
+    if (wcscmp(mode, L"--source") == 0) {
+        pattern(buf);
+        for (unsigned long long i = 0; i < total; i += CHUNK) {
+            if (!write_out(out, buf, CHUNK)) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    if (wcscmp(mode, L"--pump") == 0) {
+        while (ReadFile(in, buf, CHUNK, &n, nullptr) != FALSE && n > 0) {
+            if (!write_out(out, buf, n)) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    // the pipe may split the stream anywhere, so compare against the pattern at the running offset
+    pattern(expect);
+    bool ok = true;
+    while (ReadFile(in, buf, CHUNK, &n, nullptr) != FALSE && n > 0) {
+        for (DWORD i = 0; i < n && ok; i++) {
+            ok = buf[i] == expect[(got + i) % CHUNK];
+        }
+        got += n;
+    }
+    return ok && got == total ? 0 : 3;
+}
+
+// source | pump | pump | sink under policy, through the shell; false if the data did not arrive intact
+static bool pipeline(const WCHAR *shell, const string &self, const char *policy, int mb, double *ms)
+{
+    string exe = "\"" + self + "\"";
+    string n = to_string(mb);
+    string script = string("place ") + policy + "\n" + exe + " --source " + n + " | " + exe + " --pump | " + exe +
+                    " --pump | " + exe + " --sink " + n + "\n";
+
+    return run_shell(shell, script.c_str(), script.size(), nullptr, ms) == 0;
+}
+
+static void bench(const WCHAR *shell, const string &self)
+{
+    const int mb = 1024;
+    const char *policies[] = {"off", "pack", "spread", "0 1 2 3"};
+    DWORD cpus = 0;
+
+    for (WORD g = 0; g < GetActiveProcessorGroupCount(); g++) {
+        cpus += GetActiveProcessorCount(g);
+    }
+    printf("%d MB through source | pump | pump | sink, best of 3:\n", mb);
+    for (const char *p : policies) {
+        if (p[0] == '0' && cpus < 4) {
+            continue;
+        }
+        double best = 0;
+        for (int round = 0; round < 3; round++) {
+            double ms;
+            CHECK(pipeline(shell, self, p, mb, &ms));
+            best = round == 0 || ms < best ? ms : best;
+        }
+        printf("  place %-8s %8.0f ms %8.0f MB/s\n", p, best, mb * 1000.0 / best);
+    }
+}
+
+int wmain(int argc, WCHAR *argv[])
+{
+    if (argc > 1 && (wcscmp(argv[1], L"--source") == 0 || wcscmp(argv[1], L"--pump") == 0 ||
+                     wcscmp(argv[1], L"--sink") == 0)) {
+        return stage(argv[1], argc > 2 ? argv[2] : nullptr);
+    }
+
+    const WCHAR *shell = shell_path(argc, argv);
+    WCHAR path[MAX_PATH];
+    u8string self;
+
+    if (!shell || GetModuleFileNameW(nullptr, path, MAX_PATH) == 0) {
+        fprintf(stderr, "usage: test-place [--bench] path-to-tiny-shell\n");
+        return 1;
+    }
+    utf16_to_utf8(path, wcslen(path), self);
+
+    test_policies();
+    for (const char *p : {"off", "pack", "spread"}) {
+        double ms;
+        CHECK(pipeline(shell, self.c_str(), p, 4, &ms));
+    }
+    if (bench_mode(argc, argv)) {
+        bench(shell, self.c_str());
+    }
+    return test_result();
+}
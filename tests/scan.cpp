@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <vector>
+
+#include "parser.h"
+#include "scan.h"
+#include "test.h"
+
+using namespace std;
+
+// the answer find_special has to give, one character at a time
+static size_t scalar_find(const WCHAR *s, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (is_special(s, i, n)) {
+            return i;
+        }
+    }
+    return n;
+}
+
+static bool agrees(const vector<WCHAR> &buf, size_t n)
+{
+    return find_special(buf.data(), n) == scalar_find(buf.data(), n);
+}
+
+/*
+ * Every length up to four 16-character blocks, with each operator at every
+ * offset, so that the SIMD loops, the block boundaries and the scalar tail
+ * all see it.
+ */
+static void test_every_offset()
+{
+    static const WCHAR ops[] = L"|<>&;()\n\\`";
+    const size_t max = 64;
+    vector<WCHAR> buf(max + 2);
+    bool ok = true;
+
+    for (size_t n = 0; n <= max; n++) {
+        // plain text, with an operator just past the end that must not be seen
+        fill(buf.begin(), buf.end(), L'a');
+        buf[n] = L'|';
+        ok = ok && find_special(buf.data(), n) == n;
+
+        for (size_t at = 0; at < n; at++) {
+            for (const WCHAR *op = ops; *op != L'\0'; op++) {
+                fill(buf.begin(), buf.end(), L'a');
+                buf[at] = *op;
+                ok = ok && find_special(buf.data(), n) == at && agrees(buf, n);
+            }
+
+            // 2> counts from its 2, even across a block boundary; a lone 2 does not count
+            fill(buf.begin(), buf.end(), L'a');
+            buf[at] = L'2';
+            buf[at + 1] = L'>';
+            ok = ok && agrees(buf, n);
+            buf[at + 1] = L'2';
+            ok = ok && agrees(buf, n);
+
+            // a decoy 2 in the same block ahead of the real operator
+            if (at > 0) {
+                fill(buf.begin(), buf.end(), L'a');
+                buf[at - 1] = L'2';
+                buf[at] = L';';
+                ok = ok && find_special(buf.data(), n) == at && agrees(buf, n);
+            }
+        }
+    }
+    CHECK(ok);
+}
+
+// a generated command line of about n characters: long arguments joined by pipes
+static void make_line(size_t n, vector<WCHAR> &line)
+{
+    static const WCHAR word[] = L"--define=SOME_LONG_MACRO_NAME=1 C:\\build\\out\\obj\\module.obj ";
+    const size_t wn = sizeof(word) / sizeof(WCHAR) - 1;
+
+    line.clear();
+    for (size_t i = 0; line.size() < n; i++) {
+        line.insert(line.end(), word, word + wn);
+        if (i % 64 == 63) {
+            line.push_back(L'|');
+            line.push_back(L' ');
+        }
+    }
+    line.push_back(L'\0');
+}
+
+static void bench()
+{
+    vector<WCHAR> line;
+    size_t sum = 0;
+
+    for (size_t n : {2048, 8192, 32768}) {
+        // only the scanners: from each operator to the next, over the whole line
+        make_line(n, line);
+        const WCHAR *s = line.data();
+        size_t len = line.size() - 1;
+        int rounds = (int)(64 * 1024 * 1024 / len);
+
+        stopwatch simd;
+        for (int r = 0; r < rounds; r++) {
+            for (size_t i = 0; i < len; i++) {
+                i += find_special(s + i, len - i);
+                sum += i;
+            }
+        }
+        double t_simd = simd.ms();
+
+        stopwatch scalar;
+        for (int r = 0; r < rounds; r++) {
+            for (size_t i = 0; i < len; i++) {
+                i += scalar_find(s + i, len - i);
+                sum += i;
+            }
+        }
+        double t_scalar = scalar.ms();
+
+        // the parser as execute() drives it, cache aside
+        stopwatch parse;
+        int parsed = rounds / 16 + 1;
+        for (int r = 0; r < parsed; r++) {
+            ast_ptr ast = parse_line(s, len);
+            sum += ast ? 1 : 0;
+        }
+        double t_parse = parse.ms();
+
+        printf("%u-character line: find_special %.3f us, one at a time %.3f us, parse_line %.3f us\n",
+               (unsigned)len, t_simd * 1000.0 / rounds, t_scalar * 1000.0 / rounds, t_parse * 1000.0 / parsed);
+    }
+    printf("checksum %u\n", (unsigned)sum);
+}
+
+int wmain(int argc, WCHAR *argv[])
+{
+    test_every_offset();
+
+    if (bench_mode(argc, argv)) {
+        bench();
+    }
+    return test_result();
+}
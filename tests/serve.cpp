@@ -0,0 +1,96 @@
+#include <string>
+
+#include "test.h"
+
+using namespace std;
+
+// starts cmd and returns its process, or nullptr if it could not be started
+static HANDLE start(wstring cmd)
+{
+    PROCESS_INFORMATION pi;
+    STARTUPINFOW si;
+
+    ZeroMemory(&si, sizeof(si));
+    si.cb = sizeof(si);
+    if (CreateProcessW(nullptr, &cmd[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &si, &pi) == FALSE) {
+        return nullptr;
+    }
+    CloseHandle(pi.hThread);
+    return pi.hProcess;
+}
+
+// runs cmd to its end and returns its exit code, or -1 if it could not be started
+static long run(const wstring &cmd)
+{
+    HANDLE h = start(cmd);
+    DWORD code;
+
+    if (!h) {
+        return -1;
+    }
+    WaitForSingleObject(h, INFINITE);
+    if (GetExitCodeProcess(h, &code) == FALSE) {
+        code = (DWORD)-1;
+    }
+    CloseHandle(h);
+    return (long)code;
+}
+
+// whether the server has its pipe up within a few seconds
+static bool wait_ready(const wstring &pipe, HANDLE server)
+{
+    for (int i = 0; i < 500; i++) {
+        if (WaitNamedPipeW(pipe.c_str(), 10) != FALSE) {
+            return true;
+        }
+        if (WaitForSingleObject(server, 10) == WAIT_OBJECT_0) {
+            return false;
+        }
+    }
+    return false;
+}
+
+/*
+ * An exit in a request ends that request with its status; the server goes
+ * on to the next one, with set -e and a stopped list behind it.
+ */
+static void test_exit(const WCHAR *shell)
+{
+    wstring name = L"tiny-shell-test-" + to_wstring(GetCurrentProcessId());
+    wstring exe = wstring(L"\"") + shell + L"\"";
+    wstring connect = exe + L" --connect " + name + L" ";
+    HANDLE server = start(exe + L" --serve " + name);
+
+    CHECK(server != nullptr);
+    if (!server) {
+        return;
+    }
+    CHECK(wait_ready(L"\\\\.\\pipe\\" + name, server));
+
+    CHECK(run(connect + L"exit 3") == 3);
+    CHECK(run(connect + L"cd .") == 0);
+    CHECK(run(connect + L"exit 4; exit 5") == 4);
+    CHECK(run(connect + L"if exit 6; then exit 7; fi") == 6);
+    CHECK(run(connect + L"while exit 8; do cd .; done") == 8);
+    CHECK(run(connect + L"set -e; ls no-such-dir; exit 9") == 1);
+    CHECK(run(connect + L"exit 0") == 0);
+    CHECK(run(connect + L"cd .") == 0);
+    CHECK(WaitForSingleObject(server, 0) == WAIT_TIMEOUT);
+
+    TerminateProcess(server, 0);
+    WaitForSingleObject(server, INFINITE);
+    CloseHandle(server);
+}
+
+int wmain(int argc, WCHAR *argv[])
+{
+    const WCHAR *shell = shell_path(argc, argv);
+
+    if (!shell) {
+        fprintf(stderr, "usage: test-serve path-to-tiny-shell\n");
+        return 1;
+    }
+
+    test_exit(shell);
+    return test_result();
+}
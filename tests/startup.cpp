@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "test.h"
+
+using namespace std;
+
+/*
+ * Starts cmd with script waiting on its standard input and returns the time
+ * until its first output arrives: for the shell, exec to the end of its
+ * first command. Its input is then closed and it is left to exit. Returns
+ * a negative time if it could not be started or wrote nothing.
+ */
+static double first_output(const WCHAR *exe, const WCHAR *args, const char *script)
+{
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
+    wstring cmd = wstring(L"\"") + exe + L"\"" + args;
+    PROCESS_INFORMATION pi;
+    STARTUPINFOW si;
+    HANDLE in_r, in_w, out_r, out_w;
+    char buf[4096];
+    DWORD n = 0;
+
+    if (CreatePipe(&in_r, &in_w, &sa, 0) == FALSE) {
+        return -1;
+    }
+    if (CreatePipe(&out_r, &out_w, &sa, 0) == FALSE) {
+        CloseHandle(in_r);
+        CloseHandle(in_w);
+        return -1;
+    }
+    SetHandleInformation(in_w, HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(out_r, HANDLE_FLAG_INHERIT, 0);
+    // the script is already in the pipe when the process starts
+    WriteFile(in_w, script, (DWORD)strlen(script), &n, nullptr);
+
+    ZeroMemory(&si, sizeof(si));
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = in_r;
+    si.hStdOutput = out_w;
+    si.hStdError = out_w;
+
+    stopwatch t;
+    BOOL ok = CreateProcessW(exe, &cmd[0], nullptr, nullptr, TRUE, 0, nullptr, nullptr, &si, &pi);
+    CloseHandle(in_r);
+    CloseHandle(out_w);
+    double ms = -1;
+    if (ok != FALSE) {
+        if (ReadFile(out_r, buf, sizeof(buf), &n, nullptr) != FALSE && n > 0) {
+            ms = t.ms();
+        }
+        CloseHandle(in_w);
+        in_w = nullptr;
+        // drain the rest so that the child never blocks on a full pipe
+        while (ReadFile(out_r, buf, sizeof(buf), &n, nullptr) != FALSE && n > 0) {
+        }
+        WaitForSingleObject(pi.hProcess, INFINITE);
+        CloseHandle(pi.hThread);
+        CloseHandle(pi.hProcess);
+    }
+    if (in_w) {
+        CloseHandle(in_w);
+    }
+    CloseHandle(out_r);
+    return ms;
+}
+
+static long run(const WCHAR *shell, const char *script)
+{
+    return run_shell(shell, script, strlen(script), nullptr, nullptr);
+}
+
+// input ending, exit and an open if all end the shell with the right status
+static void test_exit(const WCHAR *shell)
+{
+    CHECK(run(shell, "") == 0);
+    CHECK(run(shell, "exit 7\n") == 7);
+    CHECK(run(shell, "exit 7") == 7);
+    CHECK(run(shell, "\r\n\n   \nexit 3\r\n") == 3);
+
+    // a syntax error, not a shell waiting for more
+    CHECK(run(shell, "if exit 0; then\n") == 2);
+}
+
+struct timings {
+    double min, median, mean;
+};
+
+static timings summarize(vector<double> &v)
+{
+    timings t = {0, 0, 0};
+
+    sort(v.begin(), v.end());
+    for (double ms : v) {
+        t.mean += ms;
+    }
+    t.min = v.front();
+    t.median = v[v.size() / 2];
+    t.mean /= v.size();
+    return t;
+}
+
+/*
+ * Exec to the first command's output, against the target of 2 ms. The same
+ * measured for this program answering at once shows what creating any
+ * process costs on the machine.
+ */
+static void bench(const WCHAR *shell)
+{
+    const int rounds = 200;
+    WCHAR self[MAX_PATH];
+    vector<double> sh, bare;
+
+    if (GetModuleFileNameW(nullptr, self, MAX_PATH) == 0) {
+        g_failed++;
+        return;
+    }
+    for (int i = 0; i < rounds; i++) {
+        double a = first_output(shell, L"", "pwd\n");
+        double b = first_output(self, L" --answer", "");
+        CHECK(a >= 0 && b >= 0);
+        if (a < 0 || b < 0) {
+            return;
+        }
+        sh.push_back(a);
+        bare.push_back(b);
+    }
+
+    timings s = summarize(sh), f = summarize(bare);
+    printf("exec to first output over %d runs (ms):   min  median    mean\n", rounds);
+    printf("  tiny-shell, pwd                       %6.2f  %6.2f  %6.2f\n", s.min, s.median, s.mean);
+    printf("  a process that answers at once        %6.2f  %6.2f  %6.2f\n", f.min, f.median, f.mean);
+    printf("target 2 ms: the median is %s\n", s.median < 2.0 ? "under it" : "over it");
+}
+
+int wmain(int argc, WCHAR *argv[])
+{
+    // the child the benchmark compares against
+    if (argc > 1 && wcscmp(argv[1], L"--answer") == 0) {
+        fputs("ready\n", stdout);
+        return 0;
+    }
+
+    const WCHAR *shell = shell_path(argc, argv);
+    if (!shell) {
+        fprintf(stderr, "usage: test-startup [--bench] path-to-tiny-shell\n");
+        return 1;
+    }
+
+    test_exit(shell);
+    if (bench_mode(argc, argv)) {
+        bench(shell);
+    }
+    return test_result();
+}
@@ -0,0 +1,50 @@
+#include <cstring>
+
+#include "test.h"
+
+static long run(const WCHAR *shell, const char *script)
+{
+    return run_shell(shell, script, strlen(script), nullptr, nullptr);
+}
+
+/*
+ * The shell runs every line it reads, also those that only continue an open
+ * construct; $? and PIPESTATUS have to come through those lines untouched,
+ * while a real syntax error sets them to 2.
+ */
+static void test_continuation(const WCHAR *shell)
+{
+    CHECK(run(shell, "ls no-such-dir\nexit $?\n") == 1);
+    CHECK(run(shell, "ls no-such-dir\nfor x in $?\ndo\nexit $x\ndone\n") == 1);
+    CHECK(run(shell, "ls no-such-dir\nwhile exit $?\ndo\ncd .\ndone\n") == 1);
+    CHECK(run(shell, "ls no-such-dir | cd .\nif exit ${PIPESTATUS[0]}\nthen\ncd .\nfi\n") == 1);
+    CHECK(run(shell, "ls no-such-dir\nfor x in 1\ndo\ncd .\ndone\nexit $?\n") == 0);
+
+    CHECK(run(shell, "ls no-such-dir\nfi\nexit $?\n") == 2);
+    CHECK(run(shell, "cd .\n|\nexit ${PIPESTATUS[0]}\n") == 2);
+}
+
+// a group or a substitution is a subshell: exit, set -e and variables end with it
+static void test_subshell(const WCHAR *shell)
+{
+    CHECK(run(shell, "(exit 1) || exit 0\nexit 9\n") == 0);
+    CHECK(run(shell, "(exit 3)\nexit $?\n") == 3);
+    CHECK(run(shell, "(set -e; ls no-such-dir; exit 9)\nexit $?\n") == 1);
+    CHECK(run(shell, "x=7; (x=1); exit $x\n") == 7);
+    CHECK(run(shell, "(x=1); exit 5$x\n") == 5);
+    CHECK(run(shell, "x=$(exit 3; cd .)\nexit 4\n") == 4);
+}
+
+int wmain(int argc, WCHAR *argv[])
+{
+    const WCHAR *shell = shell_path(argc, argv);
+
+    if (!shell) {
+        fprintf(stderr, "usage: test-status path-to-tiny-shell\n");
+        return 1;
+    }
+
+    test_continuation(shell);
+    test_subshell(shell);
+    return test_result();
+}
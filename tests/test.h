@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstdio>
+#include <cwchar>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+#include "builtin.h"
+#include "path.h"
+
+/*
+ * A minimal harness shared by the tests. CHECK reports a failed condition and
+ * carries on; main returns test_result(). Started with --bench, a test also
+ * runs its benchmarks and prints the timings; ctest -C bench runs those.
+ * Tests that drive the shell itself get its path as their last argument;
+ * others call the builtins directly.
+ */
+
+static int g_failed;
+
+#define CHECK(cond) test_check((cond), #cond, __FILE__, __LINE__)
+
+static inline void test_check(bool ok, const char *what, const char *file, int line)
+{
+    if (!ok) {
+        fprintf(stderr, "%s:%d: failed: %s\n", file, line, what);
+        g_failed++;
+    }
+}
+
+static inline int test_result()
+{
+    if (g_failed) {
+        fprintf(stderr, "%d checks failed\n", g_failed);
+    }
+    return g_failed ? 1 : 0;
+}
+
+static inline bool bench_mode(int argc, WCHAR *argv[])
+{
+    return argc > 1 && wcscmp(argv[1], L"--bench") == 0;
+}
+
+// wall-clock time since it was started
+struct stopwatch {
+    LARGE_INTEGER freq, t0;
+
+    stopwatch()
+    {
+        QueryPerformanceFrequency(&freq);
+        QueryPerformanceCounter(&t0);
+    }
+
+    double ms() const
+    {
+        LARGE_INTEGER t1;
+        QueryPerformanceCounter(&t1);
+        return (double)(t1.QuadPart - t0.QuadPart) * 1000.0 / (double)freq.QuadPart;
+    }
+};
+
+// the shell under test, passed after --bench if that is there
+static inline const WCHAR *shell_path(int argc, WCHAR *argv[])
+{
+    return argc > 1 && wcscmp(argv[argc - 1], L"--bench") != 0 ? argv[argc - 1] : nullptr;
+}
+
+/*
+ * Runs the shell with script on its standard input and returns its exit code,
+ * or -1 if it could not be started. It writes to out, or to NUL when out is
+ * null; ms gets the time from starting it to its exit.
+ */
+static inline long run_shell(const WCHAR *shell, const char *script, size_t n, HANDLE out, double *ms)
+{
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
+    std::wstring cmd = std::wstring(L"\"") + shell + L"\"";
+    PROCESS_INFORMATION pi;
+    STARTUPINFOW si;
+    HANDLE r, w;
+    DWORD code;
+
+    if (CreatePipe(&r, &w, &sa, 0) == FALSE) {
+        return -1;
+    }
+    SetHandleInformation(w, HANDLE_FLAG_INHERIT, 0);
+    HANDLE nul = CreateFileW(L"NUL", GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0,
+                             nullptr);
+
+    ZeroMemory(&si, sizeof(si));
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = r;
+    si.hStdOutput = out ? out : nul;
+    si.hStdError = out ? out : nul;
+
+    stopwatch t;
+    BOOL ok = CreateProcessW(shell, &cmd[0], nullptr, nullptr, TRUE, 0, nullptr, nullptr, &si, &pi);
+    CloseHandle(r);
+    CloseHandle(nul);
+    if (ok == FALSE) {
+        CloseHandle(w);
+        return -1;
+    }
+
+    // the shell reads while we write, so a long script needs no temporary file
+    while (n > 0) {
+        DWORD k;
+        if (WriteFile(w, script, n > 65536 ? 65536 : (DWORD)n, &k, nullptr) == FALSE) {
+            break;
+        }
+        script += k;
+        n -= k;
+    }
+    CloseHandle(w);
+
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    if (ms) {
+        *ms = t.ms();
+    }
+    if (GetExitCodeProcess(pi.hProcess, &code) == FALSE) {
+        code = (DWORD)-1;
+    }
+    CloseHandle(pi.hThread);
+    CloseHandle(pi.hProcess);
+    return (long)code;
+}
+
+// runs the builtin named by the first word, writing to out
+static inline int run_builtin(out_stream &out, std::initializer_list<const WCHAR *> words)
+{
+    std::vector<tstring> copies;
+    std::vector<WCHAR *> args;
+
+    for (const WCHAR *w : words) {
+        copies.emplace_back(w);
+    }
+    for (tstring &w : copies) {
+        args.push_back(w.data());
+    }
+
+    const struct command *cmd = is_builtin(args[0]);
+    if (!cmd) {
+        return -1;
+    }
+    builtin_io io = {GetStdHandle(STD_INPUT_HANDLE), &out, &out};
+    int status = cmd->handler(args, io);
+    out.flush();
+    return status;
+}
+
+// a new empty directory under %TEMP%, named after the test
+static inline bool make_scratch(const WCHAR *name, std::wstring &dir)
+{
+    WCHAR tmp[MAX_PATH + 1];
+    DWORD n = GetTempPathW(MAX_PATH + 1, tmp);
+
+    if (n == 0 || n > MAX_PATH) {
+        return false;
+    }
+    dir = std::wstring(tmp, n) + L"tiny-shell-" + name + L"-" + std::to_wstring(GetCurrentProcessId());
+    return CreateDirectoryW(dir.c_str(), nullptr) != FALSE;
+}
+
+// creates an empty file, however long its path
+static inline bool touch(const std::wstring &path)
+{
+    tstring full;
+
+    if (!long_path(path.c_str(), full)) {
+        return false;
+    }
+    HANDLE h = CreateFileW(full.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_NEW, 0, nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    CloseHandle(h);
+    return true;
+}
+
+static inline bool exists(const std::wstring &path)
+{
+    tstring full;
+
+    return long_path(path.c_str(), full) && GetFileAttributesW(full.c_str()) != INVALID_FILE_ATTRIBUTES;
+}
@@ -0,0 +1,218 @@
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "container.h"
+#include "test.h"
+
+using namespace std;
+
+// characters that fit in the object itself, null included
+static const unsigned inline_capacity = 56 / sizeof(WCHAR);
+
+static bool same(const tstring &s, const WCHAR *expect)
+{
+    return s.size() == wcslen(expect) && wcscmp(s.c_str(), expect) == 0;
+}
+
+static void test_growth()
+{
+    tstring s;
+    wstring expect;
+
+    CHECK(s.empty() && s.c_str()[0] == L'\0');
+    CHECK(s.capacity() == inline_capacity);
+
+    unsigned last = s.capacity();
+    for (int i = 0; i < 10000; i++) {
+        WCHAR c = (WCHAR)(L'a' + i % 26);
+        s.append(c);
+        expect += c;
+        if (s.capacity() != last) {
+            // geometric growth, and the content survives every move to a new buffer
+            CHECK(s.capacity() >= 2 * last);
+            CHECK(same(s, expect.c_str()));
+            last = s.capacity();
+        }
+    }
+    CHECK(same(s, expect.c_str()));
+
+    // the last length that still fits inline, and the first that does not
+    tstring a(expect.c_str(), inline_capacity - 1);
+    CHECK(a.capacity() == inline_capacity);
+    tstring b(expect.c_str(), inline_capacity);
+    CHECK(b.capacity() > inline_capacity);
+    CHECK(b.c_str()[inline_capacity] == L'\0');
+}
+
+static void test_copy_and_move()
+{
+    tstring small(L"short");
+    tstring big(wstring(200, L'x').c_str());
+    const WCHAR *buffer = big.c_str();
+
+    tstring c(big);
+    CHECK(same(c, big.c_str()) && c.c_str() != big.c_str());
+
+    tstring m(std::move(small));
+    CHECK(same(m, L"short"));
+    CHECK(small.empty() && small.c_str()[0] == L'\0');
+
+    // a heap buffer changes owner instead of being copied
+    tstring h(std::move(big));
+    CHECK(h.c_str() == buffer && h.size() == 200);
+    CHECK(big.empty() && big.capacity() == inline_capacity);
+
+    m = std::move(h);
+    CHECK(m.c_str() == buffer && h.empty());
+    tstring &alias = m;
+    m = std::move(alias);
+    CHECK(m.c_str() == buffer && m.size() == 200);
+
+    // a moved-from string is usable again
+    big.append(L"again");
+    CHECK(same(big, L"again"));
+
+    vector<tstring> v;
+    for (int i = 0; i < 1000; i++) {
+        v.emplace_back(i % 2 ? L"odd one, long enough to live on the heap" : L"even");
+    }
+    CHECK(same(v[998], L"even") && same(v[999], L"odd one, long enough to live on the heap"));
+}
+
+static void test_self_append()
+{
+    tstring s(L"abc");
+
+    // crosses from the inline buffer to the heap while reading itself
+    for (int i = 0; i < 6; i++) {
+        s.append(s);
+    }
+    CHECK(s.size() == 3 * 64);
+    bool ok = true;
+    for (unsigned i = 0; i < s.size(); i++) {
+        ok = ok && s[i] == L"abc"[i % 3];
+    }
+    CHECK(ok);
+
+    tstring t(L"0123456789");
+    t.append(t.c_str() + 2, 3);
+    CHECK(same(t, L"0123456789234"));
+    while (t.capacity() == inline_capacity) {
+        t.append(t.c_str(), 1);
+    }
+    CHECK(t[t.size() - 1] == L'0');
+}
+
+static void test_resize_and_strip()
+{
+    tstring s(L"abc");
+
+    // written through data() the way Win32 calls fill it, then sized
+    s.resize(100);
+    wmemset(s.data(), L'z', 100);
+    s.resize(100);
+    CHECK(s.size() == 100 && s.c_str()[100] == L'\0');
+    s.resize(2);
+    CHECK(same(s, L"zz"));
+    s.resize(0);
+    CHECK(s.empty());
+
+    tstring a(L"  \t padded both ways \r\n");
+    a.strip();
+    CHECK(same(a, L"padded both ways"));
+
+    tstring b(L" \t\r\n ");
+    b.strip();
+    CHECK(b.empty() && b.c_str()[0] == L'\0');
+
+    wstring text = L"   " + wstring(300, L'q') + L"   ";
+    tstring c(text.c_str());
+    c.strip();
+    CHECK(c.size() == 300 && c[0] == L'q' && c.c_str()[300] == L'\0');
+
+    u8string u("  bytes \n");
+    u.strip();
+    CHECK(u.size() == 5 && strcmp(u.c_str(), "bytes") == 0);
+
+    // clear keeps the buffer
+    unsigned cap = c.capacity();
+    c.clear();
+    CHECK(c.empty() && c.capacity() == cap);
+}
+
+// the same work on tstring and std::wstring, in milliseconds
+template <typename S>
+static double time_short_strings(int n, size_t &sum)
+{
+    stopwatch w;
+    vector<S> v;
+
+    for (int i = 0; i < n; i++) {
+        S s(L"word");
+        s.append(L"-suffix");
+        v.push_back(std::move(s));
+    }
+    for (const S &s : v) {
+        sum += s.size();
+    }
+    return w.ms();
+}
+
+template <typename S>
+static double time_appends(int n, size_t &sum)
+{
+    stopwatch w;
+    S s;
+
+    for (int i = 0; i < n; i++) {
+        s.append(1, (WCHAR)(L'a' + i % 26));
+    }
+    sum += s.size();
+    return w.ms();
+}
+
+// tstring has no append(count, c), so the benchmark gives it one
+struct bench_tstring : tstring {
+    using basic_tstring<WCHAR>::basic_tstring;
+    using basic_tstring<WCHAR>::append;
+
+    void append(size_t n, WCHAR c)
+    {
+        while (n--) {
+            tstring::append(c);
+        }
+    }
+};
+
+static void bench()
+{
+    size_t sum = 0;
+    const int words = 2000000;
+    const int chars = 50000000;
+
+    double t1 = time_short_strings<bench_tstring>(words, sum);
+    double s1 = time_short_strings<wstring>(words, sum);
+    printf("%d short strings built and moved: tstring %.1f ms, std::wstring %.1f ms\n", words, t1, s1);
+
+    double t2 = time_appends<bench_tstring>(chars, sum);
+    double s2 = time_appends<wstring>(chars, sum);
+    printf("%d single-character appends: tstring %.1f ms, std::wstring %.1f ms\n", chars, t2, s2);
+
+    // printed so that the work is not optimized out
+    printf("checksum %u\n", (unsigned)sum);
+}
+
+int wmain(int argc, WCHAR *argv[])
+{
+    test_growth();
+    test_copy_and_move();
+    test_self_append();
+    test_resize_and_strip();
+
+    if (bench_mode(argc, argv)) {
+        bench();
+    }
+    return test_result();
+}
@@ -0,0 +1,95 @@
+#include <cstdlib>
+#include <string>
+
+#include "test.h"
+#include "utf.h"
+
+using namespace std;
+
+static string utf8(const wstring &w)
+{
+    u8string u;
+
+    utf16_to_utf8(w.c_str(), w.size(), u);
+    return string(u.c_str(), u.size());
+}
+
+static bool write_file(const wstring &path, const string &text)
+{
+    HANDLE h = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, 0, nullptr);
+    DWORD n;
+
+    if (h == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    BOOL ok = WriteFile(h, text.data(), (DWORD)text.size(), &n, nullptr);
+    CloseHandle(h);
+    return ok != FALSE && n == text.size();
+}
+
+static string read_file(const wstring &path)
+{
+    HANDLE h = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
+    char buf[256];
+    DWORD n = 0;
+
+    if (h == INVALID_HANDLE_VALUE) {
+        return string();
+    }
+    ReadFile(h, buf, sizeof(buf), &n, nullptr);
+    CloseHandle(h);
+    return string(buf, n);
+}
+
+/*
+ * A builtin gets its words as a program would from the same command line:
+ * split on blanks outside "...", with the quotes taken off, whether or not
+ * another word on the line is globbed.
+ */
+static void test_quoted(const WCHAR *shell, const wstring &root)
+{
+    for (const WCHAR *name : {L"a b", L"c d", L"x.tmp", L"y.tmp", L"keep"}) {
+        CHECK(touch(root + L"\\" + name));
+    }
+    CHECK(write_file(root + L"\\log.txt", "ERROR request 1\nERROR 2\nINFO request 3\nERROR request 4\n"));
+
+    string script = "cd \"" + utf8(root) + "\"\n"
+                    "rm \"a b\"\n"
+                    "rm \"c d\" *.tmp\n"
+                    "mkdir \"n m\"\n"
+                    "grep \"ERROR request\" log.txt | wc -l > count.txt\n";
+    CHECK(run_shell(shell, script.c_str(), script.size(), nullptr, nullptr) == 0);
+
+    CHECK(!exists(root + L"\\a b"));
+    CHECK(!exists(root + L"\\c d"));
+    CHECK(!exists(root + L"\\x.tmp"));
+    CHECK(!exists(root + L"\\y.tmp"));
+    CHECK(exists(root + L"\\keep"));
+    CHECK(exists(root + L"\\n m"));
+    CHECK(strtol(read_file(root + L"\\count.txt").c_str(), nullptr, 10) == 2);
+
+    for (const WCHAR *name : {L"keep", L"log.txt", L"count.txt"}) {
+        DeleteFileW((root + L"\\" + name).c_str());
+    }
+    RemoveDirectoryW((root + L"\\n m").c_str());
+}
+
+int wmain(int argc, WCHAR *argv[])
+{
+    const WCHAR *shell = shell_path(argc, argv);
+    wstring root;
+
+    if (!shell) {
+        fprintf(stderr, "usage: test-words path-to-tiny-shell\n");
+        return 1;
+    }
+    if (!make_scratch(L"words", root)) {
+        fprintf(stderr, "cannot create a scratch directory (error %d)\n", (int)GetLastError());
+        return 1;
+    }
+
+    test_quoted(shell, root);
+
+    RemoveDirectoryW(root.c_str());
+    return test_result();
+}
@@ -0,0 +1,500 @@
+#include <emmintrin.h>
+
+#include "builtin.h"
+#include "output.h"
+#include "path.h"
+#include "scan.h"
+#include "text.h"
+#include "utf.h"
+
+using namespace std;
+
+#define TEXT_BLOCK (256 * 1024)
+#define TAIL_POLL_MS 1000
+
+struct wc_count {
+    ULONGLONG lines;
+    ULONGLONG words;
+    ULONGLONG bytes;
+};
+
+static HANDLE open_read(const WCHAR *file)
+{
+    tstring path;
+
+    if (!long_path(file, path)) {
+        return INVALID_HANDLE_VALUE;
+    }
+
+    // logs are usually still open for writing, and may be rotated meanwhile
+    return CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                       OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+}
+
+// writes the complete UTF-8 sequences of buf[0, n) and moves the rest to the front
+static size_t write_whole(out_stream &out, char *buf, size_t n)
+{
+    size_t k = utf8_boundary(buf, n);
+
+    out.write(buf, k);
+    memmove(buf, buf + k, n - k);
+    return n - k;
+}
+
+// parses -n N (or -nN) into *lines and -f into *follow; the rest are files
+static bool parse_lines_args(vector<WCHAR *> &args, const WCHAR *cmd, LONGLONG *lines, bool *follow,
+                             vector<WCHAR *> &files, out_stream &out)
+{
+    size_t n = args.size();
+
+    for (size_t i = 1; i < n; i++) {
+        if (args[i][0] != L'-' || args[i][1] == WNULL) {
+            files.push_back(args[i]);
+            continue;
+        }
+        WCHAR *p = args[i] + 1;
+        while (*p != WNULL) {
+            switch (*p) {
+            case L'n': {
+                WCHAR *v = p[1] != WNULL ? p + 1 : i + 1 < n ? args[++i] : nullptr;
+                WCHAR *end = nullptr;
+                if (v && iswdigit(*v)) {
+                    *lines = (LONGLONG)wcstoull(v, &end, 10);
+                }
+                if (!end || *end != WNULL) {
+                    out.printf(L"%s: invalid number of lines\n", cmd);
+                    return false;
+                }
+                // the number ends the option word
+                p = end - 1;
+                break;
+            }
+            case L'f':
+                if (follow) {
+                    *follow = true;
+                    break;
+                }
+                // fall through
+            default:
+                out.printf(L"unknown option %c\n", *p);
+                return false;
+            }
+            p++;
+        }
+    }
+
+    return true;
+}
+
+static inline __m128i space_mask(__m128i v)
+{
+    // ' ' or \t \n \v \f \r: v - 9 is at most 4 for the control characters
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8(9));
+    __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(4)), d);
+
+    return _mm_or_si128(ctl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+
+/*
+ * A word starts at every non-space byte that follows a space, so both
+ * counts come from two 16-bit masks per block; prev carries the last bit
+ * into the next block.
+ */
+static void wc_block(wc_count &c, const char *p, size_t n, unsigned &prev)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&p[i]);
+        unsigned sp = (unsigned)_mm_movemask_epi8(space_mask(v));
+        unsigned starts = ~sp & ((sp << 1) | prev) & 0xFFFF;
+        c.words += __builtin_popcount(starts);
+        prev = sp >> 15;
+    }
+    c.lines += count_lines(p, p + n);
+
+    for (; i < n; i++) {
+        unsigned char ch = p[i];
+        unsigned sp = ch == ' ' || (ch >= 9 && ch <= 13);
+        c.words += !sp && prev;
+        prev = sp;
+    }
+
+    c.bytes += n;
+}
+
+static void wc_one(HANDLE in, wc_count &c)
+{
+    vector<char> v(TEXT_BLOCK);
+    unsigned prev = 1;
+    DWORD nread;
+
+    while (ReadFile(in, v.data(), (DWORD)v.size(), &nread, nullptr) != FALSE && nread > 0) {
+        wc_block(c, v.data(), nread, prev);
+    }
+}
+
+static void wc_print(const wc_count &c, bool lines, bool words, bool bytes, const WCHAR *name, out_stream &out)
+{
+    if (lines) {
+        out.printf(L"%8llu ", c.lines);
+    }
+    if (words) {
+        out.printf(L"%8llu ", c.words);
+    }
+    if (bytes) {
+        out.printf(L"%8llu ", c.bytes);
+    }
+    out.printf(L"%s\n", name ? name : L"");
+}
+
+int do_builtin_wc(vector<WCHAR *> &args, builtin_io &io)
+{
+    size_t n = args.size();
+    bool lines = false, words = false, bytes = false;
+    vector<WCHAR *> files;
+    wc_count total = {0, 0, 0};
+    int ret = 0;
+
+    for (size_t i = 1; i < n; i++) {
+        if (args[i][0] != L'-') {
+            files.push_back(args[i]);
+            continue;
+        }
+        WCHAR *p = args[i] + 1;
+        while (*p != WNULL) {
+            switch (*p) {
+            case L'l':
+                lines = true;
+                break;
+            case L'w':
+                words = true;
+                break;
+            case L'c':
+                bytes = true;
+                break;
+            default:
+                io.out->printf(L"unknown option %c\n", *p);
+                return 1;
+            }
+            p++;
+        }
+    }
+
+    if (!lines && !words && !bytes) {
+        lines = words = bytes = true;
+    }
+
+    if (files.empty()) {
+        wc_count c = {0, 0, 0};
+        wc_one(io.in, c);
+        wc_print(c, lines, words, bytes, nullptr, *io.out);
+        return 0;
+    }
+
+    for (WCHAR *file : files) {
+        wc_count c = {0, 0, 0};
+        HANDLE fp = open_read(file);
+        if (fp == INVALID_HANDLE_VALUE) {
+            io.out->printf(L"wc: %s (error %d)\n", file, GetLastError());
+            ret = 1;
+            continue;
+        }
+        wc_one(fp, c);
+        CloseHandle(fp);
+
+        wc_print(c, lines, words, bytes, file, *io.out);
+        total.lines += c.lines;
+        total.words += c.words;
+        total.bytes += c.bytes;
+    }
+
+    if (files.size() > 1) {
+        wc_print(total, lines, words, bytes, L"total", *io.out);
+    }
+
+    return ret;
+}
+
+static void head_one(HANDLE in, LONGLONG lines, out_stream &out)
+{
+    vector<char> v(64 * 1024);
+    char *buf = v.data();
+    size_t keep = 0;
+    DWORD nread;
+
+    // reading stops with the block that holds the last wanted line
+    while (lines > 0 && ReadFile(in, buf + keep, (DWORD)(v.size() - keep), &nread, nullptr) != FALSE && nread > 0) {
+        const char *p = buf + keep;
+        const char *e = buf + keep + nread;
+        while (lines > 0 && p < e) {
+            const char *nl = (const char *)memchr(p, '\n', e - p);
+            if (!nl) {
+                p = e;
+                break;
+            }
+            p = nl + 1;
+            lines--;
+        }
+        keep = write_whole(out, buf, p - buf);
+    }
+
+    if (keep) {
+        out.write(buf, keep);
+    }
+}
+
+int do_builtin_head(vector<WCHAR *> &args, builtin_io &io)
+{
+    LONGLONG lines = 10;
+    vector<WCHAR *> files;
+    int ret = 0;
+
+    if (!parse_lines_args(args, L"head", &lines, nullptr, files, *io.out)) {
+        return 1;
+    }
+
+    if (files.empty()) {
+        head_one(io.in, lines, *io.out);
+        return 0;
+    }
+
+    for (size_t i = 0; i < files.size(); i++) {
+        HANDLE fp = open_read(files[i]);
+        if (fp == INVALID_HANDLE_VALUE) {
+            io.out->printf(L"head: %s (error %d)\n", files[i], GetLastError());
+            ret = 1;
+            continue;
+        }
+        if (files.size() > 1) {
+            io.out->printf(L"%s==> %s <==\n", i ? L"\n" : L"", files[i]);
+        }
+        head_one(fp, lines, *io.out);
+        CloseHandle(fp);
+    }
+
+    return ret;
+}
+
+// where the last lines lines of p[0, n) start, or -1 if they start before p
+static LONGLONG scan_back(const char *p, size_t n, LONGLONG &lines)
+{
+    for (size_t i = n; i-- > 0;) {
+        if (p[i] == '\n' && --lines == 0) {
+            return (LONGLONG)i + 1;
+        }
+    }
+    return -1;
+}
+
+// offset of the last lines lines, reading blocks backwards from the end
+static LONGLONG tail_start(HANDLE fp, LONGLONG size, LONGLONG lines)
+{
+    vector<char> v(64 * 1024);
+    LONGLONG pos = size;
+
+    if (lines == 0) {
+        return size;
+    }
+
+    while (pos > 0) {
+        DWORD want = (DWORD)min<LONGLONG>(pos, (LONGLONG)v.size());
+        LARGE_INTEGER li;
+        DWORD nread;
+
+        pos -= want;
+        li.QuadPart = pos;
+        if (!SetFilePointerEx(fp, li, nullptr, FILE_BEGIN) ||
+            ReadFile(fp, v.data(), want, &nread, nullptr) == FALSE || nread != want) {
+            return 0;
+        }
+
+        // a newline ending the file does not start another line
+        size_t n = want;
+        if (pos + (LONGLONG)want == size && v[n - 1] == '\n') {
+            n--;
+        }
+        LONGLONG k = scan_back(v.data(), n, lines);
+        if (k >= 0) {
+            return pos + k;
+        }
+    }
+
+    return 0;
+}
+
+// copies fp from pos to its end; with hold, a sequence cut off at the end waits for more data
+static LONGLONG tail_copy(HANDLE fp, LONGLONG pos, bool hold, out_stream &out)
+{
+    vector<char> v(64 * 1024);
+    char *buf = v.data();
+    size_t keep = 0;
+    LARGE_INTEGER li;
+    DWORD nread;
+
+    li.QuadPart = pos;
+    if (!SetFilePointerEx(fp, li, nullptr, FILE_BEGIN)) {
+        return pos;
+    }
+
+    while (ReadFile(fp, buf + keep, (DWORD)(v.size() - keep), &nread, nullptr) != FALSE && nread > 0) {
+        size_t n = keep + nread;
+        keep = write_whole(out, buf, n);
+        pos += n - keep;
+    }
+
+    if (keep && !hold) {
+        out.write(buf, keep);
+        pos += keep;
+    }
+
+    return pos;
+}
+
+// input that cannot seek, such as a pipe, is read whole
+static void tail_stream(HANDLE in, LONGLONG lines, out_stream &out)
+{
+    vector<char> v;
+    size_t n = 0;
+    DWORD nread;
+
+    v.resize(64 * 1024);
+    while (ReadFile(in, v.data() + n, (DWORD)(v.size() - n), &nread, nullptr) != FALSE && nread > 0) {
+        n += nread;
+        if (n == v.size()) {
+            v.resize(v.size() * 2);
+        }
+    }
+
+    size_t end = n > 0 && v[n - 1] == '\n' ? n - 1 : n;
+    LONGLONG k = lines == 0 ? (LONGLONG)n : scan_back(v.data(), end, lines);
+    if (k < 0) {
+        k = 0;
+    }
+    out.write(v.data() + k, n - (size_t)k);
+}
+
+static HANDLE g_tail_stop;
+
+static BOOL WINAPI tail_ctrl(DWORD type)
+{
+    if (type == CTRL_C_EVENT || type == CTRL_BREAK_EVENT) {
+        SetEvent(g_tail_stop);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+ * Follows a file by waiting for size and write notifications on its
+ * directory. The notification is re-armed before reading so a write that
+ * lands while copying wakes the next wait, and the size is checked again
+ * every TAIL_POLL_MS anyway, since a notification can be missed. Ctrl-C ends
+ * following instead of the shell, and so does an output nobody reads any
+ * more, such as a pipe into head that has ended.
+ */
+static int tail_follow(HANDLE fp, const WCHAR *file, LONGLONG pos, out_stream &out)
+{
+    tstring dir;
+    HANDLE change;
+
+    if (!long_path(file, dir)) {
+        out.printf(L"tail: %s (error %d)\n", file, GetLastError());
+        return 1;
+    }
+    size_t k = dir.size();
+    while (k > 0 && dir[(unsigned)k - 1] != L'\\') k--;
+    dir.resize(k);
+
+    change = FindFirstChangeNotificationW(dir.c_str(), FALSE, FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+    if (change == INVALID_HANDLE_VALUE) {
+        out.printf(L"tail: cannot watch %s (error %d)\n", file, GetLastError());
+        return 1;
+    }
+
+    g_tail_stop = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    SetConsoleCtrlHandler(tail_ctrl, TRUE);
+
+    HANDLE waits[2] = {change, g_tail_stop};
+    out.flush();
+    while (!out.failed()) {
+        DWORD w = WaitForMultipleObjects(2, waits, FALSE, TAIL_POLL_MS);
+        LARGE_INTEGER size;
+
+        if (w != WAIT_OBJECT_0 && w != WAIT_TIMEOUT) {
+            break;
+        }
+        if (w == WAIT_OBJECT_0) {
+            FindNextChangeNotification(change);
+        }
+        if (!GetFileSizeEx(fp, &size)) {
+            break;
+        }
+        // truncated or rotated in place: start over from the beginning
+        if (size.QuadPart < pos) {
+            pos = 0;
+        }
+        if (size.QuadPart > pos) {
+            pos = tail_copy(fp, pos, true, out);
+            out.flush();
+        }
+    }
+
+    SetConsoleCtrlHandler(tail_ctrl, FALSE);
+    CloseHandle(g_tail_stop);
+    g_tail_stop = nullptr;
+    FindCloseChangeNotification(change);
+
+    return 0;
+}
+
+int do_builtin_tail(vector<WCHAR *> &args, builtin_io &io)
+{
+    LONGLONG lines = 10;
+    bool follow = false;
+    vector<WCHAR *> files;
+    int ret = 0;
+
+    if (!parse_lines_args(args, L"tail", &lines, &follow, files, *io.out)) {
+        return 1;
+    }
+
+    if (files.empty()) {
+        if (follow) {
+            io.out->printf(L"tail: -f needs a file\n");
+            return 1;
+        }
+        tail_stream(io.in, lines, *io.out);
+        return 0;
+    }
+
+    if (follow && files.size() > 1) {
+        io.out->printf(L"tail: -f follows a single file\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < files.size(); i++) {
+        LARGE_INTEGER size;
+        HANDLE fp = open_read(files[i]);
+
+        if (fp == INVALID_HANDLE_VALUE || !GetFileSizeEx(fp, &size)) {
+            io.out->printf(L"tail: %s (error %d)\n", files[i], GetLastError());
+            if (fp != INVALID_HANDLE_VALUE) {
+                CloseHandle(fp);
+            }
+            ret = 1;
+            continue;
+        }
+        if (files.size() > 1) {
+            io.out->printf(L"%s==> %s <==\n", i ? L"\n" : L"", files[i]);
+        }
+
+        LONGLONG pos = tail_copy(fp, tail_start(fp, size.QuadPart, lines), follow, *io.out);
+        if (follow) {
+            ret = tail_follow(fp, files[i], pos, *io.out);
+        }
+        CloseHandle(fp);
+    }
+
+    return ret;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <vector>
+
+#include <Windows.h>
+
+#include "builtin.h"
+
+/*
+ * Text builtins working on UTF-8 bytes:
+ *
+ *   wc [-l] [-w] [-c] [file...]
+ *   head [-n N] [file...]
+ *   tail [-n N] [-f] [file...]
+ *
+ * head stops reading once it has its lines, tail reads files backwards from
+ * the end, and tail -f waits on directory change notifications until Ctrl-C.
+ */
+
+int do_builtin_wc(std::vector<WCHAR *> &args, builtin_io &io);
+int do_builtin_head(std::vector<WCHAR *> &args, builtin_io &io);
+int do_builtin_tail(std::vector<WCHAR *> &args, builtin_io &io);
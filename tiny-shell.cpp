@@ -6,55 +6,132 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstdint>
-#include <clocale>
 
 #include <Windows.h>
 #include <processthreadsapi.h>
-#include <io.h>
-#include <fcntl.h>
 
 #include "win_getopt.h"
 #include "builtin.h"
 #include "container.h"
+#include "glob.h"
+#include "job.h"
+#include "output.h"
+#include "parser.h"
+#include "path.h"
+#include "place.h"
+#include "pool.h"
+#include "serve.h"
+#include "utf.h"
+#include "vars.h"
 
 using namespace std;
 
+struct capture;
+
+// the standard handles a list runs with; a ( ... ) group passes its own down
+struct stdio_set {
+    HANDLE in;
+    HANDLE out;
+    HANDLE err;
+    bool redirected;
+    capture *cap; // set, with out null, inside $( ... )
+};
+
+/*
+ * The output of a $( ... ). Builtins write into mem directly. Children get
+ * the write end of a pipe, made when the first of a pipeline needs it, which
+ * a pool thread drains into mem; the pipe is closed and drained at the end
+ * of the pipeline, so the next one's output comes after it.
+ */
+struct capture {
+    out_stream mem;
+    HANDLE r;
+    HANDLE w;
+    HANDLE done; // signaled when the reader has seen the end of the pipe
+};
+
 struct execunit {
     tstring str;
+    vector<tstring> args;
+    const stage *st;
     HANDLE h_stdin;
     HANDLE h_stdout;
     HANDLE h_stderr;
+    HANDLE job; // shared by the pipeline, not owned
+    GROUP_AFFINITY affinity;
+    bool placed;
     PROCESS_INFORMATION pi;
+    HANDLE thread; // a stage the shell runs itself, away from the pipeline's other stages
+    int status;
     bool is_bg_task;
     bool use_std_handles;
     bool is_builtin;
 
     execunit()
     {
-        str = tstring();
+        st = nullptr;
         h_stdin = nullptr;
         h_stdout = nullptr;
         h_stderr = nullptr;
+        job = nullptr;
+        placed = false;
+        thread = nullptr;
+        status = 0;
         is_bg_task = false;
         use_std_handles = false;
         is_builtin = false;
         ZeroMemory(&pi, sizeof(pi));
     }
 
+    execunit(const execunit &) = delete;
+    execunit &operator=(const execunit &) = delete;
+
+    // handles are owned, so growing a vector<execunit> must transfer them
+    execunit(execunit &&other) noexcept : str(std::move(other.str)), args(std::move(other.args))
+    {
+        st = other.st;
+        h_stdin = other.h_stdin;
+        h_stdout = other.h_stdout;
+        h_stderr = other.h_stderr;
+        job = other.job;
+        affinity = other.affinity;
+        placed = other.placed;
+        pi = other.pi;
+        thread = other.thread;
+        status = other.status;
+        is_bg_task = other.is_bg_task;
+        use_std_handles = other.use_std_handles;
+        is_builtin = other.is_builtin;
+
+        other.h_stdin = nullptr;
+        other.h_stdout = nullptr;
+        other.h_stderr = nullptr;
+        other.thread = nullptr;
+        ZeroMemory(&other.pi, sizeof(other.pi));
+    }
+
     ~execunit()
+    {
+        close_handles();
+        is_bg_task = false;
+        use_std_handles = false;
+        is_builtin = false;
+    }
+
+    void close_handles()
     {
         if (h_stdin) {
             CloseHandle(h_stdin);
+            h_stdin = nullptr;
         }
         if (h_stdout) {
             CloseHandle(h_stdout);
+            h_stdout = nullptr;
         }
         if (h_stderr) {
             CloseHandle(h_stderr);
+            h_stderr = nullptr;
         }
-        is_bg_task = false;
-        use_std_handles = false;
-        is_builtin = false;
     }
 
     WCHAR *get_cmdline()
@@ -64,159 +141,559 @@ struct execunit {
 };
 
 static WCHAR g_config[256];
+static const WCHAR *g_serve;
+static const WCHAR *g_connect;
+static int g_repeat = 1;
+static vector<WCHAR *> g_env;
+static tstring g_command;
+
+// > 0 while running the condition of an if or while, where failures are expected
+static thread_local int t_testing;
 
 const static struct option g_long_opts[] = {
     {L"config", required_argument, 0, L'f'},
     {L"help", no_argument, 0, L'h'},
     {L"version", no_argument, 0, L'v'},
+    {L"serve", required_argument, 0, L's'},
+    {L"connect", required_argument, 0, L'c'},
     {0, 0, 0, 0},
 };
 
-static inline void create_process(execunit &u)
+static void CALLBACK capture_read(PTP_CALLBACK_INSTANCE inst, void *param)
 {
-    STARTUPINFOW si;
+    (void)inst;
+    capture *cap = (capture *)param;
+    char buf[16 * 1024];
+    DWORD n;
+
+    while (ReadFile(cap->r, buf, sizeof(buf), &n, nullptr) != FALSE && n > 0) {
+        cap->mem.write(buf, n);
+    }
+    CloseHandle(cap->r);
+    SetEvent(cap->done);
+}
+
+// the handle a stage writes to when its output is not redirected
+static HANDLE std_out(const stdio_set &io)
+{
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
+    capture *cap = io.cap;
+
+    if (!cap || cap->w) {
+        return cap ? cap->w : io.out;
+    }
+    if (CreatePipe(&cap->r, &cap->w, &sa, 0) == FALSE) {
+        out_printf(L"cannot capture output (error %d)\n", GetLastError());
+        cap->w = nullptr;
+        return nullptr;
+    }
+    SetHandleInformation(cap->r, HANDLE_FLAG_INHERIT, 0);
+    if (!TrySubmitThreadpoolCallback(capture_read, cap, nullptr)) {
+        out_printf(L"cannot capture output (error %d)\n", GetLastError());
+        CloseHandle(cap->r);
+        CloseHandle(cap->w);
+        cap->w = nullptr;
+    }
+    return cap->w;
+}
+
+// waits until everything the children wrote to the capture pipe is in memory
+static void drain_capture(capture &cap)
+{
+    if (cap.w) {
+        CloseHandle(cap.w);
+        cap.w = nullptr;
+        WaitForSingleObject(cap.done, INFINITE);
+    }
+}
+
+// whether h can go in a child's list of inherited handles, which takes each handle once
+static bool inheritable(HANDLE h, const HANDLE *list, DWORD n)
+{
+    DWORD info;
+
+    // console pseudo-handles reach the child without being inherited
+    if (!h || h == INVALID_HANDLE_VALUE || ((ULONG_PTR)h & 3) == 3) {
+        return false;
+    }
+    if (GetHandleInformation(h, &info) == FALSE || (info & HANDLE_FLAG_INHERIT) == 0) {
+        return false;
+    }
+    for (DWORD i = 0; i < n; i++) {
+        if (list[i] == h) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * A placed child is created with its group affinity as a thread attribute,
+ * which puts it in the right processor group, and is held suspended until
+ * the process affinity covers every thread it will start. A child inherits
+ * its standard handles and nothing else, listed as another attribute: the
+ * pipe ends of stages the shell runs alongside it stay out of it, and so
+ * the pipes still end when those stages do.
+ */
+static inline void create_process(execunit &u, const stdio_set &io)
+{
+    STARTUPINFOEXW si;
+    LPPROC_THREAD_ATTRIBUTE_LIST attrs = nullptr;
+    SIZE_T size = 0;
+    bool initialized = false;
+    bool grouped = false;
+    bool listed = false;
+    HANDLE inherit[3];
+    DWORD count = 0, attr_count;
+    DWORD flags;
     BOOL err;
 
     ZeroMemory(&si, sizeof(si));
-    si.cb = sizeof(si);
+    si.StartupInfo.cb = sizeof(si.StartupInfo);
     if (u.use_std_handles) {
-        si.hStdInput = u.h_stdin ? u.h_stdin : GetStdHandle(STD_INPUT_HANDLE);
-        si.hStdOutput = u.h_stdout ? u.h_stdout : GetStdHandle(STD_OUTPUT_HANDLE);
-        si.hStdError = u.h_stderr ? u.h_stderr : GetStdHandle(STD_ERROR_HANDLE);
-        si.dwFlags |= STARTF_USESTDHANDLES;
-    }
-
-    err = CreateProcessW(nullptr,
-                         u.str.data(),
-                         nullptr,
-                         nullptr,
-                         u.use_std_handles ? TRUE : FALSE,
-                         0,
-                         nullptr,
-                         nullptr,
-                         &si,
-                         &u.pi);
-
-    if (u.use_std_handles) {
-        if (u.h_stdin) {
-            CloseHandle(u.h_stdin);
-            u.h_stdin = nullptr;
-        }
-        if (u.h_stdout) {
-            CloseHandle(u.h_stdout);
-            u.h_stdout = nullptr;
+        si.StartupInfo.hStdInput = u.h_stdin ? u.h_stdin : io.in;
+        si.StartupInfo.hStdOutput = u.h_stdout ? u.h_stdout : std_out(io);
+        si.StartupInfo.hStdError = u.h_stderr ? u.h_stderr : io.err;
+        si.StartupInfo.dwFlags |= STARTF_USESTDHANDLES;
+        for (HANDLE h : {si.StartupInfo.hStdInput, si.StartupInfo.hStdOutput, si.StartupInfo.hStdError}) {
+            if (inheritable(h, inherit, count)) {
+                inherit[count++] = h;
+            }
         }
-        if (u.h_stderr) {
-            CloseHandle(u.h_stderr);
-            u.h_stderr = nullptr;
+    }
+
+    flags = 0;
+    attr_count = (u.placed ? 1 : 0) + (count > 0 ? 1 : 0);
+    if (attr_count > 0) {
+        InitializeProcThreadAttributeList(nullptr, attr_count, 0, &size);
+        attrs = (LPPROC_THREAD_ATTRIBUTE_LIST)_malloca(size);
+        if (attrs && InitializeProcThreadAttributeList(attrs, attr_count, 0, &size) != FALSE) {
+            initialized = true;
+            grouped = u.placed && UpdateProcThreadAttribute(attrs, 0, PROC_THREAD_ATTRIBUTE_GROUP_AFFINITY,
+                                                            &u.affinity, sizeof(u.affinity), nullptr,
+                                                            nullptr) != FALSE;
+            listed = count > 0 && UpdateProcThreadAttribute(attrs, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, inherit,
+                                                            count * sizeof(HANDLE), nullptr, nullptr) != FALSE;
+            if (grouped || listed) {
+                si.StartupInfo.cb = sizeof(si);
+                si.lpAttributeList = attrs;
+                flags |= EXTENDED_STARTUPINFO_PRESENT;
+            }
         }
     }
+    if (u.job || grouped) {
+        flags |= CREATE_SUSPENDED;
+    }
+
+    // whatever the shell printed so far must not end up after the child's output
+    out_flush();
+    HANDLE handles[3] = {si.StartupInfo.hStdInput, si.StartupInfo.hStdOutput, si.StartupInfo.hStdError};
+    if (!u.placed && pool_take(u.str.data(), u.use_std_handles ? handles : nullptr, &u.pi)) {
+        // a copy from the pool waits suspended like a placed or limited child
+        flags |= CREATE_SUSPENDED;
+        err = TRUE;
+    } else {
+        err = CreateProcessW(nullptr,
+                             u.str.data(),
+                             nullptr,
+                             nullptr,
+                             u.use_std_handles ? TRUE : FALSE,
+                             flags,
+                             nullptr,
+                             nullptr,
+                             &si.StartupInfo,
+                             &u.pi);
+    }
+
+    u.close_handles();
+    if (initialized) {
+        DeleteProcThreadAttributeList(attrs);
+    }
+    if (attrs) {
+        _freea(attrs);
+    }
 
     if (err == FALSE) {
-        wprintf(L"%s failed %d\n", u.str.data(), GetLastError());
+        out_printf(L"%s failed %d\n", u.str.data(), GetLastError());
+        u.status = 127;
         return;
     }
+
+    if (grouped) {
+        SetProcessAffinityMask(u.pi.hProcess, u.affinity.Mask);
+    }
+    // it joins the job before running, so whatever it starts is limited too
+    if (u.job && AssignProcessToJobObject(u.job, u.pi.hProcess) == FALSE) {
+        out_printf(L"%s: cannot apply limits (error %d)\n", u.str.data(), GetLastError());
+        TerminateProcess(u.pi.hProcess, 1);
+    }
+    if (flags & CREATE_SUSPENDED) {
+        ResumeThread(u.pi.hThread);
+    }
 }
 
 static inline WCHAR *strip(WCHAR *line)
 {
     size_t n = wcslen(line);
-    size_t i = 0, j = n - 1;
+    size_t i = 0, j = n;
 
-    while (i < n && iswspace(line[i])) i++;
-    while (j > i && iswspace(line[j])) j--;
-    line[++j] = WNULL;
+    while (i < j && iswspace(line[i])) i++;
+    while (j > i && iswspace(line[j - 1])) j--;
+    line[j] = WNULL;
 
     return &line[i];
 }
 
-static inline vector<WCHAR *> split(WCHAR *line)
+static int run_list(const command_list &l, const stdio_set &io);
+
+/*
+ * A group runs as a subshell: variables, directory changes, limits,
+ * placement and options set inside it do not leak out, and exit or set -e
+ * ends only the group, with its status.
+ */
+static int run_group(const command_list &l, const stdio_set &io)
 {
-    vector<WCHAR *> v;
-    size_t n = wcslen(line);
-    size_t i = 0;
+    tstring cwd;
+    var_table vars = copy_vars();
+    job_limits limits = get_limits();
+    placement place = get_placement();
+    bool stop_on_error = errexit();
+    int status;
 
-    while (i < n) {
-        v.push_back(&line[i]);
-        while (i < n && !iswspace(line[i])) i++;
-        while (i < n && iswspace(line[i])) line[i++] = WNULL;
+    if (!current_dir(cwd)) {
+        out_printf(L"cannot get the current directory (error %d)\n", GetLastError());
+        return 1;
     }
 
-    return v;
+    enter_subshell();
+    status = run_list(l, io);
+    leave_subshell();
+
+    set_stopped(false);
+    swap_vars(vars);
+    SetCurrentDirectoryW(cwd.c_str());
+    set_limits(limits);
+    set_placement(place);
+    set_errexit(stop_on_error);
+    return status;
 }
 
-static void set_stdhandles(HANDLE in, HANDLE out, HANDLE err, bool restore)
+// quotes arg the way CommandLineToArgvW and the CRT split command lines
+static void append_quoted(tstring &cmd, const tstring &arg)
 {
-    int fd;
-    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
+    const WCHAR *c = arg.c_str();
+    size_t bs = 0;
 
-    if (in) {
-        _close(_fileno(stdin));
-        if (restore) {
-            in = CreateFileW(L"CONIN$", GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
+    if (!arg.empty() && !wcspbrk(c, L" \t\"")) {
+        cmd.append(arg);
+        return;
+    }
+
+    cmd.append(L'"');
+    for (; *c != WNULL; c++) {
+        if (*c == L'\\') {
+            bs++;
+            continue;
         }
-        SetStdHandle(STD_INPUT_HANDLE, in);
-        fd = _open_osfhandle((intptr_t)in, _O_RDONLY | _O_WTEXT);
-        _dup2(fd, _fileno(stdin));
+        for (size_t k = 0; k < (*c == L'"' ? 2 * bs + 1 : bs); k++) {
+            cmd.append(L'\\');
+        }
+        cmd.append(*c);
+        bs = 0;
+    }
+    for (size_t k = 0; k < 2 * bs; k++) {
+        cmd.append(L'\\');
     }
+    cmd.append(L'"');
+}
+
+// the word [b, e) as the CRT hands it to a program: quotes dropped, and the backslashes before them halved
+static void unquote(const WCHAR *b, const WCHAR *e, tstring &word)
+{
+    size_t bs = 0;
 
-    if (out) {
-        _close(_fileno(stdout));
-        if (restore) {
-            out = CreateFileW(L"CONOUT$", GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
+    for (const WCHAR *c = b; c < e; c++) {
+        if (*c == L'\\') {
+            bs++;
+            continue;
+        }
+        for (size_t k = 0; k < (*c == L'"' ? bs / 2 : bs); k++) {
+            word.append(L'\\');
         }
-        SetStdHandle(STD_OUTPUT_HANDLE, out);
-        fd = _open_osfhandle((intptr_t)out, _O_WRONLY | _O_WTEXT);
-        _dup2(fd, _fileno(stdout));
+        // behind an odd number of backslashes a quote is kept
+        if (*c != L'"' || bs % 2 == 1) {
+            word.append(*c);
+        }
+        bs = 0;
+    }
+    for (size_t k = 0; k < bs; k++) {
+        word.append(L'\\');
     }
+}
+
+/*
+ * Splits s into words the way the CRT splits a command line, so blanks inside
+ * "..." do not end a word, and with glob replaces each word that matches
+ * files with the matches. A word with a quote in it is never globbed. The
+ * words come out as a program would see them, with their quotes taken off;
+ * when line is given, they are joined into it again as they were typed,
+ * with only the matches quoted.
+ */
+static void split_and_glob(const WCHAR *c, const WCHAR *end, vector<tstring> &out, tstring *line, bool glob)
+{
+    while (c < end) {
+        while (c < end && iswspace(*c)) c++;
+        const WCHAR *b = c;
+        bool quoted = false;
+        bool inside = false;
+        size_t bs = 0;
+
+        for (; c < end && (inside || !iswspace(*c)); c++) {
+            if (*c == L'"') {
+                quoted = true;
+                // behind an odd number of backslashes it is a literal quote
+                inside = bs % 2 == 0 ? !inside : inside;
+            }
+            bs = *c == L'\\' ? bs + 1 : 0;
+        }
+        if (c == b) {
+            continue;
+        }
+
+        size_t first = out.size();
+        bool expanded = glob && !quoted && has_glob(b, c - b) && glob_expand(b, c - b, out);
+        if (!expanded) {
+            tstring word;
+            unquote(b, c, word);
+            out.push_back(std::move(word));
+        }
+        if (!line) {
+            continue;
+        }
+        for (size_t i = first; i < out.size(); i++) {
+            if (!line->empty()) {
+                line->append(L' ');
+            }
+            if (expanded) {
+                append_quoted(*line, out[i]);
+            } else {
+                line->append(b, c - b);
+            }
+        }
+    }
+}
 
-    if (err) {
-        _close(_fileno(stderr));
-        if (restore) {
-            err = CreateFileW(L"CONOUT$", GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, nullptr);
+/*
+ * Builtins get the expanded words directly, however many there are; children
+ * get them re-joined into one command line. Both grow geometrically, so huge
+ * expansions stay linear.
+ */
+static void expand_args(execunit &u)
+{
+    tstring line;
+
+    split_and_glob(u.str.c_str(), u.str.c_str() + u.str.size(), u.args, &line, true);
+    u.str = std::move(line);
+}
+
+static void substitute(void *ctx, const WCHAR *cmd, size_t n, tstring &out);
+
+// expands the for word list, splitting expanded values on blanks
+static void expand_words(const vector<tstring> &words, const stdio_set &io, vector<tstring> &out)
+{
+    tstring w;
+
+    for (const tstring &word : words) {
+        w.clear();
+        expand_vars(word.c_str(), word.size(), w, substitute, (void *)&io);
+        split_and_glob(w.c_str(), w.c_str() + w.size(), out, nullptr, true);
+    }
+}
+
+static int run_condition(const command_list &l, const stdio_set &io)
+{
+    int status;
+
+    t_testing++;
+    status = run_list(l, io);
+    t_testing--;
+    return status;
+}
+
+// the bodies are parsed once and re-run from the cached AST on every pass
+static int run_compound(const compound &ctl, const stdio_set &io)
+{
+    int status = 0;
+
+    switch (ctl.kind) {
+    case CTL_IF:
+        for (size_t i = 0; i < ctl.bodies.size(); i++) {
+            if (i < ctl.conds.size()) {
+                // an exit in the condition ends the construct with its status
+                status = run_condition(ctl.conds[i], io);
+                if (stopped()) {
+                    return status;
+                }
+                if (status != 0) {
+                    continue;
+                }
+            }
+            return run_list(ctl.bodies[i], io);
+        }
+        return 0;
+    case CTL_WHILE:
+        while (true) {
+            int cond = run_condition(ctl.conds[0], io);
+            if (stopped()) {
+                return cond;
+            }
+            if (cond != 0) {
+                break;
+            }
+            status = run_list(ctl.bodies[0], io);
+            if (stopped()) {
+                break;
+            }
+        }
+        break;
+    case CTL_FOR: {
+        vector<tstring> words;
+        expand_words(ctl.words, io, words);
+        for (const tstring &w : words) {
+            if (stopped()) {
+                break;
+            }
+            set_var(ctl.var.c_str(), ctl.var.size(), w.c_str(), w.size());
+            status = run_list(ctl.bodies[0], io);
         }
-        SetStdHandle(STD_ERROR_HANDLE, err);
-        fd = _open_osfhandle((intptr_t)err, _O_WRONLY | _O_WTEXT);
-        _dup2(fd, _fileno(stderr));
+        break;
+    }
     }
+
+    return status;
 }
 
-static inline void do_execute(execunit &u)
+static inline void do_execute(execunit &u, const stdio_set &io)
 {
+    stdio_set sub = {u.h_stdin ? u.h_stdin : io.in,
+                     u.h_stdout ? u.h_stdout : io.out,
+                     u.h_stderr ? u.h_stderr : io.err,
+                     u.use_std_handles,
+                     u.h_stdout ? nullptr : io.cap};
+
+    if (u.st->group || u.st->ctl) {
+        u.is_builtin = true;
+        if (u.st->group) {
+            u.status = run_group(*u.st->group, sub);
+        } else {
+            u.status = run_compound(*u.st->ctl, sub);
+        }
+        // the next stage only sees end of file once our pipe ends are gone
+        u.close_handles();
+        return;
+    }
+
     WCHAR *in = u.str.data();
+    size_t eq;
+
+    if (is_assignment(in, u.str.size(), &eq)) {
+        u.is_builtin = true;
+        set_var(in, eq, in + eq + 1, u.str.size() - eq - 1);
+        u.close_handles();
+        return;
+    }
+
     const struct command *cmd = is_builtin(in);
 
     if (cmd) {
-        vector<WCHAR *> v = split(in);
-        u.is_builtin = true;
-        if (u.use_std_handles) {
-            set_stdhandles(u.h_stdin, u.h_stdout, u.h_stderr, false);
+        vector<WCHAR *> v;
+
+        // the same words a child would get, unless globbing has made them already
+        if (u.args.empty()) {
+            split_and_glob(u.str.c_str(), u.str.c_str() + u.str.size(), u.args, nullptr, false);
         }
-        cmd->handler(v);
-        if (u.use_std_handles) {
-            set_stdhandles(u.h_stdin, u.h_stdout, u.h_stderr, true);
-            // these handles are already close in set_stdhandles()
-            u.h_stdin = nullptr;
-            u.h_stdout = nullptr;
-            u.h_stderr = nullptr;
+        for (tstring &a : u.args) {
+            v.push_back(a.data());
         }
+
+        u.is_builtin = true;
+        // the builtin writes to its own handles, so what the shell holds goes first
+        out_flush();
+        {
+            // a captured builtin writes straight into the capture, with no pipe
+            out_stream out(sub.out);
+            out_stream *o = sub.cap ? &sub.cap->mem : &out;
+            out_stream err(sub.err, o);
+            builtin_io bio = {sub.in, o, &err};
+            u.status = cmd->handler(v, bio);
+        }
+        u.close_handles();
         return;
     }
 
-    create_process(u);
+    create_process(u, io);
 }
 
-static inline unsigned parse_fname(WCHAR *dest, WCHAR *c)
+// whether u runs inside the shell rather than as a child process
+static bool in_shell(execunit &u)
 {
-    unsigned i = 0, j = 0;
+    size_t eq;
+
+    return u.st->group || u.st->ctl || is_assignment(u.str.c_str(), u.str.size(), &eq) || is_builtin(u.str.data());
+}
 
-    while (c[i] != WNULL && iswspace(c[i])) i++;
-    while (c[i + j] != WNULL && !iswspace(c[i + j])) j++;
+// what a stage run on a thread of its own starts from: a copy of the state of the shell running the pipeline
+struct stage_job {
+    execunit *u;
+    stdio_set io;
+    out_stream *bound;
+    var_table vars;
+    vector<int> status;
+    job_limits limits;
+    placement place;
+    bool errexit;
+    int testing;
+};
 
-    memcpy_s(dest, MAX_PATH * sizeof(WCHAR), &c[i], j * sizeof(WCHAR));
-    dest[j] = WNULL;
+static DWORD WINAPI stage_thread(void *param)
+{
+    stage_job *job = (stage_job *)param;
 
-    return i + j;
+    out_bind(job->bound);
+    swap_vars(job->vars);
+    set_status(job->status);
+    set_limits(job->limits);
+    set_placement(job->place);
+    set_errexit(job->errexit);
+    t_testing = job->testing;
+
+    // exit and set -e end only the stage
+    enter_subshell();
+    do_execute(*job->u, job->io);
+    out_flush();
+    delete job;
+    return 0;
+}
+
+/*
+ * A builtin, group or compound stage that is not the last of its pipeline
+ * runs on a thread of its own, so that it cannot fill a pipe that no later
+ * stage is reading yet. Like a subshell, it works on a copy of the shell's
+ * variables, options, limits and placement; the working directory belongs
+ * to the process, so a cd there is seen by every stage. Returns false if
+ * the thread could not start, and the stage is to run in the shell.
+ */
+static bool start_stage(execunit &u, const stdio_set &io)
+{
+    stage_job *job = new stage_job{&u, io, out_bound(), copy_vars(), get_status(), get_limits(), get_placement(),
+                                   errexit(), t_testing};
+
+    u.thread = CreateThread(nullptr, 0, stage_thread, job, 0, nullptr);
+    if (!u.thread) {
+        delete job;
+        return false;
+    }
+    return true;
 }
 
 static int process_pipe(execunit &p, execunit &c)
@@ -224,7 +701,7 @@ static int process_pipe(execunit &p, execunit &c)
     SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
 
     if (CreatePipe(&c.h_stdin, &p.h_stdout, &sa, 0) == FALSE) {
-        wprintf(L"internal error %d\n", GetLastError());
+        out_printf(L"internal error %d\n", GetLastError());
         return -1;
     }
 
@@ -233,7 +710,8 @@ static int process_pipe(execunit &p, execunit &c)
     return 0;
 }
 
-static void wait_all_process(vector<execunit> &v)
+// stages on threads of their own are always joined, since they use the pipeline's execunits
+static void wait_all_process(vector<execunit> &v, bool background)
 {
     DWORD err;
     size_t n = v.size();
@@ -241,130 +719,463 @@ static void wait_all_process(vector<execunit> &v)
     DWORD k = 0;
 
     if (!procs) {
-        wprintf(L"_malloca failed\n");
+        out_printf(L"_malloca failed\n");
         return;
     }
 
     for (size_t i = 0; i < n; i++) {
-        if (!v[i].is_builtin) {
+        if (v[i].thread) {
+            procs[k++] = v[i].thread;
+        } else if (v[i].pi.hProcess && !background) {
             procs[k++] = v[i].pi.hProcess;
         }
     }
 
-    if (k == 0) {
-        _freea(procs);
-        return;
-    }
-
-    err = WaitForMultipleObjects(k, procs, TRUE, INFINITE);
-    if (err == WAIT_FAILED) {
-        wprintf(L"WaitForMultipleObjects failed %d\n", GetLastError());
+    if (k > 0) {
+        err = WaitForMultipleObjects(k, procs, TRUE, INFINITE);
+        if (err == WAIT_FAILED) {
+            out_printf(L"WaitForMultipleObjects failed %d\n", GetLastError());
+        }
     }
 
     for (auto &u : v) {
+        if (u.thread) {
+            CloseHandle(u.thread);
+            u.thread = nullptr;
+        }
+        if (!u.pi.hProcess) {
+            continue;
+        }
+        if (!background) {
+            DWORD code;
+            if (GetExitCodeProcess(u.pi.hProcess, &code) != FALSE) {
+                u.status = (int)code;
+            }
+        }
         CloseHandle(u.pi.hProcess);
         CloseHandle(u.pi.hThread);
     }
     _freea(procs);
 }
 
-static void execute(WCHAR *input)
+// a file opened for > is emptied only once every redirection of the pipeline has opened
+struct redir_file {
+    HANDLE trunc; // private handle used to empty the file, null for >>
+    tstring path;
+    bool created;
+};
+
+struct here_job {
+    HANDLE w;
+    u8string text;
+};
+
+static HANDLE dup_handle(HANDLE h)
+{
+    HANDLE d = nullptr;
+
+    if (DuplicateHandle(GetCurrentProcess(), h, GetCurrentProcess(), &d, 0, TRUE, DUPLICATE_SAME_ACCESS) == FALSE) {
+        return nullptr;
+    }
+    return d;
+}
+
+static HANDLE open_output(const tstring &path, bool append, vector<redir_file> &files)
 {
-    vector<execunit> v(1);
-    execunit *unit = &v[0];
-    size_t n;
-    WCHAR *c = input;
-    WCHAR dest[MAX_PATH];
     SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
+    HANDLE h, trunc = nullptr;
+    bool created;
+
+    // OPEN_ALWAYS keeps the old contents in case a later redirection fails
+    h = CreateFileW(path.c_str(), append ? FILE_APPEND_DATA | SYNCHRONIZE : GENERIC_WRITE,
+                    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, &sa, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                    nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        return h;
+    }
+    created = GetLastError() != ERROR_ALREADY_EXISTS;
+
+    if (!append && DuplicateHandle(GetCurrentProcess(), h, GetCurrentProcess(), &trunc, 0, FALSE,
+                                   DUPLICATE_SAME_ACCESS) == FALSE) {
+        CloseHandle(h);
+        return INVALID_HANDLE_VALUE;
+    }
+    if (trunc || created) {
+        files.push_back(redir_file{trunc, path, created});
+    }
+    return h;
+}
 
-    while (*c != WNULL) {
-        switch (*c) {
-        case L'|':
-            v.push_back(execunit());
-            n = v.size();
-             if (process_pipe(v[n - 2], v[n - 1])) {
-                return;
+// called once all redirections have opened, or with ok false after one failed
+static void finish_redirections(vector<redir_file> &files, bool ok)
+{
+    for (redir_file &f : files) {
+        if (f.trunc) {
+            if (ok) {
+                SetEndOfFile(f.trunc);
             }
-            unit = &v[n - 1];
-            c++;
-            break;
-        case L'\\':
-            unit->str.append(*(c + 1));
-            c += 2;
-            break;
-        case L'<':
-            c++;
-            c += parse_fname(dest, c);
-            unit->h_stdin = CreateFileW(dest, GENERIC_READ, FILE_SHARE_READ, &sa, OPEN_EXISTING,
-                                       FILE_ATTRIBUTE_READONLY | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
-            if (unit->h_stdin == INVALID_HANDLE_VALUE) {
-                wprintf(L"cannot open %s (error %d)\n", dest, GetLastError());
-                return;
+            CloseHandle(f.trunc);
+        }
+        // nothing has been written yet, so a file created for the line goes again
+        if (!ok && f.created) {
+            DeleteFileW(f.path.c_str());
+        }
+    }
+    files.clear();
+}
+
+static void CALLBACK here_write(PTP_CALLBACK_INSTANCE inst, void *param)
+{
+    (void)inst;
+    here_job *job = (here_job *)param;
+    const char *s = job->text.data();
+    size_t n = job->text.size();
+    DWORD written;
+
+    while (n > 0 && WriteFile(job->w, s, (DWORD)n, &written, nullptr) != FALSE) {
+        s += written;
+        n -= written;
+    }
+    CloseHandle(job->w);
+    delete job;
+}
+
+/*
+ * Here-documents and here-strings are fed from memory through a pipe. The
+ * pipe is sized for the whole text, and the write runs on the thread pool
+ * in case the reader has to drain it first.
+ */
+static HANDLE here_pipe(const tstring &text, bool newline)
+{
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
+    here_job *job = new here_job;
+    HANDLE r;
+
+    utf16_to_utf8(text.data(), text.size(), job->text);
+    if (newline) {
+        job->text.append('\n');
+    }
+    if (CreatePipe(&r, &job->w, &sa, (DWORD)job->text.size() + 1) == FALSE) {
+        delete job;
+        return nullptr;
+    }
+    SetHandleInformation(job->w, HANDLE_FLAG_INHERIT, 0);
+    if (!TrySubmitThreadpoolCallback(here_write, job, nullptr)) {
+        here_write(nullptr, job);
+    }
+    return r;
+}
+
+static bool open_redirections(execunit &u, const stage &st, const stdio_set &io, vector<redir_file> &files)
+{
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
+
+    for (const redirection &r : st.redirs) {
+        HANDLE h = INVALID_HANDLE_VALUE;
+        HANDLE *slot;
+        tstring expanded, path;
+        const tstring *target = &r.target;
+
+        if (st.has_vars && !r.quoted) {
+            expand_vars(r.target.c_str(), r.target.size(), expanded, substitute, (void *)&io);
+            target = &expanded;
+        }
+
+        switch (r.kind) {
+        case REDIR_HERESTR:
+        case REDIR_HEREDOC:
+            h = here_pipe(*target, r.kind == REDIR_HERESTR);
+            slot = &u.h_stdin;
+            if (!h) {
+                out_printf(L"cannot create here-document (error %d)\n", GetLastError());
+                return false;
             }
-            unit->use_std_handles = true;
             break;
-        case L'>':
-            c++;
-            c += parse_fname(dest, c);
-            unit->h_stdout = CreateFileW(dest, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa,
-                                        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
-            if (unit->h_stdout == INVALID_HANDLE_VALUE) {
-                wprintf(L"cannot open %s (error %d)\n", dest, GetLastError());
-                return;
+        case REDIR_ERR_OUT:
+            h = dup_handle(u.h_stdout ? u.h_stdout : std_out(io));
+            slot = &u.h_stderr;
+            if (!h) {
+                out_printf(L"cannot redirect stderr (error %d)\n", GetLastError());
+                return false;
             }
-            unit->use_std_handles = true;
             break;
-        case L'2':
-            if (*(c + 1) != L'>') {
-                unit->str.append(*c);
-                c++;
-                break;
+        case REDIR_IN:
+            if (long_path(target->c_str(), path)) {
+                h = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, &sa, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_READONLY | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
             }
-            c += 2;
-            c += parse_fname(dest, c);
-            unit->h_stderr = CreateFileW(dest, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa,
-                                        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
-            if (unit->h_stderr == INVALID_HANDLE_VALUE) {
-                wprintf(L"cannot open %s (error %d)\n", dest, GetLastError());
-                return;
-            }
-            unit->use_std_handles = true;
-            break;
-        case L'&':
-            unit->is_bg_task = true;
-            c++;
+            slot = &u.h_stdin;
             break;
+        case REDIR_OUT:
+        case REDIR_ERR:
+        case REDIR_ALL:
         default:
-            unit->str.append(*c);
-            c++;
+            if (long_path(target->c_str(), path)) {
+                h = open_output(path, r.append, files);
+            }
+            slot = r.kind == REDIR_ERR ? &u.h_stderr : &u.h_stdout;
             break;
         }
+
+        if (h == INVALID_HANDLE_VALUE) {
+            out_printf(L"cannot open %s (error %d)\n", target->c_str(), GetLastError());
+            return false;
+        }
+
+        // an explicit redirection wins over the pipe end set up for this stage
+        if (*slot) {
+            CloseHandle(*slot);
+        }
+        *slot = h;
+        u.use_std_handles = true;
+
+        if (r.kind == REDIR_ALL) {
+            h = dup_handle(h);
+            if (!h) {
+                out_printf(L"cannot redirect stderr (error %d)\n", GetLastError());
+                return false;
+            }
+            if (u.h_stderr) {
+                CloseHandle(u.h_stderr);
+            }
+            u.h_stderr = h;
+        }
     }
 
-    for (execunit &u : v) {
-        u.str.strip();
-        do_execute(u);
+    return true;
+}
+
+// returns the exit status of the last stage
+static int run_pipeline(const pipeline &p, const stdio_set &io)
+{
+    size_t n = p.stages.size();
+    vector<execunit> v(n);
+    vector<redir_file> files;
+    HANDLE job;
+
+    if (!open_job(&job)) {
+        out_printf(L"cannot set up limits (error %d)\n", GetLastError());
+        set_status({1});
+        return 1;
+    }
+
+    // set up every pipe and file first, so a failure starts nothing
+    for (size_t i = 0; i < n; i++) {
+        const stage &st = p.stages[i];
+        v[i].st = &st;
+        if (st.has_vars) {
+            expand_vars(st.text.c_str(), st.text.size(), v[i].str, substitute, (void *)&io);
+        } else {
+            v[i].str = st.text;
+        }
+        if (st.has_glob) {
+            expand_args(v[i]);
+        }
+        v[i].is_bg_task = p.background;
+        v[i].use_std_handles = io.redirected;
+        v[i].job = job;
+        v[i].placed = place_stage(i, n, &v[i].affinity);
+        if (i > 0 && process_pipe(v[i - 1], v[i])) {
+            close_job(job);
+            set_status({1});
+            return 1;
+        }
     }
 
-    wait_all_process(v);
+    // after the pipes, so that 2>&1 finds the pipe a stage writes to
+    for (size_t i = 0; i < n; i++) {
+        if (!open_redirections(v[i], p.stages[i], io, files)) {
+            finish_redirections(files, false);
+            close_job(job);
+            set_status({1});
+            return 1;
+        }
+    }
+    finish_redirections(files, true);
+
+    for (size_t i = 0; i < n; i++) {
+        if (i + 1 < n && in_shell(v[i]) && start_stage(v[i], io)) {
+            continue;
+        }
+        do_execute(v[i], io);
+    }
+
+    wait_all_process(v, p.background);
+    close_job(job);
+    if (io.cap) {
+        drain_capture(*io.cap);
+    }
+
+    // a background pipeline counts as a success; its statuses are never read
+    vector<int> stages(p.background ? 1 : n, 0);
+    for (size_t i = 0; i < n && !p.background; i++) {
+        stages[i] = v[i].status;
+    }
+    set_status(stages);
+    return stages.back();
+}
+
+static int run_list(const command_list &l, const stdio_set &io)
+{
+    size_t n = l.items.size();
+    int status = 0;
+
+    for (size_t i = 0; i < n && !stopped(); i++) {
+        const list_item &item = l.items[i];
+        if ((item.op == LIST_AND && status != 0) || (item.op == LIST_OR && status == 0)) {
+            continue;
+        }
+        status = run_pipeline(item.p, io);
+
+        // a failure followed by && or || is being tested, like a condition
+        if (status != 0 && errexit() && t_testing == 0 && (i + 1 == n || l.items[i + 1].op == LIST_SEQ)) {
+            set_stopped(true);
+        }
+    }
+
+    return status;
+}
+
+static parse_cache g_parse_cache(256);
+
+static int execute(const WCHAR *input, bool *incomplete)
+{
+    ast_ptr p = g_parse_cache.get(input, incomplete);
+    stdio_set io = {GetStdHandle(STD_INPUT_HANDLE),
+                    GetStdHandle(STD_OUTPUT_HANDLE),
+                    GetStdHandle(STD_ERROR_HANDLE),
+                    false,
+                    nullptr};
+
+    int status;
+
+    // a line that only leaves a construct open is not an error yet, and keeps $?
+    if (!p) {
+        if (!incomplete || !*incomplete) {
+            set_status({2});
+        }
+        return 2;
+    }
+
+    status = run_list(*p, io);
+    if (stopped()) {
+        out_flush();
+        exit(status);
+    }
+    return status;
+}
+
+/*
+ * $( ... ) and ` ... `: the command runs as a subshell, like a group, with
+ * its output captured in memory, which is then split into words joined by
+ * single blanks, so line breaks become separators and trailing ones are
+ * dropped.
+ */
+static void substitute(void *ctx, const WCHAR *cmd, size_t n, tstring &out)
+{
+    const stdio_set &outer = *(const stdio_set *)ctx;
+    tstring line(cmd, n);
+    ast_ptr p = g_parse_cache.get(line.c_str());
+    capture cap;
+    u8string bytes;
+    tstring text;
+    const WCHAR *c, *end;
+    bool first = true;
+
+    if (!p) {
+        return;
+    }
+    cap.w = nullptr;
+    cap.done = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (!cap.done) {
+        out_printf(L"cannot capture output (error %d)\n", GetLastError());
+        return;
+    }
+
+    stdio_set io = {outer.in, nullptr, outer.err, true, &cap};
+    run_group(*p, io);
+    drain_capture(cap);
+    CloseHandle(cap.done);
+
+    cap.mem.take(bytes);
+    utf8_to_utf16(bytes.data(), bytes.size(), text);
+    c = text.c_str();
+    end = c + text.size();
+    while (c < end) {
+        while (c < end && iswspace(*c)) c++;
+        const WCHAR *b = c;
+        while (c < end && !iswspace(*c)) c++;
+        if (c > b) {
+            if (!first) {
+                out.append(L' ');
+            }
+            out.append(b, c - b);
+            first = false;
+        }
+    }
+}
+
+// a command line sent to --serve, run with the handles of its request
+static int run_served(const WCHAR *line, HANDLE in, HANDLE out, HANDLE err)
+{
+    ast_ptr p = g_parse_cache.get(line);
+    stdio_set io = {in, out, err, true, nullptr};
+    job_limits limits = get_limits();
+    placement place = get_placement();
+    bool stop_on_error = errexit();
+    int status;
+
+    if (!p) {
+        return 2;
+    }
+
+    // limits, placement and options a request sets end with it, and so does an exit
+    enter_subshell();
+    status = run_list(*p, io);
+    leave_subshell();
+    set_stopped(false);
+    set_limits(limits);
+    set_placement(place);
+    set_errexit(stop_on_error);
+    return status;
 }
 
+// with --connect, options end at the first word of the command to send
 static void parse_args(int argc, WCHAR *argv[])
 {
     int option;
     int opt_index = 0;
 
-    while ((option = getoptW_long(argc, argv, L"f:hv", g_long_opts, &opt_index)) != -1) {
+    while ((option = getoptW_long(argc, argv, L"+f:hvn:e:", g_long_opts, &opt_index)) != -1) {
         switch (option) {
         case L'f':
             wcscpy_s(g_config, optarg);
             break;
+        case L's':
+            g_serve = optarg;
+            break;
+        case L'c':
+            g_connect = optarg;
+            break;
+        case L'n':
+            g_repeat = _wtoi(optarg);
+            break;
+        case L'e':
+            g_env.push_back(optarg);
+            break;
         case L'h':
         case L'v':
         default:
             break;
         }
     }
+
+    for (int i = optind; i < argc; i++) {
+        if (i > optind) {
+            g_command.append(L' ');
+        }
+        g_command.append(argv[i]);
+    }
 }
 
 static void parse_config()
@@ -373,7 +1184,8 @@ static void parse_config()
         FILE_ATTRIBUTE_READONLY | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
 
     if (fp == INVALID_HANDLE_VALUE) {
-        wprintf(L"open config file \"%s\" failed %d\n", g_config, GetLastError());
+        out_printf(L"open config file \"%s\" failed %d\n", g_config, GetLastError());
+        out_flush();
         exit(1);
     }
 
@@ -385,33 +1197,120 @@ static void parse_config()
     CloseHandle(fp);
 }
 
+/*
+ * Reads one line of input, without its line break. A console is read as
+ * UTF-16 directly; anything else is read in blocks as UTF-8, so neither
+ * needs the CRT's locale. Returns false at the end of input.
+ */
+static bool read_line(HANDLE in, bool console, tstring &line)
+{
+    static char buf[4096];
+    static DWORD pos, len;
+    DWORD n;
+
+    line.clear();
+    if (console) {
+        WCHAR w[1024];
+        while (ReadConsoleW(in, w, _countof(w), &n, nullptr) != FALSE && n > 0) {
+            line.append(w, n);
+            if (w[n - 1] == L'\n') {
+                break;
+            }
+        }
+        if (line.empty()) {
+            return false;
+        }
+    } else {
+        u8string bytes;
+        while (true) {
+            if (pos == len) {
+                pos = 0;
+                if (ReadFile(in, buf, sizeof(buf), &len, nullptr) == FALSE || len == 0) {
+                    len = 0;
+                    if (bytes.empty()) {
+                        return false;
+                    }
+                    break;
+                }
+            }
+            const char *p = buf + pos;
+            const char *nl = (const char *)memchr(p, '\n', len - pos);
+            n = nl ? (DWORD)(nl - p) + 1 : len - pos;
+            bytes.append(p, n);
+            pos += n;
+            if (nl) {
+                break;
+            }
+        }
+        utf8_to_utf16(bytes.data(), bytes.size(), line);
+    }
+
+    n = (DWORD)line.size();
+    while (n > 0 && (line.c_str()[n - 1] == L'\n' || line.c_str()[n - 1] == L'\r')) n--;
+    line.resize(n);
+    return true;
+}
+
 int wmain(int argc, WCHAR *argv[])
 {
-    WCHAR buf[1024];
+    HANDLE in = GetStdHandle(STD_INPUT_HANDLE);
+    tstring buf;
     WCHAR *line;
-
-    _wsetlocale(LC_ALL, L".utf8");
-    wprintf(L"Console CP is %u\n", GetConsoleCP());
-    wprintf(L"Set Console CP to UTF-8 (65001) %d\n", SetConsoleCP(65001));
-    wprintf(L"Console CP is %u\n", GetConsoleCP());
+    tstring script;
+    bool incomplete;
+    bool interactive;
+    int status = 0;
 
     parse_args(argc, argv);
+
+    if (g_serve) {
+        return serve(g_serve, run_served);
+    }
+    if (g_connect) {
+        return serve_connect(g_connect, g_command.c_str(), g_env, g_repeat > 0 ? g_repeat : 1);
+    }
+
+    // scripts and pipes get no prompts and leave the console alone
+    interactive = is_console(in);
+    if (interactive) {
+        SetConsoleCP(65001);
+    }
+
     if (wcslen(g_config)) {
         parse_config();
     }
 
     while (true) {
-        ZeroMemory(buf, sizeof(buf));
-        fputws(L"$> ", stdout);
-        _getws_s(buf, _countof(buf));
+        if (interactive) {
+            out_printf(script.empty() ? L"$> " : L"> ");
+        }
+        out_flush();
+        if (!read_line(in, interactive, buf)) {
+            break;
+        }
 
-        line = strip(buf);
-        if (wcslen(line) == 0) {
+        // continuation lines may be here-document text, which keeps its indentation
+        line = script.empty() ? strip(buf.data()) : buf.data();
+        if (wcslen(line) == 0 && script.empty()) {
             continue;
         }
 
-        execute(line);
+        // keep reading while an if/while/for or group is still open
+        if (!script.empty()) {
+            script.append(L'\n');
+        }
+        script.append(line);
+        status = execute(script.c_str(), &incomplete);
+        if (!incomplete) {
+            script.clear();
+        }
     }
 
-    return 0;
-}
\ No newline at end of file
+    // input ended inside an open construct: report it as the syntax error it is
+    if (!script.empty()) {
+        status = execute(script.c_str(), nullptr);
+    }
+    out_flush();
+
+    return status;
+}
@@ -0,0 +1,176 @@
+#include <emmintrin.h>
+
+#include "utf.h"
+
+#define REPLACEMENT_CHAR 0xFFFD
+
+static inline size_t utf8_decode(const unsigned char *s, size_t n, unsigned *cp)
+{
+    unsigned c = s[0];
+    unsigned min;
+    size_t len;
+
+    if (c < 0x80) {
+        *cp = c;
+        return 1;
+    } else if (c >= 0xC2 && c <= 0xDF) {
+        len = 2;
+        min = 0x80;
+        c &= 0x1F;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        len = 3;
+        min = 0x800;
+        c &= 0x0F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        len = 4;
+        min = 0x10000;
+        c &= 0x07;
+    } else {
+        *cp = REPLACEMENT_CHAR;
+        return 1;
+    }
+
+    if (len > n) {
+        *cp = REPLACEMENT_CHAR;
+        return 1;
+    }
+
+    for (size_t i = 1; i < len; i++) {
+        if ((s[i] & 0xC0) != 0x80) {
+            *cp = REPLACEMENT_CHAR;
+            return i;
+        }
+        c = (c << 6) | (s[i] & 0x3F);
+    }
+
+    if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+        c = REPLACEMENT_CHAR;
+    }
+
+    *cp = c;
+    return len;
+}
+
+size_t utf8_to_utf16(const char *src, size_t n, WCHAR *dst)
+{
+    const unsigned char *s = (const unsigned char *)src;
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0, j = 0;
+
+    while (i < n) {
+        // ASCII fast path: widen 16 bytes to 16 code units
+        while (i + 16 <= n) {
+            __m128i v = _mm_loadu_si128((const __m128i *)&s[i]);
+            if (_mm_movemask_epi8(v)) {
+                break;
+            }
+            _mm_storeu_si128((__m128i *)&dst[j], _mm_unpacklo_epi8(v, zero));
+            _mm_storeu_si128((__m128i *)&dst[j + 8], _mm_unpackhi_epi8(v, zero));
+            i += 16;
+            j += 16;
+        }
+
+        if (i == n) {
+            break;
+        }
+
+        unsigned cp;
+        i += utf8_decode(&s[i], n - i, &cp);
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            dst[j++] = (WCHAR)(0xD800 | (cp >> 10));
+            dst[j++] = (WCHAR)(0xDC00 | (cp & 0x3FF));
+        } else {
+            dst[j++] = (WCHAR)cp;
+        }
+    }
+
+    return j;
+}
+
+size_t utf16_to_utf8(const WCHAR *src, size_t n, char *dst)
+{
+    unsigned char *d = (unsigned char *)dst;
+    const __m128i high = _mm_set1_epi16((short)0xFF80);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0, j = 0;
+
+    while (i < n) {
+        // ASCII fast path: narrow 16 code units to 16 bytes
+        while (i + 16 <= n) {
+            __m128i a = _mm_loadu_si128((const __m128i *)&src[i]);
+            __m128i b = _mm_loadu_si128((const __m128i *)&src[i + 8]);
+            __m128i t = _mm_and_si128(_mm_or_si128(a, b), high);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(t, zero)) != 0xFFFF) {
+                break;
+            }
+            _mm_storeu_si128((__m128i *)&d[j], _mm_packus_epi16(a, b));
+            i += 16;
+            j += 16;
+        }
+
+        if (i == n) {
+            break;
+        }
+
+        unsigned c = src[i++];
+        if (c >= 0xD800 && c <= 0xDBFF && i < n && src[i] >= 0xDC00 && src[i] <= 0xDFFF) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (src[i++] - 0xDC00);
+        } else if (c >= 0xD800 && c <= 0xDFFF) {
+            c = REPLACEMENT_CHAR;
+        }
+
+        if (c < 0x80) {
+            d[j++] = (unsigned char)c;
+        } else if (c < 0x800) {
+            d[j++] = (unsigned char)(0xC0 | (c >> 6));
+            d[j++] = (unsigned char)(0x80 | (c & 0x3F));
+        } else if (c < 0x10000) {
+            d[j++] = (unsigned char)(0xE0 | (c >> 12));
+            d[j++] = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+            d[j++] = (unsigned char)(0x80 | (c & 0x3F));
+        } else {
+            d[j++] = (unsigned char)(0xF0 | (c >> 18));
+            d[j++] = (unsigned char)(0x80 | ((c >> 12) & 0x3F));
+            d[j++] = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+            d[j++] = (unsigned char)(0x80 | (c & 0x3F));
+        }
+    }
+
+    return j;
+}
+
+void utf8_to_utf16(const char *src, size_t n, tstring &out)
+{
+    size_t k = out.size();
+
+    out.reserve(k + n);
+    out.resize(k + utf8_to_utf16(src, n, out.data() + k));
+}
+
+void utf16_to_utf8(const WCHAR *src, size_t n, u8string &out)
+{
+    size_t k = out.size();
+
+    out.reserve(k + 3 * n);
+    out.resize(k + utf16_to_utf8(src, n, out.data() + k));
+}
+
+size_t utf8_boundary(const char *s, size_t n)
+{
+    size_t i = n;
+    size_t k = 0;
+
+    // walk back over at most three continuation bytes to the lead byte
+    while (i > 0 && k < 4) {
+        unsigned char c = (unsigned char)s[--i];
+        k++;
+        if ((c & 0xC0) == 0x80) {
+            continue;
+        }
+        size_t len = c < 0x80 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        return k >= len ? n : i;
+    }
+
+    return n;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <Windows.h>
+
+#include "container.h"
+
+/*
+ * UTF-8 <-> UTF-16 transcoding for the Win32 API boundary.
+ *
+ * Both directions convert 16 ASCII characters per step with SSE2 and fall
+ * back to a scalar decoder for multibyte sequences. Malformed input is
+ * replaced with U+FFFD instead of being rejected.
+ */
+
+// dst must have room for n code units; returns the number written
+size_t utf8_to_utf16(const char *src, size_t n, WCHAR *dst);
+
+// dst must have room for 3 * n bytes; returns the number written
+size_t utf16_to_utf8(const WCHAR *src, size_t n, char *dst);
+
+void utf8_to_utf16(const char *src, size_t n, tstring &out);
+void utf16_to_utf8(const WCHAR *src, size_t n, u8string &out);
+
+// length of the longest prefix of s[0, n) that does not end inside a sequence
+size_t utf8_boundary(const char *s, size_t n);
@@ -0,0 +1,282 @@
+#include <string>
+#include <unordered_map>
+
+#include "vars.h"
+
+using namespace std;
+
+static thread_local var_table t_vars;
+static thread_local std::vector<int> t_status = {0};
+static thread_local bool t_errexit;
+static thread_local bool t_stopped;
+static thread_local int t_subshells;
+
+static inline bool is_name_char(WCHAR c, bool first)
+{
+    return c == L'_' || (c >= L'A' && c <= L'Z') || (c >= L'a' && c <= L'z') ||
+           (!first && c >= L'0' && c <= L'9');
+}
+
+static void append_int(tstring &value, int v)
+{
+    WCHAR num[16];
+
+    swprintf_s(num, L"%d", v);
+    value.append(num);
+}
+
+// $? and PIPESTATUS, PIPESTATUS[i] or PIPESTATUS[@]
+static bool get_status(const wstring &key, tstring &value)
+{
+    const size_t k = wcslen(L"PIPESTATUS");
+    WCHAR *end;
+
+    if (key == L"?") {
+        append_int(value, t_status.back());
+        return true;
+    }
+    if (key.compare(0, k, L"PIPESTATUS") != 0) {
+        return false;
+    }
+    if (key.size() == k) {
+        append_int(value, t_status.front());
+        return true;
+    }
+    if (key[k] != L'[' || key.back() != L']') {
+        return false;
+    }
+    if (key.compare(k, wstring::npos, L"[@]") == 0 || key.compare(k, wstring::npos, L"[*]") == 0) {
+        for (size_t i = 0; i < t_status.size(); i++) {
+            if (i > 0) {
+                value.append(L' ');
+            }
+            append_int(value, t_status[i]);
+        }
+        return true;
+    }
+    if (!iswdigit(key[k + 1])) {
+        return false;
+    }
+    size_t i = wcstoul(&key[k + 1], &end, 10);
+    if (*end != L']' || i >= t_status.size()) {
+        // an index past the last stage is simply unset
+        return *end == L']';
+    }
+    append_int(value, t_status[i]);
+    return true;
+}
+
+bool get_var(const WCHAR *name, size_t n, tstring &value)
+{
+    wstring key(name, n);
+    auto it = t_vars.find(key);
+
+    if (get_status(key, value)) {
+        return true;
+    }
+
+    if (it != t_vars.end()) {
+        value.append(it->second);
+        return true;
+    }
+
+    DWORD k = GetEnvironmentVariableW(key.c_str(), nullptr, 0);
+    if (k == 0) {
+        return false;
+    }
+
+    size_t at = value.size();
+    value.resize(at + k);
+    value.resize(at + GetEnvironmentVariableW(key.c_str(), value.data() + at, k));
+    return true;
+}
+
+void set_var(const WCHAR *name, size_t n, const WCHAR *value, size_t vn)
+{
+    t_vars[wstring(name, n)] = tstring(value, vn);
+}
+
+void swap_vars(var_table &t)
+{
+    t_vars.swap(t);
+}
+
+var_table copy_vars()
+{
+    return t_vars;
+}
+
+// just past the end of the $( ... ) or ` ... ` that opens at s[k]; 0 if it is not closed
+static size_t substitution_end(const WCHAR *s, size_t k, size_t n)
+{
+    WCHAR close = s[k] == L'`' ? L'`' : L')';
+    int depth = 1;
+
+    for (size_t i = k + 1; i < n; i++) {
+        if (s[i] == L'\\') {
+            i++;
+        } else if (s[i] == close && --depth == 0) {
+            return i + 1;
+        } else if (s[i] == L'(' && close == L')') {
+            depth++;
+        }
+    }
+    return 0;
+}
+
+void expand_vars(const WCHAR *s, size_t n, tstring &out, subst_fn subst, void *ctx)
+{
+    size_t i = 0;
+
+    while (i < n) {
+        size_t j = i;
+        while (j < n && s[j] != L'$' && s[j] != L'\\' && s[j] != L'`') j++;
+        out.append(&s[i], j - i);
+        if (j == n) {
+            break;
+        }
+
+        if (s[j] == L'\\') {
+            // only \$ and \` survive parsing; any other backslash is literal
+            if (j + 1 < n && (s[j + 1] == L'$' || s[j + 1] == L'`')) {
+                j++;
+            }
+            out.append(s[j]);
+            i = j + 1;
+            continue;
+        }
+
+        size_t k = s[j] == L'`' ? j : j + 1;
+        if (k < n && (s[k] == L'`' || s[k] == L'(')) {
+            size_t e = substitution_end(s, k, n);
+            if (e == 0 || !subst) {
+                // left as it is when open or when nothing can run it
+                e = e ? e : n;
+                out.append(&s[j], e - j);
+            } else {
+                subst(ctx, &s[k + 1], e - k - 2, out);
+            }
+            i = e;
+            continue;
+        }
+        if (k < n && s[k] == L'{') {
+            size_t e = k + 1;
+            while (e < n && s[e] != L'}') e++;
+            if (e < n) {
+                get_var(&s[k + 1], e - k - 1, out);
+                i = e + 1;
+                continue;
+            }
+        } else if (k < n && s[k] == L'?') {
+            get_var(&s[k], 1, out);
+            i = k + 1;
+            continue;
+        } else if (k < n && is_name_char(s[k], true)) {
+            size_t e = k + 1;
+            while (e < n && is_name_char(s[e], false)) e++;
+            get_var(&s[k], e - k, out);
+            i = e;
+            continue;
+        }
+
+        // a lone $ is just a dollar sign
+        out.append(L'$');
+        i = k;
+    }
+}
+
+bool is_assignment(const WCHAR *s, size_t n, size_t *eq)
+{
+    size_t i = 0;
+
+    if (n == 0 || !is_name_char(s[0], true)) {
+        return false;
+    }
+    while (i < n && is_name_char(s[i], false)) i++;
+    if (i == n || s[i] != L'=') {
+        return false;
+    }
+    for (size_t j = i + 1; j < n; j++) {
+        if (iswspace(s[j])) {
+            return false;
+        }
+    }
+
+    *eq = i;
+    return true;
+}
+
+void set_status(const vector<int> &stages)
+{
+    if (!stages.empty()) {
+        t_status = stages;
+    }
+}
+
+vector<int> get_status()
+{
+    return t_status;
+}
+
+int last_status()
+{
+    return t_status.back();
+}
+
+bool errexit()
+{
+    return t_errexit;
+}
+
+void set_errexit(bool on)
+{
+    t_errexit = on;
+}
+
+bool stopped()
+{
+    return t_stopped;
+}
+
+void set_stopped(bool on)
+{
+    t_stopped = on;
+}
+
+void enter_subshell()
+{
+    t_subshells++;
+}
+
+void leave_subshell()
+{
+    t_subshells--;
+}
+
+bool in_subshell()
+{
+    return t_subshells > 0;
+}
+
+int do_builtin_set(vector<WCHAR *> &args, builtin_io &io)
+{
+    size_t n = args.size();
+    bool on = t_errexit;
+
+    if (n == 1) {
+        io.out->printf(L"set %ce\n", t_errexit ? L'-' : L'+');
+        return 0;
+    }
+
+    for (size_t i = 1; i < n; i++) {
+        const WCHAR *opt = args[i];
+        if ((opt[0] != L'-' && opt[0] != L'+') || opt[1] != L'e' || opt[2] != WNULL) {
+            io.out->printf(L"set: unknown option %s\n", opt);
+            return 1;
+        }
+        on = opt[0] == L'-';
+    }
+
+    t_errexit = on;
+    return 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Windows.h>
+
+#include "builtin.h"
+#include "container.h"
+
+/*
+ * Shell variables. Lookups fall back to the process environment, so $PATH
+ * and friends expand without being copied into the shell's own table.
+ *
+ * $? is the exit status of the last pipeline and ${PIPESTATUS[i]} that of
+ * its stage i; ${PIPESTATUS[@]} gives all of them and $PIPESTATUS the first.
+ *
+ * Variables, statuses and options belong to the calling thread, so that a
+ * pipeline stage the shell runs on a thread of its own works on a copy.
+ */
+
+bool get_var(const WCHAR *name, size_t n, tstring &value);
+void set_var(const WCHAR *name, size_t n, const WCHAR *value, size_t vn);
+
+// runs the command cmd[0, n) of a $( ... ) or ` ... ` and appends its output to out
+using subst_fn = void (*)(void *ctx, const WCHAR *cmd, size_t n, tstring &out);
+
+// appends s[0, n) to out with $name and ${name} replaced; \$ gives a literal $.
+// $( ... ) and ` ... ` are replaced by what subst appends, or kept without one.
+void expand_vars(const WCHAR *s, size_t n, tstring &out, subst_fn subst = nullptr, void *ctx = nullptr);
+
+// is s a NAME=value assignment? *eq receives the position of the '='
+bool is_assignment(const WCHAR *s, size_t n, size_t *eq);
+
+using var_table = std::unordered_map<std::wstring, tstring>;
+
+// exchanges the shell's variables with t, so a served command runs with its own
+void swap_vars(var_table &t);
+// a copy of them, for a subshell to put back when it ends
+var_table copy_vars();
+
+// records the exit statuses of a pipeline's stages; the last one is $?
+void set_status(const std::vector<int> &stages);
+std::vector<int> get_status();
+int last_status();
+
+/*
+ * Shell options:
+ *
+ *   set                   show them
+ *   set -e                stop when a pipeline fails, unless it is tested
+ *                         by if, while, && or || (errexit)
+ *   set +e                keep going (the default)
+ */
+bool errexit();
+void set_errexit(bool on);
+
+// set -e or exit has stopped the lists that are running, up to where it ends
+bool stopped();
+void set_stopped(bool on);
+
+// exit ends the shell, except inside a subshell or a served request, where it ends only that
+void enter_subshell();
+void leave_subshell();
+bool in_subshell();
+
+int do_builtin_set(std::vector<WCHAR *> &args, builtin_io &io);
@@ -0,0 +1,116 @@
+#include "dir.h"
+#include "output.h"
+#include "path.h"
+#include "walk.h"
+
+namespace {
+
+struct walker {
+    walk_fn fn;
+    void *ctx;
+    out_stream *msg;
+    volatile LONG pending;
+    volatile LONG errors;
+    HANDLE done;
+};
+
+struct walk_job {
+    walker *w;
+    tstring dir;
+};
+
+} // namespace
+
+static void submit(walker *w, const tstring &dir);
+
+static void finish(walker *w)
+{
+    if (InterlockedDecrement(&w->pending) == 0) {
+        SetEvent(w->done);
+    }
+}
+
+static void CALLBACK walk_dir(PTP_CALLBACK_INSTANCE inst, void *param)
+{
+    (void)inst;
+    walk_job *job = (walk_job *)param;
+    walker *w = job->w;
+    tstring &path = job->dir;
+    size_t n = path.size();
+    WCHAR last = n ? path[(unsigned)n - 1] : L'\0';
+    dir_iter it(path.c_str());
+
+    if (it.error() != ERROR_SUCCESS) {
+        w->msg->printf(L"cannot read %s (error %d)\n", path.c_str(), it.error());
+        InterlockedIncrement(&w->errors);
+    }
+
+    if (n && last != L'\\' && last != L'/') {
+        path.append(L'\\');
+        n++;
+    }
+
+    while (it.next()) {
+        if (is_dot_dir(it.name())) {
+            continue;
+        }
+        path.append(it.name());
+        w->fn(w->ctx, path, it.entry());
+        if (it.is_dir() && !it.is_reparse()) {
+            submit(w, path);
+        }
+        path.resize(n);
+    }
+
+    delete job;
+    finish(w);
+}
+
+static void submit(walker *w, const tstring &dir)
+{
+    walk_job *job = new walk_job{w, dir};
+
+    InterlockedIncrement(&w->pending);
+    // without a free pool slot the directory is listed on this thread
+    if (!TrySubmitThreadpoolCallback(walk_dir, job, nullptr)) {
+        walk_dir(nullptr, job);
+    }
+}
+
+int parallel_walk(const WCHAR *root, walk_fn fn, void *ctx, out_stream &msg)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    tstring path;
+
+    if (!long_path(root, path) || !GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &attr)) {
+        msg.printf(L"cannot access %s (error %d)\n", root, GetLastError());
+        return -1;
+    }
+
+    if (!(attr.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        WIN32_FIND_DATAW data;
+        ZeroMemory(&data, sizeof(data));
+        data.dwFileAttributes = attr.dwFileAttributes;
+        data.ftCreationTime = attr.ftCreationTime;
+        data.ftLastAccessTime = attr.ftLastAccessTime;
+        data.ftLastWriteTime = attr.ftLastWriteTime;
+        data.nFileSizeHigh = attr.nFileSizeHigh;
+        data.nFileSizeLow = attr.nFileSizeLow;
+        fn(ctx, tstring(root), data);
+        return 0;
+    }
+
+    walker w = {fn, ctx, &msg, 1, 0, CreateEventW(nullptr, TRUE, FALSE, nullptr)};
+    if (!w.done) {
+        msg.printf(L"cannot walk %s (error %d)\n", root, GetLastError());
+        return -1;
+    }
+
+    // the extra count held here keeps done unsignaled until every job is queued
+    submit(&w, tstring(root));
+    finish(&w);
+    WaitForSingleObject(w.done, INFINITE);
+    CloseHandle(w.done);
+
+    return (int)w.errors;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <Windows.h>
+
+#include "container.h"
+#include "output.h"
+
+/*
+ * Parallel directory walk on the process thread pool.
+ *
+ * Every directory is listed by its own work item, and the subdirectories it
+ * finds are queued as new items, so wide trees keep all workers busy. The
+ * callback runs concurrently on pool threads for every entry below root
+ * (or once for root itself when it is not a directory) and must be thread
+ * safe. path is the entry's path in the form root was given. Reparse points
+ * are reported but not followed.
+ */
+
+using walk_fn = void (*)(void *ctx, const tstring &path, const WIN32_FIND_DATAW &data);
+
+// -1 if root cannot be accessed, else the number of directories that could not be listed;
+// those are reported to msg
+int parallel_walk(const WCHAR *root, walk_fn fn, void *ctx, out_stream &msg);